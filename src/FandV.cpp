@@ -19,6 +19,17 @@ using namespace flint;
 #include "FandV_ct.h"
 #include "FandV_ct_vec.h"
 #include "FandV_ct_mat.h"
+#include "FandV_ct_mmat.h"
+#include "FandV_ct_smat.h"
+#include "FandV_compress.h"
+#include "FandV_stream.h"
+#include "FandV_bench.h"
+#include "FandV_prof.h"
+#include "FandV_mem.h"
+#include "FandV_sched.h"
+#include "FandV_async.h"
+#include "FandV_lazy.h"
+#include "FandV_keyring.h"
 
 // More detailed info on memory usage.  Rcpp modules exist outside R's direct
 // control, so gc() useless for finding out memory usage.
@@ -34,15 +45,57 @@ void HEmem() {
   #endif
 }
 
+// Running count of deep cipher text copies, so tests can check that the
+// container kernels only move
+double FandV_ct_copies() {
+  return((double) FandV_ct::copies);
+}
+
+// Coefficients are reduced in place into (-q/2, q/2], skipping those already
+// there, and with q = 2^qpow the reduction is a shift
+void fmpz_vec_q(fmpz* c, slong len, const fmpz* q) {
+  fmpz_t qo2;
+  fmpz_init(qo2);
+  fmpz_fdiv_q_2exp(qo2, q, 1);
+  mp_bitcnt_t qpow = fmpz_bits(q)-1;
+  bool pow2 = fmpz_sgn(q) > 0 && fmpz_val2(q) == qpow;
+  
+  for(slong i=0; i<len; i++) {
+    if(fmpz_cmpabs(c+i, qo2) < 0 || fmpz_equal(c+i, qo2))
+      continue;
+    if(pow2)
+      fmpz_fdiv_r_2exp(c+i, c+i, qpow);
+    else
+      fmpz_mod(c+i, c+i, q);
+    if(fmpz_cmp(c+i, qo2) > 0)
+      fmpz_sub(c+i, c+i, q);
+  }
+  
+  fmpz_clear(qo2);
+}
+
 // Do centred modulo q reduction of all coefficients of polynomial p ... [p]_q
-void fmpz_polyxx_q(fmpz_polyxx& p, fmpzxx q) {
-  fmpzxx tmp, qo2(q/2);
-  for(int i=0; i<p.length(); i++) {
-    tmp = p.get_coeff(i)%q;
-    if(tmp > qo2)
-      tmp -= q;
-    p.set_coeff(i, tmp);
+void fmpz_polyxx_q(fmpz_polyxx& p, const fmpzxx& q) {
+  fmpz_vec_q(p._poly()->coeffs, p.length(), q._fmpz());
+  _fmpz_poly_normalise(p._poly());
+}
+
+std::size_t fmpz_polyxx_bytes(const fmpz_polyxx& p) {
+  const fmpz_poly_struct* x = p._poly();
+  std::size_t bytes = x->alloc*sizeof(fmpz);
+  for(slong i=0; i<x->alloc; i++) {
+    if(COEFF_IS_MPZ(x->coeffs[i])) {
+      __mpz_struct* z = COEFF_TO_PTR(x->coeffs[i]);
+      bytes += sizeof(__mpz_struct) + z->_mp_alloc*sizeof(mp_limb_t);
+    }
   }
+  return(bytes);
+}
+
+std::size_t fmpzxx_bytes(const fmpzxx& x) {
+  if(!COEFF_IS_MPZ(*x._fmpz()))
+    return(0);
+  return(sizeof(__mpz_struct) + COEFF_TO_PTR(*x._fmpz())->_mp_alloc*sizeof(mp_limb_t));
 }
 
 void fmpz_rand(fmpzxx &p, unsigned int bits) { // Random number from 0 to 2^bits-1
@@ -100,7 +153,7 @@ void save_FandV_ct(const FandV_ct& ct, const std::string& file) {
   // pars
   ct.p.save(fp);
   // rlk
-  (ct.rlkl->x[ct.rlki]).save(fp);
+  ct.rlkl->get(ct.rlki)->save(fp);
   // ct content
   ct.save(fp);
   
@@ -153,9 +206,9 @@ void save_FandV_ct_vec(const FandV_ct_vec& ct_vec, const std::string& file) {
   // header
   fprintf(fp, "=> FHE pkg obj <=\nRcpp_FandV_ct_vec\n");
   // pars
-  ct_vec.vec[1].p.save(fp);
+  ct_vec.vec[1]->p.save(fp);
   // rlk
-  (ct_vec.vec[1].rlkl->x[ct_vec.vec[1].rlki]).save(fp);
+  ct_vec.vec[1]->rlkl->get(ct_vec.vec[1]->rlki)->save(fp);
   // ct content
   ct_vec.save(fp);
   
@@ -208,9 +261,9 @@ void save_FandV_ct_mat(const FandV_ct_mat& ct_mat, const std::string& file) {
   // header
   fprintf(fp, "=> FHE pkg obj <=\nRcpp_FandV_ct_mat\n");
   // pars
-  ct_mat.mat[1].p.save(fp);
+  ct_mat.mat[1]->p.save(fp);
   // rlk
-  (ct_mat.mat[1].rlkl->x[ct_mat.mat[1].rlki]).save(fp);
+  ct_mat.mat[1]->rlkl->get(ct_mat.mat[1]->rlki)->save(fp);
   // ct content
   ct_mat.save(fp);
   
@@ -252,6 +305,43 @@ FandV_ct_mat load_FandV_ct_mat(const std::string& file, FandV_rlk_locker* rlkl)
   return(ct_mat);
 }
 
+// Memory mapped matrices live in their file, so "saving" is writing the file
+// once and loading is just re-mapping it
+FandV_ct_mmat mmap_FandV_ct_mat(const FandV_ct_mat& ct_mat, const std::string& file) {
+  return(FandV_ct_mmat(ct_mat, file));
+}
+FandV_ct_mmat load_FandV_ct_mmat(const std::string& file, FandV_rlk_locker* rlkl) {
+  return(FandV_ct_mmat(file, rlkl));
+}
+
+// Sparse matrices carry their own binary format
+FandV_ct_smat sparse_FandV_ct(const FandV_ct_vec& x, IntegerVector i, IntegerVector j, int nrow, int ncol) {
+  return(FandV_ct_smat(x, i, j, nrow, ncol));
+}
+void save_FandV_ct_smat(const FandV_ct_smat& ct_smat, const std::string& file) {
+  ct_smat.save(file);
+}
+FandV_ct_smat load_FandV_ct_smat(const std::string& file, FandV_rlk_locker* rlkl) {
+  return(FandV_ct_smat(file, rlkl));
+}
+
+// Compressed files are only a storage format: they load as ordinary cipher
+// texts at the full modulus q
+void compress_FandV_ct_vec(const FandV_ct_vec& ct_vec, const std::string& kind, int bits, bool rlk, const std::string& file) {
+  FandV_compress(ct_vec.vec, kind, ct_vec.vec.size(), 1, bits, rlk, file);
+}
+void compress_FandV_ct_mat(const FandV_ct_mat& ct_mat, int bits, bool rlk, const std::string& file) {
+  FandV_compress(ct_mat.mat, "ctmat", ct_mat.nrow, ct_mat.ncol, bits, rlk, file);
+}
+List load_FandV_ct_z(const std::string& file, FandV_rlk_locker* rlkl) {
+  FandV_ct_vec x;
+  std::string kind;
+  int nrow = 0, ncol = 0;
+  if(!FandV_decompress(file, rlkl, x.vec, kind, nrow, ncol))
+    return(List::create());
+  return(List::create(Named("x")=x, Named("kind")=kind, Named("nrow")=nrow, Named("ncol")=ncol));
+}
+
 void save_FandV_keys(const List& keys, const std::string& file) {
   const char *file_c = file.c_str();
   
@@ -312,7 +402,7 @@ List load_FandV_keys(const std::string& file, FandV_rlk_locker* rlkl) {
   FandV_pk pk(fp, p, rlkl, rlki);
   len = getline(&buf, &bufn, fp); // Advance past the new line
   // sk
-  FandV_sk sk(fp);
+  FandV_sk sk(fp, p.Phi.length()-1);
   
   keys["sk"] = sk;
   keys["pk"] = pk;
@@ -334,11 +424,11 @@ void save_FandV_pk(const FandV_pk& pk, const std::string& file) {
   
   fprintf(fp, "=> FHE pkg obj <=\nFandV_pk\n");
   
-  FandV_rlk& rlk = (pk.rlkl->x)[pk.rlki];
+  std::shared_ptr<const FandV_rlk> rlk = pk.rlkl->get(pk.rlki);
 
   // pars + rlk
   pk.p.save(fp);
-  rlk.save(fp);
+  rlk->save(fp);
   // pk
   pk.save(fp);
 
@@ -394,15 +484,22 @@ RCPP_EXPOSED_CLASS(FandV_rlk_locker)
 RCPP_EXPOSED_CLASS(FandV_ct)
 RCPP_EXPOSED_CLASS(FandV_ct_vec)
 RCPP_EXPOSED_CLASS(FandV_ct_mat)
+RCPP_EXPOSED_CLASS(FandV_ct_mmat)
+RCPP_EXPOSED_CLASS(FandV_ct_smat)
+RCPP_EXPOSED_CLASS(FandV_future)
+RCPP_EXPOSED_CLASS(FandV_lazy)
 
 RCPP_MODULE(FandV) {
   class_<FandV_par>("FandV_par")
     .constructor<int, double, int, std::string, int, int>()
     .method("keygen", &FandV_par::keygen)
+    .method("memoryUsage", &FandV_par::memoryUsage)
     .method("show", &FandV_par::show)
     .method("show_no_t", &FandV_par::show_no_t)
     .method("show_t", &FandV_par::show_t)
     .method("get_t", &FandV_par::get_t)
+    .method("get_encoding", &FandV_par::get_encoding)
+    .method("setEncoding", &FandV_par::setEncoding)
   ;
   
   class_<FandV_pk>("FandV_pk")
@@ -410,9 +507,17 @@ RCPP_MODULE(FandV) {
     .field("p", &FandV_pk::p)
     .field("rlki", &FandV_pk::rlki)
     .method("enc", &FandV_pk::enc)
+    .method("encbig", &FandV_pk::encbig)
+    .method("encfrac", &FandV_pk::encfrac)
     .method("encbinary", &FandV_pk::encbinary)
     .method("encvec", &FandV_pk::encvec)
     .method("encmat", &FandV_pk::encmat)
+    .method("encfracvec", &FandV_pk::encfracvec)
+    .method("encfracmat", &FandV_pk::encfracmat)
+    .method("startPool", &FandV_pk::startPool)
+    .method("stopPool", &FandV_pk::stopPool)
+    .method("poolAvailable", &FandV_pk::poolAvailable)
+    .method("memoryUsage", &FandV_pk::memoryUsage)
     .method("show", &FandV_pk::show)
   ;
 
@@ -420,17 +525,21 @@ RCPP_MODULE(FandV) {
     .constructor()
     //.method("decraw", &FandV_sk::decraw)
     .method("dec", &FandV_sk::dec)
+    .method("memoryUsage", &FandV_sk::memoryUsage)
     .method("show", &FandV_sk::show)
   ;
   
   class_<FandV_rlk>("FandV_rlk")
     .constructor()
+    .method("memoryUsage", &FandV_rlk::memoryUsage)
     .method("show", &FandV_rlk::show)
   ;
   
   class_<FandV_rlk_locker>("FandV_rlk_locker")
     .constructor()
     .method("add", &FandV_rlk_locker::add)
+    .method("resident", &FandV_rlk_locker::resident)
+    .method("memoryUsage", &FandV_rlk_locker::memoryUsage)
     .method("show", &FandV_rlk_locker::show)
   ;
   
@@ -442,6 +551,7 @@ RCPP_MODULE(FandV) {
     .method("add", &FandV_ct::add)
     .method("sub", &FandV_ct::sub)
     .method("mul", &FandV_ct::mul)
+    .method("memoryUsage", &FandV_ct::memoryUsage)
     .method("show", &FandV_ct::show)
   ;
   
@@ -464,10 +574,13 @@ RCPP_MODULE(FandV) {
     .method("push", &FandV_ct_vec::push)
     .method("pushvec", &FandV_ct_vec::pushvec)
     .method("set", &FandV_ct_vec::set)
+    .method("memoryUsage", &FandV_ct_vec::memoryUsage)
     .method("show", &FandV_ct_vec::show)
     .method("size", &FandV_ct_vec::size)
     .method("subset", &FandV_ct_vec::subset)
     .method("without", &FandV_ct_vec::without)
+    .method("rep", &FandV_ct_vec::rep)
+    .method("cat", &FandV_ct_vec::cat)
   ;
   
   class_<FandV_ct_mat>("FandV_ct_mat")
@@ -479,10 +592,13 @@ RCPP_MODULE(FandV) {
     .method("subset", &FandV_ct_mat::subset)
     .method("subsetV", &FandV_ct_mat::subsetV)
     .method("t", &FandV_ct_mat::t)
+    .method("cbind", &FandV_ct_mat::cbind)
+    .method("rbind", &FandV_ct_mat::rbind)
     .method("set", &FandV_ct_mat::set)
     .method("setelt", &FandV_ct_mat::setelt)
     .method("setmatrix", &FandV_ct_mat::setmatrix)
     .method("reset", &FandV_ct_mat::reset)
+    .method("memoryUsage", &FandV_ct_mat::memoryUsage)
     .method("show", &FandV_ct_mat::show)
     .method("add", &FandV_ct_mat::add)
     .method("mul", &FandV_ct_mat::mul)
@@ -496,12 +612,108 @@ RCPP_MODULE(FandV) {
     .method("matmulSerial", &FandV_ct_mat::matmulSerial)
     .method("TmatmulParallel", &FandV_ct_mat::TmatmulParallel)
     .method("matmulTParallel", &FandV_ct_mat::matmulTParallel)
+    .method("matvec", &FandV_ct_mat::matvec)
+    .method("tmatvec", &FandV_ct_mat::tmatvec)
+    .method("matvecpt", &FandV_ct_mat::matvecpt)
+    .method("tmatvecpt", &FandV_ct_mat::tmatvecpt)
+    .method("matmulpt", &FandV_ct_mat::matmulpt)
+    .method("ptmatmul", &FandV_ct_mat::ptmatmul)
+    .method("syrkParallel", &FandV_ct_mat::syrkParallel)
+    .method("tsyrkParallel", &FandV_ct_mat::tsyrkParallel)
     .method("rowSumsParallel", &FandV_ct_mat::rowSumsParallel)
     .method("rowSumsSerial", &FandV_ct_mat::rowSumsSerial)
     .method("colSumsParallel", &FandV_ct_mat::colSumsParallel)
     .method("colSumsSerial", &FandV_ct_mat::colSumsSerial)
   ;
   
+  class_<FandV_ct_mmat>("FandV_ct_mmat")
+    .constructor()
+    .field_readonly("nrow", &FandV_ct_mmat::nrow)
+    .field_readonly("ncol", &FandV_ct_mmat::ncol)
+    .field_readonly("file", &FandV_ct_mmat::file)
+    .method("size", &FandV_ct_mmat::size)
+    .method("get", &FandV_ct_mmat::get)
+    .method("setelt", &FandV_ct_mmat::setelt)
+    .method("load", &FandV_ct_mmat::load)
+    .method("subset", &FandV_ct_mmat::subset)
+    .method("subsetV", &FandV_ct_mmat::subsetV)
+    .method("setTile", &FandV_ct_mmat::setTile)
+    .method("show", &FandV_ct_mmat::show)
+    .method("add", &FandV_ct_mmat::add)
+    .method("mul", &FandV_ct_mmat::mul)
+    .method("addct", &FandV_ct_mmat::addct)
+    .method("mulct", &FandV_ct_mmat::mulct)
+    .method("colSumsParallel", &FandV_ct_mmat::colSumsParallel)
+    .method("TmatmulParallel", &FandV_ct_mmat::TmatmulParallel)
+  ;
+  
+  class_<FandV_ct_smat>("FandV_ct_smat")
+    .constructor()
+    .field_readonly("nrow", &FandV_ct_smat::nrow)
+    .field_readonly("ncol", &FandV_ct_smat::ncol)
+    .method("size", &FandV_ct_smat::size)
+    .method("nnz", &FandV_ct_smat::nnz)
+    .method("rows", &FandV_ct_smat::rows)
+    .method("cols", &FandV_ct_smat::cols)
+    .method("values", &FandV_ct_smat::values)
+    .method("dense", &FandV_ct_smat::dense)
+    .method("t", &FandV_ct_smat::t)
+    .method("matmul", &FandV_ct_smat::matmul)
+    .method("matvec", &FandV_ct_smat::matvec)
+    .method("matmulpt", &FandV_ct_smat::matmulpt)
+    .method("rowSums", &FandV_ct_smat::rowSums)
+    .method("colSums", &FandV_ct_smat::colSums)
+    .method("memoryUsage", &FandV_ct_smat::memoryUsage)
+    .method("show", &FandV_ct_smat::show)
+  ;
+  
+  class_<FandV_future>("FandV_future")
+    .constructor()
+    .method("ready", &FandV_future::ready)
+    .method("wait", &FandV_future::wait)
+    .method("kind", &FandV_future::kind)
+    .method("error", &FandV_future::error)
+    .method("getCt", &FandV_future::getCt)
+    .method("getVec", &FandV_future::getVec)
+    .method("getMat", &FandV_future::getMat)
+    .method("getDec", &FandV_future::getDec)
+    .method("nrow", &FandV_future::nrow)
+    .method("ncol", &FandV_future::ncol)
+    .method("show", &FandV_future::show)
+  ;
+  
+  class_<FandV_lazy>("FandV_lazy")
+    .constructor()
+    .method("add", &FandV_lazy::add)
+    .method("sub", &FandV_lazy::sub)
+    .method("mul", &FandV_lazy::mul)
+    .method("pow", &FandV_lazy::pow)
+    .method("sum", &FandV_lazy::sum)
+    .method("prod", &FandV_lazy::prod)
+    .method("matmul", &FandV_lazy::matmul)
+    .method("kind", &FandV_lazy::kind)
+    .method("size", &FandV_lazy::size)
+    .method("nrow", &FandV_lazy::nrow)
+    .method("ncol", &FandV_lazy::ncol)
+    .method("pending", &FandV_lazy::pending)
+    .method("compute", &FandV_lazy::compute)
+    .method("getCt", &FandV_lazy::getCt)
+    .method("getVec", &FandV_lazy::getVec)
+    .method("getMat", &FandV_lazy::getMat)
+    .method("show", &FandV_lazy::show)
+  ;
+  
+  class_<FandV_keyring>("FandV_keyring")
+    .constructor<std::string, FandV_rlk_locker*, int>()
+    .method("put", &FandV_keyring::put)
+    .method("get", &FandV_keyring::get)
+    .method("has", &FandV_keyring::has)
+    .method("ids", &FandV_keyring::ids)
+    .method("setMaxRlk", &FandV_keyring::setMaxRlk)
+    .method("resident", &FandV_keyring::resident)
+    .method("show", &FandV_keyring::show)
+  ;
+  
   function("saveFHE.FandV_keys2", &save_FandV_keys);
   function("load_FandV_keys", &load_FandV_keys);
   function("saveFHE.Rcpp_FandV_pk2", &save_FandV_pk);
@@ -512,5 +724,39 @@ RCPP_MODULE(FandV) {
   function("load_FandV_ct_vec", &load_FandV_ct_vec);
   function("saveFHE.Rcpp_FandV_ct_mat2", &save_FandV_ct_mat);
   function("load_FandV_ct_mat", &load_FandV_ct_mat);
+  function("mmap_FandV_ct_mat", &mmap_FandV_ct_mat);
+  function("load_FandV_ct_mmat", &load_FandV_ct_mmat);
+  function("FandV_mmat_cleanup", &FandV_mmat_cleanup);
+  function("sparse_FandV_ct", &sparse_FandV_ct);
+  function("saveFHE.Rcpp_FandV_ct_smat2", &save_FandV_ct_smat);
+  function("load_FandV_ct_smat", &load_FandV_ct_smat);
+  function("compress_FandV_ct_vec", &compress_FandV_ct_vec);
+  function("compress_FandV_ct_mat", &compress_FandV_ct_mat);
+  function("load_FandV_ct_z", &load_FandV_ct_z);
+  function("stream_FandV_sum", &stream_FandV_sum);
+  function("stream_FandV_innerprod", &stream_FandV_innerprod);
+  function("stream_FandV_wsum", &stream_FandV_wsum);
   function("HEmem", &HEmem);
+  function("FandV_bench", &FandV_bench);
+  function("FandV_prof_enabled", &FandV_prof_enabled);
+  function("FandV_prof", &FandV_prof);
+  function("FandV_prof_reset", &FandV_prof_reset);
+  function("FandV_mem_live", &FandV_mem_live);
+  function("FandV_mem_threshold", &FandV_mem_threshold);
+  function("FandV_mem_service", &FandV_mem_service);
+  function("FandV_setThreads", &FandV_setThreads);
+  function("FandV_getThreads", &FandV_getThreads);
+  function("FandV_ct_copies", &FandV_ct_copies);
+  function("FandV_future_ct", &FandV_future_ct);
+  function("FandV_future_vec", &FandV_future_vec);
+  function("FandV_future_mat", &FandV_future_mat);
+  function("async_FandV_op", &async_FandV_op);
+  function("async_FandV_unary", &async_FandV_unary);
+  function("async_FandV_enc", &async_FandV_enc);
+  function("async_FandV_dec", &async_FandV_dec);
+  function("async_FandV_pending", &async_FandV_pending);
+  function("lazy_FandV_ct", &lazy_FandV_ct);
+  function("lazy_FandV_vec", &lazy_FandV_vec);
+  function("lazy_FandV_mat", &lazy_FandV_mat);
+  function("keygen_FandV_batch", &keygen_FandV_batch);
 }
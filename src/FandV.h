@@ -9,8 +9,11 @@
 #include <flint/fmpz_polyxx.h>
 using namespace flint;
 
-void fmpz_polyxx_q(fmpz_polyxx& p, fmpzxx q);
+void fmpz_polyxx_q(fmpz_polyxx& p, const fmpzxx& q);
+void fmpz_vec_q(fmpz* c, slong len, const fmpz* q); // As fmpz_polyxx_q on a bare coefficient array (not normalised)
 void fmpz_rand(fmpzxx &p, unsigned int bits);
 void printPoly(const fmpz_polyxx& p);
+std::size_t fmpz_polyxx_bytes(const fmpz_polyxx& p); // Heap bytes held, including multiprecision coefficients
+std::size_t fmpzxx_bytes(const fmpzxx& x); // Heap bytes held by a multiprecision integer
 
 #endif
@@ -0,0 +1,417 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <deque>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "FandV_ct.h"
+#include "FandV_ct_vec.h"
+#include "FandV_ct_mat.h"
+#include "FandV_keys.h"
+#include "FandV_async.h"
+#include "FandV_mem.h"
+
+//// Task queue ////
+// A few dispatcher threads take tasks in submission order.  Each task runs the
+// usual parallel kernels, so the dispatchers only need to keep enough operations
+// in flight to fill the cores between them.  Because a task's inputs were always
+// submitted before it, they are already running or done when it starts waiting,
+// so a FIFO queue cannot deadlock.
+class FandV_tasks {
+  public:
+    FandV_tasks() : stop(false), pending(0) {
+      int n = std::min(std::max((int) std::thread::hardware_concurrency()/2, 2), 4);
+      for(int i=0; i<n; i++) {
+        workers.push_back(std::thread(&FandV_tasks::run, this));
+      }
+    }
+    ~FandV_tasks() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+      }
+      wake.notify_all();
+      for(unsigned int i=0; i<workers.size(); i++) {
+        workers[i].join();
+      }
+    }
+
+    void submit(std::function<void()> task) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(task);
+        pending++;
+      }
+      wake.notify_one();
+    }
+    int count() {
+      std::lock_guard<std::mutex> guard(lock);
+      return(pending);
+    }
+
+  private:
+    void run() {
+      std::unique_lock<std::mutex> guard(lock);
+      while(true) {
+        wake.wait(guard, [this]() { return(stop || !queue.empty()); });
+        if(queue.empty())
+          return;
+        std::function<void()> task = queue.front();
+        queue.pop_front();
+        guard.unlock();
+        task();
+        guard.lock();
+        pending--;
+      }
+    }
+
+    std::deque< std::function<void()> > queue;
+    bool stop;
+    int pending;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<std::thread> workers;
+};
+
+static FandV_tasks& FandV_task_queue() {
+  static FandV_tasks tasks; // Threads only started on first use
+  return(tasks);
+}
+
+// Queue f to fill in a new future of the given kind, catching any failure so it
+// can be reported when the result is waited on
+static FandV_future FandV_submit(FandV_future_kind kind, std::function<void(FandV_future_state&)> f) {
+  FandV_future res(kind);
+  std::shared_ptr<FandV_future_state> s = res.s;
+  FandV_task_queue().submit([s, f]() {
+    std::string error;
+    FandV_mem_hold hold;
+    try {
+      f(*s);
+    } catch(std::exception& e) {
+      error = e.what();
+    } catch(...) {
+      error = "unknown failure in asynchronous operation";
+    }
+    s->finish(error);
+  });
+  return(res);
+}
+
+//// Shared state ////
+FandV_future_state::FandV_future_state(FandV_future_kind kind_) : done(false), kind(kind_), nrow(0), ncol(0) { }
+
+void FandV_future_state::wait() {
+  std::unique_lock<std::mutex> guard(lock);
+  cv.wait(guard, [this]() { return(done); });
+}
+void FandV_future_state::finish(const std::string& error_) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    error = error_;
+    done = true;
+  }
+  cv.notify_all();
+}
+
+//// Futures ////
+FandV_future::FandV_future() : s(std::make_shared<FandV_future_state>(FandV_FUT_VEC)) {
+  s->done = true;
+}
+FandV_future::FandV_future(FandV_future_kind kind) : s(std::make_shared<FandV_future_state>(kind)) { }
+FandV_future::FandV_future(const FandV_future& f) : s(f.s) { }
+
+bool FandV_future::ready() const {
+  std::lock_guard<std::mutex> guard(s->lock);
+  return(s->done);
+}
+void FandV_future::wait() const {
+  s->wait();
+}
+std::string FandV_future::kind() const {
+  switch(s->kind) {
+    case FandV_FUT_CT:
+      return("ct");
+    case FandV_FUT_VEC:
+      return("ctvec");
+    case FandV_FUT_MAT:
+      return("ctmat");
+    case FandV_FUT_DEC:
+      return("dec");
+  }
+  return("");
+}
+std::string FandV_future::error() const {
+  s->wait();
+  return(s->error);
+}
+
+FandV_ct FandV_future::getCt() const {
+  s->wait();
+  if(s->kind != FandV_FUT_CT || s->res.size() != 1 || !s->error.empty()) {
+    Rcout << "Error: future does not hold a cipher text\n";
+    return(FandV_ct(FandV_par(), NULL, 0));
+  }
+  return(*(s->res[0]));
+}
+FandV_ct_vec FandV_future::getVec() const {
+  s->wait();
+  if(s->kind != FandV_FUT_VEC || !s->error.empty()) {
+    Rcout << "Error: future does not hold a cipher text vector\n";
+    return(FandV_ct_vec());
+  }
+  return(FandV_ct_vec(s->res));
+}
+FandV_ct_mat FandV_future::getMat() const {
+  s->wait();
+  if(s->kind != FandV_FUT_MAT || !s->error.empty()) {
+    Rcout << "Error: future does not hold a cipher text matrix\n";
+    return(FandV_ct_mat());
+  }
+  return(FandV_ct_mat(s->res, s->nrow, s->ncol));
+}
+std::vector<std::string> FandV_future::getDec() const {
+  s->wait();
+  return(s->dec);
+}
+int FandV_future::nrow() const {
+  s->wait();
+  return(s->nrow);
+}
+int FandV_future::ncol() const {
+  s->wait();
+  return(s->ncol);
+}
+
+void FandV_future::show() const {
+  Rcout << "Fan and Vercauteren asynchronous result (" << kind() << "), ";
+  if(!ready()) {
+    Rcout << "pending\n";
+  } else if(!s->error.empty()) {
+    Rcout << "failed: " << s->error << "\n";
+  } else {
+    Rcout << "ready\n";
+  }
+}
+
+FandV_future FandV_future_ct(const FandV_ct& ct) {
+  FandV_future res(FandV_FUT_CT);
+  res.s->res.push_back(std::make_shared<const FandV_ct>(ct));
+  res.s->finish("");
+  return(res);
+}
+FandV_future FandV_future_vec(const FandV_ct_vec& ct_vec) {
+  FandV_future res(FandV_FUT_VEC);
+  res.s->res = ct_vec.vec;
+  res.s->finish("");
+  return(res);
+}
+FandV_future FandV_future_mat(const FandV_ct_mat& ct_mat) {
+  FandV_future res(FandV_FUT_MAT);
+  res.s->res = ct_mat.mat;
+  res.s->nrow = ct_mat.nrow;
+  res.s->ncol = ct_mat.ncol;
+  res.s->finish("");
+  return(res);
+}
+
+//// Operations ////
+// A future which has already failed, for requests refused before queueing;
+// the error is raised when it is waited on, as for a task which fails
+static FandV_future FandV_failed(const std::string& error) {
+  FandV_future res(FandV_FUT_VEC);
+  res.s->finish(error);
+  return(res);
+}
+// Wait for an input inside a task, passing on its failure
+static FandV_future_state& FandV_input(const std::shared_ptr<FandV_future_state>& s) {
+  s->wait();
+  if(!s->error.empty())
+    throw std::runtime_error(s->error);
+  return(*s);
+}
+// Inputs viewed as the containers the kernels work on; vectors act as a column
+static FandV_ct_vec FandV_asVec(const FandV_future_state& s) {
+  return(FandV_ct_vec(s.res));
+}
+static FandV_ct_mat FandV_asMat(const FandV_future_state& s) {
+  if(s.kind == FandV_FUT_VEC)
+    return(FandV_ct_mat(s.res, s.res.size(), 1));
+  return(FandV_ct_mat(s.res, s.nrow, s.ncol));
+}
+static void FandV_put(FandV_future_state& s, FandV_ct&& ct) {
+  s.res.assign(1, std::make_shared<const FandV_ct>(std::move(ct)));
+}
+static void FandV_put(FandV_future_state& s, const FandV_ct_vec& ct_vec) {
+  s.res = ct_vec.vec;
+}
+static void FandV_put(FandV_future_state& s, const FandV_ct_mat& ct_mat) {
+  s.res = ct_mat.mat;
+  s.nrow = ct_mat.nrow;
+  s.ncol = ct_mat.ncol;
+}
+
+// Kind of result of a binary op, or -1 if the combination is not supported
+static int FandV_async_kind(const std::string& op, FandV_future_kind x, FandV_future_kind y) {
+  if(x == FandV_FUT_DEC || y == FandV_FUT_DEC)
+    return(-1);
+  if(op == "+" || op == "-" || op == "*") {
+    if(x == FandV_FUT_MAT || y == FandV_FUT_MAT) {
+      if(op == "-" || (x != FandV_FUT_CT && y != FandV_FUT_CT && x != y))
+        return(-1);
+      return(FandV_FUT_MAT);
+    }
+    if(x == FandV_FUT_VEC || y == FandV_FUT_VEC)
+      return(FandV_FUT_VEC);
+    return(FandV_FUT_CT);
+  }
+  if(op == "%*%") {
+    if(x == FandV_FUT_VEC && y == FandV_FUT_VEC)
+      return(FandV_FUT_CT);
+    if(x == FandV_FUT_MAT && y != FandV_FUT_CT)
+      return(FandV_FUT_MAT);
+    return(-1);
+  }
+  if(op == "crossprod") {
+    if(x == FandV_FUT_CT || y == FandV_FUT_CT)
+      return(-1);
+    return(FandV_FUT_MAT);
+  }
+  return(-1);
+}
+
+FandV_future async_FandV_op(std::string op, const FandV_future& x, const FandV_future& y) {
+  int kind = FandV_async_kind(op, x.s->kind, y.s->kind);
+  if(kind < 0) {
+    return(FandV_failed("operation " + op + " is not available asynchronously for these arguments"));
+  }
+  std::shared_ptr<FandV_future_state> xs(x.s), ys(y.s);
+
+  return(FandV_submit((FandV_future_kind) kind, [op, xs, ys](FandV_future_state& out) {
+    FandV_future_state& a = FandV_input(xs);
+    FandV_future_state& b = FandV_input(ys);
+
+    if(op == "%*%" || op == "crossprod") {
+      if(out.kind == FandV_FUT_CT) {
+        if(a.res.size() != b.res.size())
+          throw std::runtime_error("non-conformable arguments");
+        FandV_put(out, FandV_asVec(a).innerprod(FandV_asVec(b)));
+        return;
+      }
+      FandV_ct_mat am(FandV_asMat(a)), bm(FandV_asMat(b));
+      if((op == "%*%" && am.ncol != bm.nrow) || (op == "crossprod" && am.nrow != bm.nrow))
+        throw std::runtime_error("non-conformable arguments");
+      FandV_put(out, op == "%*%" ? am.matmulParallel(bm) : am.TmatmulParallel(bm));
+      return;
+    }
+
+    // Element-wise, with a single cipher text on either side broadcast
+    if(a.kind == FandV_FUT_CT && b.kind == FandV_FUT_CT) {
+      const FandV_ct &ac = *a.res[0], &bc = *b.res[0];
+      FandV_put(out, op == "+" ? ac.add(bc) : (op == "-" ? ac.sub(bc) : ac.mul(bc)));
+    } else if(out.kind == FandV_FUT_VEC) {
+      if(a.kind == FandV_FUT_CT || b.kind == FandV_FUT_CT) {
+        bool rev = a.kind == FandV_FUT_CT;
+        FandV_ct_vec v(FandV_asVec(rev ? b : a));
+        const FandV_ct& c = *(rev ? a : b).res[0];
+        FandV_put(out, op == "+" ? v.addct(c) : (op == "-" ? v.subct(c, rev) : v.mulctParallel(c)));
+      } else {
+        std::size_t na = a.res.size(), nb = b.res.size();
+        if(na == 0 || nb == 0 || (na%nb != 0 && nb%na != 0))
+          throw std::runtime_error("longer object length is not a multiple of shorter object length");
+        FandV_ct_vec av(FandV_asVec(a)), bv(FandV_asVec(b));
+        FandV_put(out, op == "+" ? av.add(bv) : (op == "-" ? av.sub(bv) : av.mulParallel(bv)));
+      }
+    } else {
+      if(a.kind == FandV_FUT_CT || b.kind == FandV_FUT_CT) {
+        FandV_ct_mat m(FandV_asMat(a.kind == FandV_FUT_CT ? b : a));
+        const FandV_ct& c = *(a.kind == FandV_FUT_CT ? a : b).res[0];
+        FandV_put(out, op == "+" ? m.addct(c) : m.mulctParallel(c));
+      } else {
+        if(a.nrow != b.nrow || a.ncol != b.ncol)
+          throw std::runtime_error("non-conformable matrix sizes");
+        FandV_ct_mat am(FandV_asMat(a)), bm(FandV_asMat(b));
+        FandV_put(out, op == "+" ? am.add(bm) : am.mulctmatParallel(bm));
+      }
+    }
+  }));
+}
+
+FandV_future async_FandV_unary(std::string op, const FandV_future& x) {
+  int kind = -1;
+  if((op == "sum" || op == "prod") && x.s->kind == FandV_FUT_VEC) {
+    kind = FandV_FUT_CT;
+  } else if((op == "rowSums" || op == "colSums") && x.s->kind == FandV_FUT_MAT) {
+    kind = FandV_FUT_VEC;
+  }
+  if(kind < 0) {
+    return(FandV_failed("operation " + op + " is not available asynchronously for this argument"));
+  }
+  std::shared_ptr<FandV_future_state> xs(x.s);
+
+  return(FandV_submit((FandV_future_kind) kind, [op, xs](FandV_future_state& out) {
+    FandV_future_state& a = FandV_input(xs);
+    if(a.res.empty())
+      throw std::runtime_error("no cipher texts to reduce");
+    if(op == "sum") {
+      FandV_put(out, FandV_asVec(a).sumParallel());
+    } else if(op == "prod") {
+      FandV_put(out, FandV_asVec(a).prodParallel());
+    } else if(op == "rowSums") {
+      FandV_put(out, FandV_asMat(a).rowSumsParallel());
+    } else {
+      FandV_put(out, FandV_asMat(a).colSumsParallel());
+    }
+  }));
+}
+
+FandV_future async_FandV_enc(const FandV_pk& pk, IntegerVector m, int nrow, int ncol) {
+  // Copy out of R and draw the seed here, on the main thread, so the result
+  // still follows set.seed() unless a pool supplies the noise
+  std::vector<int> mv(m.begin(), m.end());
+  RNGScope scope;
+  unsigned long seed = ((unsigned long) (R::runif(0.0, 4294967296.0)) << 32) ^ (unsigned long) (R::runif(0.0, 4294967296.0));
+
+  FandV_future_kind kind = nrow > 0 ? FandV_FUT_MAT : (mv.size() == 1 ? FandV_FUT_CT : FandV_FUT_VEC);
+  FandV_pk key(pk);
+
+  return(FandV_submit(kind, [mv, seed, key, nrow, ncol](FandV_future_state& out) {
+    key.encvecseeded(mv, seed, out.res);
+    if(out.kind == FandV_FUT_MAT) {
+      out.nrow = nrow;
+      out.ncol = ncol;
+    }
+  }));
+}
+
+FandV_future async_FandV_dec(const FandV_sk& sk, const FandV_future& x) {
+  if(x.s->kind == FandV_FUT_DEC) {
+    return(FandV_failed("argument is already decrypted"));
+  }
+  FandV_sk key(sk);
+  std::shared_ptr<FandV_future_state> xs(x.s);
+
+  return(FandV_submit(FandV_FUT_DEC, [key, xs](FandV_future_state& out) {
+    FandV_future_state& a = FandV_input(xs);
+    out.dec.resize(a.res.size());
+    for(unsigned int i=0; i<a.res.size(); i++) {
+      out.dec[i] = key.dec(*a.res[i]);
+    }
+    if(a.kind == FandV_FUT_MAT) {
+      out.nrow = a.nrow;
+      out.ncol = a.ncol;
+    }
+  }));
+}
+
+int async_FandV_pending() {
+  return(FandV_task_queue().count());
+}
@@ -0,0 +1,99 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_async_H
+#define FandV_async_H
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "FandV_ct.h"
+
+class FandV_ct_vec;
+class FandV_ct_mat;
+class FandV_pk;
+class FandV_sk;
+
+// What a future resolves to (named as the FHEt attribute on the R side)
+enum FandV_future_kind {
+  FandV_FUT_CT = 0, // a single cipher text
+  FandV_FUT_VEC,    // vector of cipher texts
+  FandV_FUT_MAT,    // matrix of cipher texts
+  FandV_FUT_DEC     // decrypted values, as strings
+};
+
+// Shared between a future, the task computing it and any tasks waiting on it
+struct FandV_future_state {
+  FandV_future_state(FandV_future_kind kind_);
+  void wait();
+  void finish(const std::string& error_);
+
+  std::mutex lock;
+  std::condition_variable cv;
+  bool done;
+  std::string error; // Empty unless the task failed
+
+  FandV_future_kind kind;
+  std::vector<FandV_ct_ptr> res; // Result elements, column major for matrices
+  int nrow, ncol;
+  std::vector<std::string> dec;
+};
+
+// Handle to the result of an operation running on the package's task queue.
+// Tasks are queued in the order they are submitted and a task only starts once
+// the futures it takes as input are complete, so results can be chained without
+// returning to R.  Nothing on the R side is touched until wait() is called on
+// the main thread.
+class FandV_future {
+  public:
+    // Constructors
+    FandV_future(); // An empty, completed vector
+    FandV_future(FandV_future_kind kind);
+    FandV_future(const FandV_future& f);
+
+    // Status
+    bool ready() const;
+    void wait() const;
+    std::string kind() const;
+    std::string error() const;
+
+    // Results, waiting if necessary
+    FandV_ct getCt() const;
+    FandV_ct_vec getVec() const;
+    FandV_ct_mat getMat() const;
+    std::vector<std::string> getDec() const;
+    int nrow() const;
+    int ncol() const;
+
+    // Print out
+    void show() const;
+
+    std::shared_ptr<FandV_future_state> s;
+};
+
+// Wrap existing values as completed futures
+FandV_future FandV_future_ct(const FandV_ct& ct);
+FandV_future FandV_future_vec(const FandV_ct_vec& ct_vec);
+FandV_future FandV_future_mat(const FandV_ct_mat& ct_mat);
+
+// Queue an operation: op is one of "+", "-", "*", "%*%", "crossprod" for the
+// binary form, and "sum", "prod", "rowSums", "colSums" for the unary form
+FandV_future async_FandV_op(std::string op, const FandV_future& x, const FandV_future& y);
+FandV_future async_FandV_unary(std::string op, const FandV_future& x);
+
+// Queue an encryption (a matrix if nrow > 0) or a decryption
+FandV_future async_FandV_enc(const FandV_pk& pk, IntegerVector m, int nrow, int ncol);
+FandV_future async_FandV_dec(const FandV_sk& sk, const FandV_future& x);
+
+// Operations queued or running
+int async_FandV_pending();
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <stdio.h>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <string>
+
+#include "FandV_par.h"
+#include "FandV_keys.h"
+#include "FandV_ct.h"
+#include "FandV_ct_vec.h"
+#include "FandV_ct_mat.h"
+#include "FandV_bench.h"
+#include "FandV.h"
+
+// Results table, one row per kernel
+struct FandV_bench_res {
+  std::vector<std::string> name;
+  std::vector<double> iterations, ns, items;
+  
+  // Run fn with a doubling iteration count until a run lasts mintime seconds
+  template <typename Fn>
+  void run(const std::string& name_, double items_, double mintime, Fn fn) {
+    double iters = 1.0, elapsed = 0.0;
+    for(;;) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for(double i=0; i<iters; i++)
+        fn();
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if(elapsed >= mintime || iters >= 1e9)
+        break;
+      // Jump straight to roughly enough iterations once a run takes measurable time
+      iters = elapsed > mintime/100.0 ? ceil(iters*1.4*mintime/elapsed) : iters*10.0;
+    }
+    name.push_back(name_);
+    iterations.push_back(iters);
+    ns.push_back(1e9*elapsed/iters);
+    items.push_back(items_);
+    checkUserInterrupt();
+  }
+};
+
+DataFrame FandV_bench(const FandV_par& p_, FandV_rlk_locker* rlkl_, int n, double mintime) {
+  FandV_bench_res res;
+  FandV_par p(p_);
+  n = std::max(n, 1);
+  // Everything here is registered in a private locker, so the session's is
+  // left as it was
+  FandV_rlk_locker locker;
+  FandV_rlk_locker* rlkl = &locker;
+  
+  // Keys, timed without registering each relin key (as keygen does)
+  FandV_pk pk(rlkl, 0);
+  FandV_sk sk;
+  FandV_rlk rlk;
+  unsigned long stream = 0;
+  res.run("keygen", 1, mintime, [&]() {
+    FandV_pk pk2(rlkl, 0);
+    FandV_sk sk2;
+    FandV_rlk rlk2;
+    p.keygenseeded(pk2, sk2, rlk2, 1, stream++);
+  });
+  p.keygen(pk, sk, rlk);
+  
+  // Single cipher texts
+  FandV_ct ct1(p, rlkl, pk.rlki), ct2(p, rlkl, pk.rlki);
+  pk.enc(3, ct1);
+  pk.enc(-2, ct2);
+  res.run("enc", 1, mintime, [&]() {
+    FandV_ct ct(p, rlkl, pk.rlki);
+    pk.enc(7, ct);
+  });
+  res.run("add", 1, mintime, [&]() {
+    FandV_ct ct(ct1.add(ct2));
+  });
+  res.run("mul", 1, mintime, [&]() { // Includes relinearisation
+    FandV_ct ct(ct1.mul(ct2));
+  });
+  res.run("decraw", 1, mintime, [&]() {
+    fmpz_polyxx m(sk.decraw(ct1));
+  });
+  fmpz_polyxx big(p.t*ct1.c0);
+  res.run("fmpz_polyxx_q", 1, mintime, [&]() {
+    fmpz_polyxx x(big);
+    fmpz_polyxx_q(x, p.q);
+  });
+  
+  // Save/load through a temporary file
+  FILE* fp = tmpfile();
+  if(fp == NULL) {
+    perror("Error");
+  } else {
+    res.run("save", 1, mintime, [&]() {
+      rewind(fp);
+      ct1.save(fp);
+    });
+    res.run("load", 1, mintime, [&]() {
+      rewind(fp);
+      FandV_ct ct(fp, p, rlkl, pk.rlki);
+    });
+    fclose(fp);
+  }
+  
+  // Vectors
+  IntegerVector m(n);
+  for(int i=0; i<n; i++)
+    m[i] = i%7 - 3;
+  FandV_ct_vec v1, v2;
+  pk.encvec(m, v1);
+  pk.encvec(m, v2);
+  res.run("encvec", n, mintime, [&]() {
+    FandV_ct_vec v;
+    pk.encvec(m, v);
+  });
+  res.run("mulParallel", n, mintime, [&]() {
+    FandV_ct_vec v(v1.mulParallel(v2));
+  });
+  res.run("sumParallel", n, mintime, [&]() {
+    FandV_ct ct(v1.sumParallel());
+  });
+  res.run("innerprod", n, mintime, [&]() {
+    FandV_ct ct(v1.innerprod(v2));
+  });
+  
+  // Matrices: about n cipher texts in each operand
+  int k = std::max((int) sqrt((double) n), 1);
+  IntegerVector mm(k*k);
+  for(int i=0; i<k*k; i++)
+    mm[i] = i%5 - 2;
+  FandV_ct_mat x, y;
+  pk.encmat(mm, k, k, x);
+  pk.encmat(mm, k, k, y);
+  res.run("matmulParallel", k*k*k, mintime, [&]() {
+    FandV_ct_mat z(x.matmulParallel(y));
+  });
+  res.run("colSumsParallel", k*k, mintime, [&]() {
+    FandV_ct_vec z(x.colSumsParallel());
+  });
+  
+  return(DataFrame::create(Named("name")=CharacterVector(res.name),
+                           Named("iterations")=NumericVector(res.iterations),
+                           Named("ns")=NumericVector(res.ns),
+                           Named("items")=NumericVector(res.items),
+                           Named("stringsAsFactors")=false));
+}
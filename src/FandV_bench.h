@@ -0,0 +1,23 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_bench_H
+#define FandV_bench_H
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include "FandV_par.h"
+
+class FandV_rlk_locker;
+
+// Time the core FandV kernels at parameters p.  Each kernel is rerun with a
+// doubling iteration count until one run takes at least mintime seconds; vector
+// kernels work on n cipher texts.  Returns one row per kernel with the time per
+// iteration in nanoseconds.  Keys and cipher texts go in a private relin key
+// locker, so rlkl is not touched.
+DataFrame FandV_bench(const FandV_par& p, FandV_rlk_locker* rlkl, int n, double mintime);
+
+#endif
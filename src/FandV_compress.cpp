@@ -0,0 +1,394 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include "getline.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "FandV_ct.h"
+#include "FandV_compress.h"
+#include "FandV_sched.h"
+#include "FandV.h"
+
+// Records packed or unpacked in parallel per block
+#define FandV_Z_BLOCK 4096
+
+int FandV_compress_bits(const FandV_par& p, int depth) {
+  // Room for t and the rounding noise, plus roughly the growth in noise of
+  // each level of multiplication
+  int level = fmpz_bits(p.t._fmpz()) + FLINT_BIT_COUNT(p.Phi.length()-1);
+  return(std::min(p.qpow, level + 4 + depth*level));
+}
+std::size_t FandV_compress_recsz(const FandV_par& p, int bits) {
+  return(4 + (2*(std::size_t) (p.Phi.length()-1)*bits + 7)/8);
+}
+
+// Little endian bit streams, written and read at most 8 bits at a time
+struct FandV_BitWriter {
+  unsigned char* out;
+  uint64_t acc;
+  int n;
+
+  FandV_BitWriter(unsigned char* out_) : out(out_), acc(0), n(0) { }
+
+  void put(uint64_t v, int bits) {
+    acc |= v << n;
+    n += bits;
+    while(n >= 8) {
+      *out++ = acc & 0xff;
+      acc >>= 8;
+      n -= 8;
+    }
+  }
+  void flush() {
+    if(n > 0)
+      *out++ = acc & 0xff;
+    acc = 0;
+    n = 0;
+  }
+};
+struct FandV_BitReader {
+  const unsigned char* in;
+  uint64_t acc;
+  int n;
+
+  FandV_BitReader(const unsigned char* in_) : in(in_), acc(0), n(0) { }
+
+  uint64_t get(int bits) {
+    while(n < bits) {
+      acc |= ((uint64_t) *in++) << n;
+      n += 8;
+    }
+    uint64_t v = acc & ((UINT64_C(1) << bits) - 1);
+    acc >>= bits;
+    n -= bits;
+    return(v);
+  }
+};
+
+// A coefficient x in [0, 2^bits) written as its bits little endian, and read
+// back unsigned
+static void FandV_z_put(FandV_BitWriter& out, const fmpz_t x, int bits, mpz_t z, std::vector<unsigned char>& bytes) {
+  fmpz_get_mpz(z, x);
+  std::fill(bytes.begin(), bytes.end(), 0);
+  mpz_export(&bytes[0], NULL, -1, 1, 0, 0, z);
+  for(std::size_t b=0; b<bytes.size(); b++) {
+    out.put(bytes[b], std::min(8, bits - 8*(int) b));
+  }
+}
+static void FandV_z_get(FandV_BitReader& in, fmpz_t x, int bits, mpz_t z, std::vector<unsigned char>& bytes) {
+  for(std::size_t b=0; b<bytes.size(); b++) {
+    bytes[b] = (unsigned char) in.get(std::min(8, bits - 8*(int) b));
+  }
+  mpz_import(z, bytes.size(), -1, 1, 0, 0, &bytes[0]);
+  fmpz_set_mpz(x, z);
+}
+
+// Coefficients are taken mod q first, so unreduced cipher texts compress the
+// same as reduced ones; round(c/2^k) mod 2^bits does not depend on the
+// representative of c as q/2^k = 2^bits
+static void FandV_z_pack(const FandV_ct& ct, int bits, unsigned char* rec) {
+  const FandV_par& p = ct.p;
+  int d = p.Phi.length()-1;
+  int k = p.qpow - bits;
+  std::size_t nbytes = (bits+7)/8;
+
+  int32_t depth = ct.depth;
+  memcpy(rec, &depth, 4);
+
+  fmpz_t x, h;
+  mpz_t z;
+  fmpz_init(x);
+  fmpz_init(h);
+  mpz_init(z);
+  if(k > 0) {
+    fmpz_one(h);
+    fmpz_mul_2exp(h, h, k-1);
+  }
+  std::vector<unsigned char> bytes(nbytes);
+  FandV_BitWriter out(rec + 4);
+  const fmpz_poly_struct* polys[2] = { ct.c0._poly(), ct.c1._poly() };
+  for(int j=0; j<2; j++) {
+    for(int i=0; i<d; i++) {
+      if(i < polys[j]->length)
+        fmpz_fdiv_r_2exp(x, polys[j]->coeffs+i, p.qpow);
+      else
+        fmpz_zero(x);
+      if(k > 0) {
+        fmpz_add(x, x, h);
+        fmpz_fdiv_q_2exp(x, x, k);
+        fmpz_fdiv_r_2exp(x, x, bits);
+      }
+      FandV_z_put(out, x, bits, z, bytes);
+    }
+  }
+  out.flush();
+  mpz_clear(z);
+  fmpz_clear(h);
+  fmpz_clear(x);
+}
+static void FandV_z_unpack(const unsigned char* rec, int bits, FandV_ct& ct) {
+  const FandV_par& p = ct.p;
+  int d = p.Phi.length()-1;
+  int k = p.qpow - bits;
+  std::size_t nbytes = (bits+7)/8;
+
+  int32_t depth;
+  memcpy(&depth, rec, 4);
+  ct.depth = depth;
+
+  fmpz_t x, m, mo2;
+  mpz_t z;
+  fmpz_init(x);
+  fmpz_init(m);
+  fmpz_init(mo2);
+  mpz_init(z);
+  fmpz_one(m);
+  fmpz_mul_2exp(m, m, bits);
+  fmpz_fdiv_q_2exp(mo2, m, 1);
+  std::vector<unsigned char> bytes(nbytes);
+  FandV_BitReader in(rec + 4);
+  fmpz_poly_struct* polys[2] = { ct.c0._poly(), ct.c1._poly() };
+  for(int j=0; j<2; j++) {
+    fmpz_poly_zero(polys[j]);
+    fmpz_poly_fit_length(polys[j], d);
+    for(int i=0; i<d; i++) {
+      FandV_z_get(in, x, bits, z, bytes);
+      if(fmpz_cmp(x, mo2) > 0)
+        fmpz_sub(x, x, m);
+      fmpz_mul_2exp(x, x, k);
+      fmpz_poly_set_coeff_fmpz(polys[j], i, x);
+    }
+  }
+  mpz_clear(z);
+  fmpz_clear(mo2);
+  fmpz_clear(m);
+  fmpz_clear(x);
+}
+
+// The relinearisation key, each coefficient mod q in qpow bits
+std::size_t FandV_compress_rlksz(const FandV_par& p) {
+  return((4*(std::size_t) (p.Phi.length()-1)*p.qpow + 7)/8);
+}
+static void FandV_z_pack_rlk(const FandV_rlk& rlk, const FandV_par& p, unsigned char* buf) {
+  int d = p.Phi.length()-1;
+  fmpz_t x;
+  mpz_t z;
+  fmpz_init(x);
+  mpz_init(z);
+  std::vector<unsigned char> bytes((p.qpow+7)/8);
+  FandV_BitWriter out(buf);
+  const fmpz_poly_struct* polys[4] = { rlk.rlk00._poly(), rlk.rlk01._poly(), rlk.rlk10._poly(), rlk.rlk11._poly() };
+  for(int j=0; j<4; j++) {
+    for(int i=0; i<d; i++) {
+      if(i < polys[j]->length)
+        fmpz_fdiv_r_2exp(x, polys[j]->coeffs+i, p.qpow);
+      else
+        fmpz_zero(x);
+      FandV_z_put(out, x, p.qpow, z, bytes);
+    }
+  }
+  out.flush();
+  mpz_clear(z);
+  fmpz_clear(x);
+}
+static void FandV_z_unpack_rlk(const unsigned char* buf, const FandV_par& p, FandV_rlk& rlk) {
+  int d = p.Phi.length()-1;
+  fmpz_t x, qo2;
+  mpz_t z;
+  fmpz_init(x);
+  fmpz_init(qo2);
+  mpz_init(z);
+  fmpz_one(qo2);
+  fmpz_mul_2exp(qo2, qo2, p.qpow-1);
+  std::vector<unsigned char> bytes((p.qpow+7)/8);
+  FandV_BitReader in(buf);
+  fmpz_poly_struct* polys[4] = { rlk.rlk00._poly(), rlk.rlk01._poly(), rlk.rlk10._poly(), rlk.rlk11._poly() };
+  for(int j=0; j<4; j++) {
+    fmpz_poly_zero(polys[j]);
+    fmpz_poly_fit_length(polys[j], d);
+    for(int i=0; i<d; i++) {
+      FandV_z_get(in, x, p.qpow, z, bytes);
+      if(fmpz_cmp(x, qo2) > 0)
+        fmpz_sub(x, x, p.q._fmpz());
+      fmpz_poly_set_coeff_fmpz(polys[j], i, x);
+    }
+  }
+  mpz_clear(z);
+  fmpz_clear(qo2);
+  fmpz_clear(x);
+}
+
+struct FandV_ZPack : public Worker {
+  const std::vector<FandV_ct_ptr>* x;
+  const std::size_t from, recsz;
+  const int bits;
+  unsigned char* buf;
+
+  FandV_ZPack(const std::vector<FandV_ct_ptr>* x_, unsigned char* buf_, const std::size_t from_, const std::size_t recsz_, const int bits_) : from(from_), recsz(recsz_), bits(bits_) { x=x_; buf=buf_; }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      FandV_z_pack(*x->at(from+i), bits, buf + i*recsz);
+    }
+  }
+};
+struct FandV_ZUnpack : public Worker {
+  std::vector<FandV_ct_ptr>* x;
+  const std::size_t from, recsz;
+  const int bits;
+  const unsigned char* buf;
+  const FandV_par* p;
+  FandV_rlk_locker* rlkl;
+  const std::size_t rlki;
+
+  FandV_ZUnpack(std::vector<FandV_ct_ptr>* x_, const unsigned char* buf_, const std::size_t from_, const std::size_t recsz_, const int bits_, const FandV_par* p_, FandV_rlk_locker* rlkl_, const std::size_t rlki_) : from(from_), recsz(recsz_), bits(bits_), rlki(rlki_) { x=x_; buf=buf_; p=p_; rlkl=rlkl_; }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      std::shared_ptr<FandV_ct> ct = std::make_shared<FandV_ct>(*p, rlkl, rlki);
+      FandV_z_unpack(buf + i*recsz, bits, *ct);
+      x->at(from+i) = ct;
+    }
+  }
+};
+
+void FandV_compress(const std::vector<FandV_ct_ptr>& x, const std::string& kind, int nrow, int ncol, int bits, bool withRlk, const std::string& file) {
+  if(x.size() == 0) {
+    Rcout << "Error: cannot compress an empty cipher text vector or matrix\n";
+    return;
+  }
+  const FandV_ct& x0 = *x[0];
+  const FandV_par& p = x0.p;
+  if(bits <= 0) {
+    int depth = 0;
+    for(std::size_t i=0; i<x.size(); i++)
+      depth = std::max(depth, x[i]->depth);
+    bits = FandV_compress_bits(p, depth);
+  }
+  bits = std::max(2, std::min(bits, p.qpow));
+  std::size_t recsz = FandV_compress_recsz(p, bits);
+  std::vector<unsigned char> rlkbuf;
+  if(withRlk) {
+    rlkbuf.assign(FandV_compress_rlksz(p), 0);
+    FandV_z_pack_rlk(*x0.rlkl->get(x0.rlki), p, &rlkbuf[0]);
+  }
+
+  FILE *fp = fopen(file.c_str(), "wb");
+  if(fp == NULL) {
+    perror("Error");
+    return;
+  }
+
+  // header
+  fprintf(fp, "=> FHE pkg obj <=\nRcpp_FandV_ct_z\n");
+  // pars
+  p.save(fp);
+  // shape and layout
+  fprintf(fp, "kind=%s\nnrow=%d\nncol=%d\nbits=%d\nrecsz=%lu\nrlk=%d\n", kind.c_str(), nrow, ncol, bits, (unsigned long) recsz, withRlk ? 1 : 0);
+  unsigned long offset = ftell(fp) + 28; // "offset=" + 20 digits + "\n"
+  fprintf(fp, "offset=%020lu\n", offset);
+  // rlk, packed, then the records
+  if(withRlk && fwrite(&rlkbuf[0], 1, rlkbuf.size(), fp) != rlkbuf.size()) {
+    Rcout << "Error: failed writing the relinearisation key\n";
+    fclose(fp);
+    return;
+  }
+
+  // records, packed in parallel a block at a time
+  std::vector<unsigned char> buf(std::min(x.size(), (std::size_t) FandV_Z_BLOCK)*recsz);
+  for(std::size_t from = 0; from < x.size(); from += FandV_Z_BLOCK) {
+    std::size_t n = std::min(x.size() - from, (std::size_t) FandV_Z_BLOCK);
+    FandV_ZPack packEngine(&x, &buf[0], from, recsz, bits);
+    FandV_parallelFor(FandV_OP_IO, p, 0, n, packEngine);
+    if(fwrite(&buf[0], recsz, n, fp) != n) {
+      Rcout << "Error: failed writing compressed ciphertext records\n";
+      break;
+    }
+  }
+  fclose(fp);
+}
+
+bool FandV_decompress(const std::string& file, FandV_rlk_locker* rlkl, std::vector<FandV_ct_ptr>& x, std::string& kind, int& nrow, int& ncol) {
+  x.clear();
+  FILE *fp = fopen(file.c_str(), "rb");
+  if(fp == NULL) {
+    perror("Error");
+    return(false);
+  }
+
+  // Check for header line
+  char *buf = NULL; size_t bufn = 0;
+  size_t len;
+  len = getline(&buf, &bufn, fp);
+  if(strncmp("=> FHE pkg obj <=\n", buf, len) != 0) {
+    Rcout << "Error: file does not contain an FHE object (CTZ)\n";
+    free(buf);
+    fclose(fp);
+    return(false);
+  }
+  len = getline(&buf, &bufn, fp);
+  if(strncmp("Rcpp_FandV_ct_z\n", buf, len) != 0) {
+    Rcout << "Error: file does not contain compressed ciphertexts\n";
+    free(buf);
+    fclose(fp);
+    return(false);
+  }
+
+  // pars
+  FandV_par p(fp);
+  len = getline(&buf, &bufn, fp); // Advance past the new line
+  free(buf);
+  // shape and layout
+  char kind_[8];
+  int bits, withRlk;
+  unsigned long recsz, offset;
+  if(fscanf(fp, "kind=%7s\nnrow=%d\nncol=%d\nbits=%d\nrecsz=%lu\nrlk=%d\noffset=%lu", kind_, &nrow, &ncol, &bits, &recsz, &withRlk, &offset) != 7 ||
+     bits < 2 || bits > p.qpow || nrow < 0 || ncol < 0 || recsz != FandV_compress_recsz(p, bits)) {
+    Rcout << "Error: corrupt compressed ciphertext header\n";
+    fclose(fp);
+    return(false);
+  }
+  kind = kind_;
+  fseek(fp, offset, SEEK_SET);
+  // rlk, if stored: without it the cipher texts decrypt but cannot be multiplied
+  std::size_t rlki = FandV_RLK_NONE;
+  if(withRlk) {
+    std::vector<unsigned char> rlkbuf(FandV_compress_rlksz(p));
+    if(fread(&rlkbuf[0], 1, rlkbuf.size(), fp) != rlkbuf.size()) {
+      Rcout << "Error: truncated compressed ciphertext file\n";
+      fclose(fp);
+      return(false);
+    }
+    FandV_rlk rlk;
+    FandV_z_unpack_rlk(&rlkbuf[0], p, rlk);
+    rlki = rlkl->add(rlk);
+  }
+
+  // records, unpacked in parallel a block at a time
+  x.resize((std::size_t) nrow*ncol);
+  std::vector<unsigned char> rec(std::min(x.size(), (std::size_t) FandV_Z_BLOCK)*recsz);
+  for(std::size_t from = 0; from < x.size(); from += FandV_Z_BLOCK) {
+    std::size_t n = std::min(x.size() - from, (std::size_t) FandV_Z_BLOCK);
+    if(fread(&rec[0], recsz, n, fp) != n) {
+      Rcout << "Error: truncated compressed ciphertext file\n";
+      x.clear();
+      fclose(fp);
+      return(false);
+    }
+    FandV_ZUnpack unpackEngine(&x, &rec[0], from, recsz, bits, &p, rlkl, rlki);
+    FandV_parallelFor(FandV_OP_IO, p, 0, n, unpackEngine);
+  }
+  fclose(fp);
+  return(true);
+}
@@ -0,0 +1,44 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_compress_H
+#define FandV_compress_H
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <vector>
+#include <string>
+
+#include "FandV_par.h"
+#include "FandV_ct.h"
+
+class FandV_rlk_locker;
+
+// Compressed storage of cipher texts.  Each coefficient of c0 and c1 is
+// switched from modulus q = 2^qpow down to 2^bits, c -> round(c*2^bits/q), and
+// stored in exactly bits bits.  This adds rounding noise of about
+// (1 + ||s||_1)/2 in units of 2^(qpow-bits), so bits needs to exceed
+// log2(t) + log2(d) by a margin plus the noise the cipher text already holds.
+// On load each coefficient is multiplied back up by 2^(qpow-bits), giving
+// ordinary cipher texts at modulus q which decrypt (and can be computed on)
+// as before.
+
+// Default bits for cipher texts of multiplicative depth up to depth
+int FandV_compress_bits(const FandV_par& p, int depth);
+// Bytes per record: int32 depth, then the 2d coefficients packed end to end
+std::size_t FandV_compress_recsz(const FandV_par& p, int bits);
+// Bytes of the relinearisation key, when stored: 4d coefficients of qpow bits
+std::size_t FandV_compress_rlksz(const FandV_par& p);
+
+// kind is "ct", "ctvec" or "ctmat", recorded so the loaded object matches;
+// bits <= 0 chooses FandV_compress_bits for the deepest cipher text in x.
+// Without withRlk the file only serves decryption: loaded cipher texts carry
+// no relinearisation key (rlki is FandV_RLK_NONE).
+void FandV_compress(const std::vector<FandV_ct_ptr>& x, const std::string& kind, int nrow, int ncol, int bits, bool withRlk, const std::string& file);
+// Returns false (with a message) if the file is not a valid compressed file
+bool FandV_decompress(const std::string& file, FandV_rlk_locker* rlkl, std::vector<FandV_ct_ptr>& x, std::string& kind, int& nrow, int& ncol);
+
+#endif
@@ -8,27 +8,50 @@ using namespace Rcpp;
 
 #include <iostream>
 #include <math.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include "getline.h"
 #include <string.h>
 
 #include "FandV_ct.h"
+#include "FandV_prof.h"
+#include "FandV_mem.h"
 #include "FandV.h"
 
 // Construct from parameters
-FandV_ct::FandV_ct(const FandV_par& p_, FandV_rlk_locker* rlkl_, size_t rlki_) : p(p_), rlkl(rlkl_), rlki(rlki_), depth(0) { }
+FandV_ct::FandV_ct(const FandV_par& p_, FandV_rlk_locker* rlkl_, size_t rlki_) : p(p_), rlkl(rlkl_), rlki(rlki_), depth(0), bound(1), accounted(p_.ctBytes()) {
+  FandV_mem_add(accounted);
+}
+
+std::atomic<long> FandV_ct::copies(0);
 
 // Copy constructor
-FandV_ct::FandV_ct(const FandV_ct& ct) : c0(ct.c0), c1(ct.c1), p(ct.p), rlkl(ct.rlkl), rlki(ct.rlki), depth(ct.depth) { }
+FandV_ct::FandV_ct(const FandV_ct& ct) : c0(ct.c0), c1(ct.c1), p(ct.p), rlkl(ct.rlkl), rlki(ct.rlki), depth(ct.depth), bound(ct.bound), accounted(ct.accounted) {
+  copies++;
+  FandV_mem_add(accounted);
+}
+
+// Move constructor (steals the polynomials of ct)
+FandV_ct::FandV_ct(FandV_ct&& ct) : p(std::move(ct.p)), rlkl(ct.rlkl), rlki(ct.rlki), depth(ct.depth), bound(ct.bound), accounted(ct.accounted) {
+  fmpz_poly_swap(c0._poly(), ct.c0._poly());
+  fmpz_poly_swap(c1._poly(), ct.c1._poly());
+  ct.accounted = 0;
+}
 
-// Assignment (copy-and-swap idiom)
+FandV_ct::~FandV_ct() {
+  FandV_mem_sub(accounted);
+}
+
+// Assignment (copy-and-swap idiom, so a temporary on the right is moved in)
 void FandV_ct::swap(FandV_ct& a, FandV_ct& b) {
-  std::swap(a.c0, b.c0);
-  std::swap(a.c1, b.c1);
-  std::swap(a.p, b.p);
+  fmpz_poly_swap(a.c0._poly(), b.c0._poly());
+  fmpz_poly_swap(a.c1._poly(), b.c1._poly());
+  a.p.swap(a.p, b.p);
   std::swap(a.rlkl, b.rlkl);
   std::swap(a.rlki, b.rlki);
   std::swap(a.depth, b.depth);
+  std::swap(a.bound, b.bound);
+  std::swap(a.accounted, b.accounted);
 }
 FandV_ct& FandV_ct::operator=(FandV_ct ct) {
   swap(*this, ct);
@@ -37,121 +60,183 @@ FandV_ct& FandV_ct::operator=(FandV_ct ct) {
 
 // R level ops
 FandV_ct FandV_ct::add(const FandV_ct& c) const {
+  FHE_PROF(FandV_PROF_ADD);
   FandV_ct res(p, rlkl, rlki);
   res.depth = std::max(depth, c.depth);
   
   res.c0 = c0+c.c0;
   res.c1 = c1+c.c1;
+  res.bound = bound+c.bound;
+  if(res.bound > FandV_REDUCE_TERMS)
+    res.reduce();
   
   return(res);
 }
-void FandV_ct::addEq(const FandV_ct& c) {  
+void FandV_ct::addEq(const FandV_ct& c) {
+  FHE_PROF(FandV_PROF_ADD);
   depth = std::max(depth, c.depth);
   
   c0 += c.c0;
   c1 += c.c1;
+  bound += c.bound;
+  if(bound > FandV_REDUCE_TERMS)
+    reduce();
 }
 
 FandV_ct FandV_ct::sub(const FandV_ct& c) const {
+  FHE_PROF(FandV_PROF_ADD);
   FandV_ct res(p, rlkl, rlki);
   res.depth = std::max(depth, c.depth);
   
   res.c0 = c0-c.c0;
   res.c1 = c1-c.c1;
+  res.bound = bound+c.bound;
+  if(res.bound > FandV_REDUCE_TERMS)
+    res.reduce();
   
   return(res);
 }
+void FandV_ct::subEq(const FandV_ct& c) {
+  FHE_PROF(FandV_PROF_ADD);
+  depth = std::max(depth, c.depth);
+  
+  c0 -= c.c0;
+  c1 -= c.c1;
+  bound += c.bound;
+  if(bound > FandV_REDUCE_TERMS)
+    reduce();
+}
 
 FandV_ct FandV_ct::mul(const FandV_ct& c) const {
-  fmpz_polyxx c2, res2;
+  FHE_PROF(FandV_PROF_MUL);
+  fmpz_polyxx c2;
   c2.realloc(p.Phi.length());
-  res2.realloc(p.Phi.length());
-  fmpzxx one(1);
   FandV_ct res(p, rlkl, rlki);
   res.depth = depth+c.depth+1;
   
-  // c0
-  //res.c0 = ((c0*c.c0)%p.Phi); Rcout << res.c0 << "\n"; // Following indented lines are 2x faster at doing modulo cyclotomic poly
-    res.c0 = c0*c.c0;
-    for(int i=0; i<p.Phi.length()-1; i++) {
-      res.c0.set_coeff(i, res.c0.get_coeff(i)-res.c0.get_coeff(i+p.Phi.length()-1));
-      res.c0.set_coeff(i+p.Phi.length()-1, 0);
-    }
-    res.c0.set_coeff(2*p.Phi.length()-2, 0);
-    
-  res2   = (p.t*res.c0)%p.q;
-  res.c0 = (p.t*res.c0)/p.q;
-  for(int i=0; i<p.Phi.length(); i++) {
-    if(res2.get_coeff(i) > p.q/2)
-      res.c0.set_coeff(i, res.c0.get_coeff(i)+one);
-  }
-  fmpz_polyxx_q(res.c0, p.q);
-  
-  
-  // c1
-  //res.c1 = ((c0*c.c1 + c1*c.c0)%p.Phi); // Following indented lines are 2x faster at doing modulo cyclotomic poly
-    res.c1 = c0*c.c1 + c1*c.c0;
-    for(int i=0; i<p.Phi.length()-1; i++) {
-      res.c1.set_coeff(i, res.c1.get_coeff(i)-res.c1.get_coeff(i+p.Phi.length()-1));
-      res.c1.set_coeff(i+p.Phi.length()-1, 0);
-    }
-    res.c1.set_coeff(2*p.Phi.length()-2, 0);
+  tensor(c, res.c0, res.c1, c2);
+  res.relin(c2);
+  FHE_PROF_ALLOC(FandV_PROF_CT, fmpz_polyxx_bytes(res.c0) + fmpz_polyxx_bytes(res.c1));
   
-  res2   = (p.t*res.c1)%p.q;
-  res.c1 = (p.t*res.c1)/p.q;
-  for(int i=0; i<p.Phi.length(); i++) {
-    if(res2.get_coeff(i) > p.q/2)
-      res.c1.set_coeff(i, res.c1.get_coeff(i)+one);
+  return(res);
+}
+
+// Reduce a product of two ring elements modulo Phi = x^d + 1, as x^d = -1.
+// About 2x faster than % Phi.  Given q, the folded coefficients are also
+// centred mod q in the same pass.
+static void FandV_fold(fmpz_polyxx& x, const FandV_par& p, const fmpz* q = NULL) {
+  fmpz_poly_struct* xp = x._poly();
+  slong d = p.Phi.length()-1;
+  for(slong i=0; i+d<xp->length; i++) {
+    fmpz_sub(xp->coeffs+i, xp->coeffs+i, xp->coeffs+i+d);
   }
-  fmpz_polyxx_q(res.c1, p.q);
-  
-  
-  // c2
-  //c2 = ((c1*c.c1)%p.Phi); // Following indented lines are 2x faster at doing modulo cyclotomic poly
-    c2 = c1*c.c1;
-    for(int i=0; i<p.Phi.length()-1; i++) {
-      c2.set_coeff(i, c2.get_coeff(i)-c2.get_coeff(i+p.Phi.length()-1));
-      c2.set_coeff(i+p.Phi.length()-1, 0);
-    }
-    c2.set_coeff(2*p.Phi.length()-2, 0);
-  
-  res2 = (p.t*c2)%p.q;
-  c2 = (p.t*c2)/p.q;
-  for(int i=0; i<p.Phi.length(); i++) {
-    if(res2.get_coeff(i) > p.q/2)
-      c2.set_coeff(i, c2.get_coeff(i)+one);
+  fmpz_poly_truncate(xp, d);
+  if(q != NULL) {
+    fmpz_vec_q(xp->coeffs, xp->length, q);
+    _fmpz_poly_normalise(xp);
   }
-  fmpz_polyxx_q(c2, p.q);
+}
+
+// Scale each coefficient of the three tensor components by t/q, rounding to
+// nearest, and reduce into (-q/2, q/2] (see FandV_par::scaleRound)
+static void FandV_rescale(const FandV_par& p, fmpz_polyxx& d0, fmpz_polyxx& d1, fmpz_polyxx& d2) {
+  FHE_PROF(FandV_PROF_RESCALE);
+  p.scaleRound(d0, p.q);
+  p.scaleRound(d1, p.q);
+  p.scaleRound(d2, p.q);
+}
+
+// Tensor product of two cipher texts scaled by t/q: d0 + d1 s + d2 s^2, each
+// reduced modulo Phi and q but not yet relinearised.  Karatsuba style, the
+// cross term comes from one product, (c0+c1)(c0'+c1') - c0c0' - c1c1', so only
+// three polynomial products are needed rather than four.  Excess multiples of
+// q left by additions would be scaled into the noise, so an operand whose
+// bound is past 1 is reduced first (on a copy, the operands are shared).
+void FandV_ct::tensor(const FandV_ct& c, fmpz_polyxx& d0, fmpz_polyxx& d1, fmpz_polyxx& d2) const {
+  fmpz_polyxx r[4];
+  const fmpz_polyxx *a0 = &c0, *a1 = &c1, *b0 = &c.c0, *b1 = &c.c1;
+  if(bound > 1) {
+    r[0] = c0; r[1] = c1;
+    fmpz_polyxx_q(r[0], p.q);
+    fmpz_polyxx_q(r[1], p.q);
+    a0 = &r[0]; a1 = &r[1];
+  }
+  if(c.bound > 1) {
+    r[2] = c.c0; r[3] = c.c1;
+    fmpz_polyxx_q(r[2], p.q);
+    fmpz_polyxx_q(r[3], p.q);
+    b0 = &r[2]; b1 = &r[3];
+  }
+  
+  d0 = (*a0)*(*b0);
+  d2 = (*a1)*(*b1);
+  d1 = ((*a0)+(*a1))*((*b0)+(*b1)) - d0 - d2;
   
+  FandV_fold(d0, p);
+  FandV_fold(d1, p);
+  FandV_fold(d2, p);
+  FandV_rescale(p, d0, d1, d2);
+}
+
+// Fold the s^2 term c2 of a tensored cipher text into c0 and c1 using the
+// relinearisation key (c2 is overwritten)
+void FandV_ct::relin(fmpz_polyxx& c2) {
+  FHE_PROF(FandV_PROF_RELIN);
+  fmpz_polyxx res2;
+  res2.realloc(p.Phi.length());
   
-  // relin
   for(int i=0; i<p.Phi.length(); i++) {
     res2.set_coeff(i, c2.get_coeff(i)%p.T);
     c2.set_coeff(i, c2.get_coeff(i)/p.T);
   }
   
-  FandV_rlk& rlk = (rlkl->x)[rlki];
-  //res.c0 = res.c0 + ((rlk.rlk00*res2)%p.Phi) + ((rlk.rlk10*c2)%p.Phi); // Following indented lines are 2x faster at doing modulo cyclotomic poly
-    res.c0 = res.c0 + rlk.rlk00*res2 + rlk.rlk10*c2;
-    for(int i=0; i<p.Phi.length()-1; i++) {
-      res.c0.set_coeff(i, res.c0.get_coeff(i)-res.c0.get_coeff(i+p.Phi.length()-1));
-      res.c0.set_coeff(i+p.Phi.length()-1, 0);
-    }
-    res.c0.set_coeff(2*p.Phi.length()-2, 0);
-    
-  fmpz_polyxx_q(res.c0, p.q);
-  
-  //res.c1 = res.c1 + ((rlk.rlk01*res2)%p.Phi) + ((rlk.rlk11*c2)%p.Phi); // Following indented lines are 2x faster at doing modulo cyclotomic poly
-    res.c1 = res.c1 + rlk.rlk01*res2 + rlk.rlk11*c2;
-    for(int i=0; i<p.Phi.length()-1; i++) {
-      res.c1.set_coeff(i, res.c1.get_coeff(i)-res.c1.get_coeff(i+p.Phi.length()-1));
-      res.c1.set_coeff(i+p.Phi.length()-1, 0);
-    }
-    res.c1.set_coeff(2*p.Phi.length()-2, 0);
+  std::shared_ptr<const FandV_rlk> key = rlkl->get(rlki);
+  const FandV_rlk& rlk = *key;
+  c0 = c0 + rlk.rlk00*res2 + rlk.rlk10*c2;
+  FandV_fold(c0, p, p.q._fmpz());
   
-  fmpz_polyxx_q(res.c1, p.q);
+  c1 = c1 + rlk.rlk01*res2 + rlk.rlk11*c2;
+  FandV_fold(c1, p, p.q._fmpz());
+  bound = 1;
+}
+
+void FandV_ct::reduce() {
+  fmpz_polyxx_q(c0, p.q);
+  fmpz_polyxx_q(c1, p.q);
+  bound = 1;
+}
+
+void FandV_ct::mulEq(const FandV_ct& c) {
+  FandV_ct res(mul(c));
+  swap(*this, res);
+}
+
+void FandV_ct::addmulEq(const FandV_ct& c, const fmpzxx& k) {
+  // Unit weights need no multiplication at all
+  if(k == 1) {
+    addEq(c);
+    return;
+  }
+  if(k == -1) {
+    subEq(c);
+    return;
+  }
+  depth = std::max(depth, c.depth);
   
-  return(res);
+  fmpz_poly_scalar_addmul_fmpz(c0._poly(), c.c0._poly(), k._fmpz());
+  fmpz_poly_scalar_addmul_fmpz(c1._poly(), c.c1._poly(), k._fmpz());
+  // Weights too large to track reduce straight away
+  if(fmpz_fits_si(k._fmpz()) && labs(fmpz_get_si(k._fmpz())) <= FandV_REDUCE_TERMS)
+    bound += labs(fmpz_get_si(k._fmpz()))*c.bound;
+  else
+    bound = FandV_REDUCE_TERMS+1;
+  if(bound > FandV_REDUCE_TERMS)
+    reduce();
+}
+
+// Memory
+double FandV_ct::memoryUsage() const {
+  return(sizeof(FandV_ct) - sizeof(FandV_par) + p.memoryUsage() + fmpz_polyxx_bytes(c0) + fmpz_polyxx_bytes(c1));
 }
 
 void FandV_ct::show() const {
@@ -165,6 +250,7 @@ void FandV_ct::show() const {
 
 // Save/load
 void FandV_ct::save(FILE* fp) const {
+  FHE_PROF(FandV_PROF_SAVE);
   fprintf(fp, "=> FHE pkg obj <=\nRcpp_FandV_ct\n");
   // c0
   print(fp, c0);
@@ -175,7 +261,9 @@ void FandV_ct::save(FILE* fp) const {
   // depth
   fprintf(fp, "%d\n", depth);
 }
-FandV_ct::FandV_ct(FILE* fp, const FandV_par& p_, FandV_rlk_locker* rlkl_, size_t rlki_) : p(p_), rlkl(rlkl_), rlki(rlki_) {
+FandV_ct::FandV_ct(FILE* fp, const FandV_par& p_, FandV_rlk_locker* rlkl_, size_t rlki_) : p(p_), rlkl(rlkl_), rlki(rlki_), depth(0), bound(1), accounted(p_.ctBytes()) {
+  FandV_mem_add(accounted);
+  FHE_PROF(FandV_PROF_LOAD);
   // Check for header line
   char *buf = NULL; size_t bufn = 0;
   size_t len;
@@ -198,6 +286,87 @@ FandV_ct::FandV_ct(FILE* fp, const FandV_par& p_, FandV_rlk_locker* rlkl_, size_
   read(fp, c1);
   // depth
   len = fscanf(fp, "%d\n", &depth);
+  // Older files may hold sums which were never reduced
+  reduce();
+  FHE_PROF_ALLOC(FandV_PROF_CT, fmpz_polyxx_bytes(c0) + fmpz_polyxx_bytes(c1));
   
   free(buf);
 }
+
+// Deferred relinearisation
+void FandV_tensor_acc::add(const FandV_ct& a) {
+  if(!value) {
+    value = std::make_shared<FandV_ct>(a);
+  } else {
+    value->addEq(a);
+  }
+}
+
+void FandV_tensor_acc::addmul(const FandV_ct& a, const fmpzxx& k) {
+  if(!value)
+    value = std::make_shared<FandV_ct>(a.p, a.rlkl, a.rlki);
+  value->addmulEq(a, k);
+}
+
+void FandV_tensor_acc::add(const FandV_ct& a, const FandV_ct& b, const fmpz_polyxx& d0, const fmpz_polyxx& d1, const fmpz_polyxx& d2) {
+  if(!value) {
+    value = std::make_shared<FandV_ct>(a.p, a.rlkl, a.rlki);
+    value->c0 = d0;
+    value->c1 = d1;
+  } else {
+    value->c0 += d0;
+    value->c1 += d1;
+    value->bound++;
+  }
+  if(!tensored) {
+    c2 = d2;
+    tensored = true;
+  } else {
+    c2 += d2;
+  }
+  value->depth = std::max(value->depth, a.depth+b.depth+1);
+  // Keep coefficients from growing with the number of terms
+  if(++terms >= FandV_REDUCE_TERMS)
+    reduce();
+}
+
+void FandV_tensor_acc::join(FandV_tensor_acc& rhs) {
+  if(!rhs.value)
+    return;
+  if(!value) {
+    std::swap(value, rhs.value);
+    std::swap(c2, rhs.c2);
+    std::swap(tensored, rhs.tensored);
+    std::swap(terms, rhs.terms);
+    return;
+  }
+  value->addEq(*rhs.value);
+  rhs.value.reset();
+  if(rhs.tensored) {
+    if(!tensored) {
+      std::swap(c2, rhs.c2);
+      tensored = true;
+    } else {
+      c2 += rhs.c2;
+    }
+    terms += rhs.terms;
+    if(terms >= FandV_REDUCE_TERMS)
+      reduce();
+  }
+}
+
+void FandV_tensor_acc::reduce() {
+  value->reduce();
+  if(tensored)
+    fmpz_polyxx_q(c2, value->p.q);
+  terms = 0;
+}
+
+std::shared_ptr<FandV_ct> FandV_tensor_acc::result() {
+  if(!value)
+    return(value);
+  reduce();
+  if(tensored)
+    value->relin(c2);
+  return(value);
+}
@@ -12,12 +12,22 @@
 #include <flint/fmpz_polyxx.h>
 using namespace flint;
 
+#include <memory>
+#include <atomic>
+
+// Additions leave c0 and c1 unreduced, tracking a bound on the coefficients in
+// multiples of q/2; once it passes this the cipher text is reduced mod q, so
+// coefficients never carry more than 6 bits beyond qpow
+#define FandV_REDUCE_TERMS 64
+
 class FandV_ct {
   public:
     // Constructors
     FandV_ct(const FandV_par& p_, FandV_rlk_locker* rlkl_, size_t rlki_);
     //FandV_ct(const FandV_par& p_, const FandV_rlk& rlk_);
     FandV_ct(const FandV_ct& ct);
+    FandV_ct(FandV_ct&& ct);
+    ~FandV_ct();
     
     // Operators
     FandV_ct& operator=(FandV_ct ct);
@@ -27,7 +37,17 @@ class FandV_ct {
     FandV_ct add(const FandV_ct& c) const;
     void addEq(const FandV_ct& c); // += ... overwrites ct in place
     FandV_ct sub(const FandV_ct& c) const;
+    void subEq(const FandV_ct& c); // -= ... overwrites ct in place
     FandV_ct mul(const FandV_ct& c) const;
+    void mulEq(const FandV_ct& c); // *= ... overwrites ct in place
+    void addmulEq(const FandV_ct& c, const fmpzxx& k); // += k*c for a plaintext integer k ... overwrites ct in place
+    // ... mul split into its two stages, so relinearisation can be deferred
+    void tensor(const FandV_ct& c, fmpz_polyxx& d0, fmpz_polyxx& d1, fmpz_polyxx& d2) const;
+    void relin(fmpz_polyxx& c2); // c0 + c1 s + c2 s^2 -> c0 + c1 s ... overwrites ct in place
+    void reduce(); // centred reduction of c0 and c1 mod q, resetting bound to 1 ... overwrites ct in place
+    
+    // Memory
+    double memoryUsage() const; // Exact bytes held, including parameters
     
     // Print out
     void show() const;
@@ -42,6 +62,36 @@ class FandV_ct {
     FandV_rlk_locker* rlkl;
     size_t rlki;
     int depth;
+    unsigned int bound; // |coefficients| of c0 and c1 are at most bound*q/2 (1 when reduced)
+    std::size_t accounted; // Bytes counted towards the live total (see FandV_mem.h)
+    
+    // Number of deep copies made (copy constructor calls), for tests
+    static std::atomic<long> copies;
+};
+
+// Containers hold immutable, reference counted cipher texts so that subsets
+// and transposes only move pointers; writes swap in a fresh element
+typedef std::shared_ptr<const FandV_ct> FandV_ct_ptr;
+
+// A running sum of cipher texts and tensor products with relinearisation
+// deferred to the end: the s^2 terms of the products are summed in c2 and
+// folded in once by result(), rather than once per product.  Partial sums
+// over separate ranges are combined with join().
+struct FandV_tensor_acc {
+  FandV_tensor_acc() : tensored(false), terms(0) { }
+  
+  void add(const FandV_ct& a); // += a
+  void addmul(const FandV_ct& a, const fmpzxx& k); // += k*a for a plaintext integer k
+  // += a*b, given its tensor d0 + d1 s + d2 s^2 (see FandV_ct::tensor)
+  void add(const FandV_ct& a, const FandV_ct& b, const fmpz_polyxx& d0, const fmpz_polyxx& d1, const fmpz_polyxx& d2);
+  void join(FandV_tensor_acc& rhs); // += rhs ... rhs is left empty
+  void reduce(); // centred reduction of c0, c1 and c2 mod q
+  std::shared_ptr<FandV_ct> result(); // Reduced and relinearised, null if nothing was added
+  
+  std::shared_ptr<FandV_ct> value; // Null until the first term
+  fmpz_polyxx c2; // s^2 term, once a tensor product has been added
+  bool tensored;
+  int terms; // Tensor products since the last reduction
 };
 
 #endif
@@ -12,19 +12,29 @@ using namespace RcppParallel;
 #include <iostream>
 #include "getline.h"
 #include <math.h>
+#include <unordered_set>
+#include <thread>
+#include <algorithm>
 
 #include "FandV_ct.h"
 #include "FandV_ct_vec.h"
 #include "FandV_ct_mat.h"
+#include "FandV_sched.h"
+#include "FandV_reduce.h"
 #include "FandV.h"
 
+RCPP_EXPOSED_CLASS(FandV_ct_mat)
+
 // Construct from parameters
 FandV_ct_mat::FandV_ct_mat() : nrow(0), ncol(0) { }
-FandV_ct_mat::FandV_ct_mat(const std::vector<FandV_ct>& v, const int nrow_, const int ncol_) : nrow(nrow_), ncol(ncol_), mat(v) { }
+FandV_ct_mat::FandV_ct_mat(const std::vector<FandV_ct_ptr>& v, const int nrow_, const int ncol_) : nrow(nrow_), ncol(ncol_), mat(v) { }
 
-// Copy constructor
+// Copy constructor (elements are shared, not duplicated)
 FandV_ct_mat::FandV_ct_mat(const FandV_ct_mat& ct_mat) : nrow(ct_mat.nrow), ncol(ct_mat.ncol), mat(ct_mat.mat) { }
 
+// Move constructor
+FandV_ct_mat::FandV_ct_mat(FandV_ct_mat&& ct_mat) : nrow(ct_mat.nrow), ncol(ct_mat.ncol), mat(std::move(ct_mat.mat)) { }
+
 // Assignment (copy-and-swap idiom)
 void FandV_ct_mat::swap(FandV_ct_mat& a, FandV_ct_mat& b) {
   std::swap(a.nrow, b.nrow);
@@ -42,24 +52,26 @@ FandV_ct_mat::~FandV_ct_mat() {
 }
 
 // Manipulate matrix
+// Copy-on-write: any other matrix/vector sharing the old element keeps it
 void FandV_ct_mat::set(int i, int j, const FandV_ct& ct) {
-  mat[i + j*nrow] = ct;
+  mat[i + j*nrow] = std::make_shared<const FandV_ct>(ct);
 }
 void FandV_ct_mat::setelt(int i, const FandV_ct& ct) {
-  mat[i] = ct;
+  mat[i] = std::make_shared<const FandV_ct>(ct);
 }
 void FandV_ct_mat::setmatrix(const FandV_ct_vec& ct_vec, int nrow_, int ncol_, int byrow) {
-  std::vector<FandV_ct>().swap(mat); // clear the matrix data store and reset allocation
+  std::vector<FandV_ct_ptr>().swap(mat); // clear the matrix data store and reset allocation
+  mat.reserve(nrow_*ncol_);
   if(!byrow) {
     for(int j=0; j<ncol_; j++) {
       for(int i=0; i<nrow_; i++) {
-        mat.push_back(ct_vec.get((i + j*nrow_)%ct_vec.size()));
+        mat.push_back(ct_vec.vec[(i + j*nrow_)%ct_vec.size()]);
       }
     }
   } else {
     for(int j=0; j<ncol_; j++) {
       for(int i=0; i<nrow_; i++) {
-        mat.push_back(ct_vec.get((j + i*ncol_)%ct_vec.size()));
+        mat.push_back(ct_vec.vec[(j + i*ncol_)%ct_vec.size()]);
       }
     }
   }
@@ -67,10 +79,10 @@ void FandV_ct_mat::setmatrix(const FandV_ct_vec& ct_vec, int nrow_, int ncol_, i
   ncol = ncol_;
 }
 void FandV_ct_mat::reset(const FandV_ct& ct, const int nrow_, const int ncol_) {
-  std::vector<FandV_ct>().swap(mat); // clear the matrix data store and reset allocation
+  std::vector<FandV_ct_ptr>().swap(mat); // clear the matrix data store and reset allocation
   nrow = nrow_;
   ncol = ncol_;
-  mat.resize(nrow*ncol, ct);
+  mat.resize(nrow*ncol, std::make_shared<const FandV_ct>(ct));
 }
 
 // Access ...
@@ -78,16 +90,16 @@ int FandV_ct_mat::size() const {
   return(mat.size());
 }
 FandV_ct FandV_ct_mat::get(int i) const {
-  return(mat[i]);
+  return(*mat[i]);
 }
 // Vector indicies i chosen to form new matrix of nrow x ncol
 // Basically allows us to push the complicated subsetting options onto R to figure out ... see method for [ in FandV.R 
+// Only the element pointers are copied, so row/column slices share storage with this matrix
 FandV_ct_mat FandV_ct_mat::subset(IntegerVector i, int nrow_, int ncol_) const {
   FandV_ct_mat res;
   res.nrow = nrow_;
   res.ncol = ncol_;
-  //res.mat.resize(res.nrow*res.ncol, FandC_ct(mat[0].p, mat[0].rlk));
-  // This is pretty naive, come up with something better
+  res.mat.reserve(i.size());
   for(IntegerVector::iterator itI = i.begin(); itI != i.end(); ++itI) {
     res.mat.push_back(mat[*itI]);
   }
@@ -95,8 +107,9 @@ FandV_ct_mat FandV_ct_mat::subset(IntegerVector i, int nrow_, int ncol_) const {
 }
 FandV_ct_vec FandV_ct_mat::subsetV(IntegerVector i) const {
   FandV_ct_vec res;
+  res.vec.reserve(i.size());
   for(IntegerVector::iterator it = i.begin(); it != i.end(); ++it) {
-    res.push(mat[*it]);
+    res.vec.push_back(mat[*it]);
   }
   return(res);
 }
@@ -112,78 +125,164 @@ FandV_ct_mat FandV_ct_mat::t() const {
   return(res);
 }
 
+// Binding shares the elements of the inputs.  The result is allocated once and
+// filled a column at a time: for cbind each output column is a column of one
+// input, for rbind it is the same column of every input stacked.
+struct FandV_Bind : public Worker {
+  // Input matrices, and the first output row (rbind) or column (cbind) of each
+  const std::vector<const FandV_ct_mat*>* x;
+  const std::vector<int>* off;
+  const bool byrow;
+  const unsigned int resnrow;
+  
+  // Output matrix of cipher texts
+  std::vector<FandV_ct_ptr>* res;
+  
+  // Constructor
+  FandV_Bind(const std::vector<const FandV_ct_mat*>* x_, const std::vector<int>* off_, std::vector<FandV_ct_ptr>* res_, const bool byrow_, const unsigned int resnrow_) : byrow(byrow_), resnrow(resnrow_) { x=x_; off=off_; res=res_; }
+  
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t col = begin; col < end; col++) {
+      std::vector<FandV_ct_ptr>::iterator to = res->begin() + col*resnrow;
+      if(byrow) {
+        for(unsigned int b=0; b<x->size(); b++) {
+          const FandV_ct_mat& m = *x->at(b);
+          std::copy(m.mat.begin() + col*m.nrow, m.mat.begin() + (col+1)*m.nrow, to + off->at(b));
+        }
+      } else {
+        unsigned int b = std::upper_bound(off->begin(), off->end(), (int) col) - off->begin() - 1;
+        const FandV_ct_mat& m = *x->at(b);
+        std::size_t from = (col - off->at(b))*m.nrow;
+        std::copy(m.mat.begin() + from, m.mat.begin() + from + m.nrow, to);
+      }
+    }
+  }
+};
+static FandV_ct_mat FandV_bind(const FandV_ct_mat& first, List y, bool byrow) {
+  std::vector<FandV_ct_mat> more;
+  more.reserve(y.size());
+  for(int k=0; k<y.size(); k++) {
+    more.push_back(as<FandV_ct_mat>(y[k]));
+  }
+  
+  // Offsets of each input in the bound dimension, which must agree in the other
+  std::vector<const FandV_ct_mat*> x(1, &first);
+  std::vector<int> off(1, 0);
+  int len = byrow ? first.nrow : first.ncol;
+  for(unsigned int k=0; k<more.size(); k++) {
+    if(more[k].size() == 0)
+      continue;
+    if((byrow && more[k].ncol != first.ncol) || (!byrow && more[k].nrow != first.nrow)) {
+      Rcout << "Error: number of " << (byrow ? "columns" : "rows") << " of matrices must match\n";
+      return(FandV_ct_mat());
+    }
+    x.push_back(&more[k]);
+    off.push_back(len);
+    len += byrow ? more[k].nrow : more[k].ncol;
+  }
+  
+  FandV_ct_mat res;
+  res.nrow = byrow ? len : first.nrow;
+  res.ncol = byrow ? first.ncol : len;
+  res.mat.resize((std::size_t) res.nrow*res.ncol);
+  if(res.mat.size() == 0)
+    return(res);
+  
+  const FandV_ct& x0 = first.size() > 0 ? *first.mat[0] : *x.back()->mat[0];
+  FandV_Bind bindEngine(&x, &off, &(res.mat), byrow, res.nrow);
+  FandV_parallelFor(FandV_OP_PTR, x0.p, 0, res.ncol, bindEngine, res.nrow);
+  return(res);
+}
+FandV_ct_mat FandV_ct_mat::cbind(List y) const {
+  return(FandV_bind(*this, y, false));
+}
+FandV_ct_mat FandV_ct_mat::rbind(List y) const {
+  return(FandV_bind(*this, y, true));
+}
+
 // R level ops
 FandV_ct_mat FandV_ct_mat::add(const FandV_ct_mat& x) const {
-  FandV_ct_mat res(mat, nrow, ncol);
+  FandV_ct_mat res;
+  addTo(x, res);
+  return(res);
+}
+void FandV_ct_mat::addTo(const FandV_ct_mat& x, FandV_ct_mat& res) const {
+  res.nrow = nrow;
+  res.ncol = ncol;
+  res.mat = mat;
   
   if(nrow!=x.nrow || ncol!=x.ncol || mat.size()!=x.mat.size()) {
-    return(res);
+    return;
   }
   for(unsigned int i=0; i<mat.size(); ++i) {
-    res.mat[i] = x.mat[i].add(mat[i]);
+    res.mat[i] = std::make_shared<const FandV_ct>(x.mat[i]->add(*mat[i]));
   }
-  return(res);
 }
 FandV_ct_mat FandV_ct_mat::mul(const FandV_ct_mat& x) const {
-  FandV_ct_mat res(mat, nrow, ncol);
+  FandV_ct_mat res;
+  mulTo(x, res);
+  return(res);
+}
+void FandV_ct_mat::mulTo(const FandV_ct_mat& x, FandV_ct_mat& res) const {
+  res.nrow = nrow;
+  res.ncol = ncol;
+  res.mat = mat;
   
   if(nrow!=x.nrow || ncol!=x.ncol || mat.size()!=x.mat.size()) {
-    return(res);
+    return;
   }
   for(unsigned int i=0; i<mat.size(); ++i) {
-    res.mat[i] = x.mat[i].mul(mat[i]);
+    res.mat[i] = std::make_shared<const FandV_ct>(x.mat[i]->mul(*mat[i]));
   }
-  return(res);
 }
 
 struct FandV_MulCtVec : public Worker {
   // Input values to multiply
-  const std::vector<FandV_ct>* x;
-  const std::vector<FandV_ct>* y;
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector<FandV_ct_ptr>* y;
   
   // Output vector of cipher texts
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructor
-  FandV_MulCtVec(const std::vector<FandV_ct>* x_, const std::vector<FandV_ct>* y_, std::vector<FandV_ct>* res_) : x(x_), y(y_), res(res_) { }
+  FandV_MulCtVec(const std::vector<FandV_ct_ptr>* x_, const std::vector<FandV_ct_ptr>* y_, std::vector<FandV_ct_ptr>* res_) : x(x_), y(y_), res(res_) { }
   
   // function call operator that work for the specified range (begin/end)
   void operator()(std::size_t begin, std::size_t end) {
     for(std::size_t i = begin; i < end; i++) {
-      res->at(i) = x->at(i).mul(y->at(i%(y->size())));
+      res->at(i) = std::make_shared<const FandV_ct>(x->at(i)->mul(*y->at(i%(y->size()))));
     }
   }
 };
 FandV_ct_mat FandV_ct_mat::mulctmatParallel(const FandV_ct_mat& ctmat) const {
   // Setup destination
   FandV_ct_mat res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.mat.resize(nrow*ncol, zero);
+  res.mat.resize(nrow*ncol);
   res.nrow = nrow;
   res.ncol = ncol;
   
   FandV_MulCtVec mulEngine(&mat, &(ctmat.mat), &(res.mat));
-  parallelFor(0, nrow*ncol, mulEngine);
+  FandV_parallelFor(FandV_OP_MUL, mat[0]->p, 0, nrow*ncol, mulEngine);
   
   return(res);
 }
 FandV_ct_mat FandV_ct_mat::mulctvecParallel(const FandV_ct_vec& ctvec) const {
   // Setup destination
   FandV_ct_mat res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.mat.resize(nrow*ncol, zero);
+  res.mat.resize(nrow*ncol);
   res.nrow = nrow;
   res.ncol = ncol;
   
   FandV_MulCtVec mulEngine(&mat, &(ctvec.vec), &(res.mat));
-  parallelFor(0, nrow*ncol, mulEngine);
+  FandV_parallelFor(FandV_OP_MUL, mat[0]->p, 0, nrow*ncol, mulEngine);
   
   return(res);
 }
 FandV_ct_mat FandV_ct_mat::mulctvecSerial(const FandV_ct_vec& ctvec) const {
   FandV_ct_mat res(mat, nrow, ncol);
   for(unsigned int i=0; i<mat.size(); i++) {
-    res.mat[i] = mat[i].mul(ctvec.get(i%ctvec.size()));
+    res.mat[i] = std::make_shared<const FandV_ct>(mat[i]->mul(*ctvec.vec[i%ctvec.size()]));
   }
   return(res);
 }
@@ -191,30 +290,32 @@ FandV_ct_mat FandV_ct_mat::mulctvecSerial(const FandV_ct_vec& ctvec) const {
 FandV_ct_mat FandV_ct_mat::addct(const FandV_ct& ct) const {
   FandV_ct_mat res(mat, nrow, ncol);
   for(unsigned int i=0; i<mat.size(); i++) {
-    res.mat[i] = mat[i].add(ct);
+    res.mat[i] = std::make_shared<const FandV_ct>(mat[i]->add(ct));
   }
   return(res);
 }
 FandV_ct_mat FandV_ct_mat::mulctParallel(const FandV_ct& ct) const {
-  // Setup destination
   FandV_ct_mat res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.mat.resize(nrow*ncol, zero);
+  mulctTo(ct, res);
+  return(res);
+}
+void FandV_ct_mat::mulctTo(const FandV_ct& ct, FandV_ct_mat& res) const {
+  // Setup destination
+  res.mat.resize(nrow*ncol);
   res.nrow = nrow;
   res.ncol = ncol;
   
-  std::vector<FandV_ct> tmp;
-  tmp.push_back(ct);
+  // Non-owning pointer: ct outlives the parallel loop
+  std::vector<FandV_ct_ptr> tmp;
+  tmp.push_back(FandV_ct_ptr(FandV_ct_ptr(), &ct));
   
   FandV_MulCtVec mulEngine(&mat, &tmp, &(res.mat));
-  parallelFor(0, nrow*ncol, mulEngine);
-  
-  return(res);
+  FandV_parallelFor(FandV_OP_MUL, ct.p, 0, nrow*ncol, mulEngine);
 }
 FandV_ct_mat FandV_ct_mat::mulctSerial(const FandV_ct& ct) const {
   FandV_ct_mat res(mat, nrow, ncol);
   for(unsigned int i=0; i<mat.size(); i++) {
-    res.mat[i] = mat[i].mul(ct);
+    res.mat[i] = std::make_shared<const FandV_ct>(mat[i]->mul(ct));
   }
   return(res);
 }
@@ -222,15 +323,15 @@ FandV_ct_mat FandV_ct_mat::mulctSerial(const FandV_ct& ct) const {
 
 struct FandV_MatMul : public Worker {
   // Input values to multiply
-  const std::vector<FandV_ct>* x;
-  const std::vector<FandV_ct>* y;
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector<FandV_ct_ptr>* y;
   const unsigned int xnrow, xncolynrow, yncol;
   
   // Output vector of cipher texts
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructor
-  FandV_MatMul(const std::vector<FandV_ct>* x_, const std::vector<FandV_ct>* y_, std::vector<FandV_ct>* res_, const unsigned int xnrow_, const int xncolynrow_, const int yncol_) : xnrow(xnrow_), xncolynrow(xncolynrow_), yncol(yncol_) { x=x_; y=y_; res=res_; }
+  FandV_MatMul(const std::vector<FandV_ct_ptr>* x_, const std::vector<FandV_ct_ptr>* y_, std::vector<FandV_ct_ptr>* res_, const unsigned int xnrow_, const int xncolynrow_, const int yncol_) : xnrow(xnrow_), xncolynrow(xncolynrow_), yncol(yncol_) { x=x_; y=y_; res=res_; }
   
   // function call operator that work for the specified range (begin/end)
   void operator()(std::size_t begin, std::size_t end) {
@@ -238,38 +339,41 @@ struct FandV_MatMul : public Worker {
     for(std::size_t ij = begin; ij < end; ij++) {
       i = ij/yncol;
       j = ij%yncol;
-      for(k=0; k<xncolynrow; k++) {
-        res->at(i + j*xnrow).addEq(x->at(i + k*xnrow).mul(y->at(k + j*xncolynrow)));
+      std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(x->at(i)->mul(*y->at(j*xncolynrow)));
+      for(k=1; k<xncolynrow; k++) {
+        sum->addEq(x->at(i + k*xnrow)->mul(*y->at(k + j*xncolynrow)));
       }
+      res->at(i + j*xnrow) = sum;
     }
   }
 };
 FandV_ct_mat FandV_ct_mat::matmulParallel(const FandV_ct_mat& y) const {
-  // Setup destination
   FandV_ct_mat res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.mat.resize(nrow*y.ncol, zero);
+  matmulTo(y, res);
+  return(res);
+}
+void FandV_ct_mat::matmulTo(const FandV_ct_mat& y, FandV_ct_mat& res) const {
+  // Setup destination
+  res.mat.resize(nrow*y.ncol);
   res.nrow = nrow;
   res.ncol = y.ncol;
   
   FandV_MatMul matmulEngine(&mat, &(y.mat), &(res.mat), nrow, ncol, y.ncol);
-  parallelFor(0, res.nrow*res.ncol, matmulEngine);
-  
-  return(res);
+  FandV_parallelFor(FandV_OP_MUL, mat[0]->p, 0, res.nrow*res.ncol, matmulEngine, ncol);
 }
 FandV_ct_mat FandV_ct_mat::matmulSerial(const FandV_ct_mat& y) const {
   FandV_ct_mat res;
   // Setup destination size
-  res.mat.resize(nrow*y.ncol, mat[0]);
+  res.mat.resize(nrow*y.ncol);
   res.nrow = nrow;
   res.ncol = y.ncol;
   
   // Do naive multiply ... switch for something clever like Strassen's algorithm in future
   for(int i=0; i<nrow; i++) {
     for(int j=0; j<y.ncol; j++) {
-      FandV_ct sum(mat[0].p, mat[0].rlkl, mat[0].rlki);
-      for(int k=0; k<ncol; k++) {
-        sum = sum.add(mat[i + k*nrow].mul(y.mat[k + j*y.nrow]));
+      std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(mat[i]->mul(*y.mat[j*y.nrow]));
+      for(int k=1; k<ncol; k++) {
+        sum->addEq(mat[i + k*nrow]->mul(*y.mat[k + j*y.nrow]));
       }
       res.mat[i + j*nrow] = sum;
     }
@@ -279,15 +383,15 @@ FandV_ct_mat FandV_ct_mat::matmulSerial(const FandV_ct_mat& y) const {
 
 struct FandV_TMatMul : public Worker {
   // Input values to multiply
-  const std::vector<FandV_ct>* x;
-  const std::vector<FandV_ct>* y;
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector<FandV_ct_ptr>* y;
   const unsigned int xncol, xnrowynrow, yncol;
   
   // Output vector of cipher texts
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructor
-  FandV_TMatMul(const std::vector<FandV_ct>* x_, const std::vector<FandV_ct>* y_, std::vector<FandV_ct>* res_, const unsigned int xncol_, const int xnrowynrow_, const int yncol_) : xncol(xncol_), xnrowynrow(xnrowynrow_), yncol(yncol_) { x=x_; y=y_; res=res_; }
+  FandV_TMatMul(const std::vector<FandV_ct_ptr>* x_, const std::vector<FandV_ct_ptr>* y_, std::vector<FandV_ct_ptr>* res_, const unsigned int xncol_, const int xnrowynrow_, const int yncol_) : xncol(xncol_), xnrowynrow(xnrowynrow_), yncol(yncol_) { x=x_; y=y_; res=res_; }
   
   // function call operator that work for the specified range (begin/end)
   void operator()(std::size_t begin, std::size_t end) {
@@ -295,37 +399,40 @@ struct FandV_TMatMul : public Worker {
     for(std::size_t ij = begin; ij < end; ij++) {
       i = ij/yncol;
       j = ij%yncol;
-      for(k=0; k<xnrowynrow; k++) {
-        res->at(i + j*xncol).addEq(x->at(k + i*xnrowynrow).mul(y->at(k + j*xnrowynrow)));
+      std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(x->at(i*xnrowynrow)->mul(*y->at(j*xnrowynrow)));
+      for(k=1; k<xnrowynrow; k++) {
+        sum->addEq(x->at(k + i*xnrowynrow)->mul(*y->at(k + j*xnrowynrow)));
       }
+      res->at(i + j*xncol) = sum;
     }
   }
 };
 FandV_ct_mat FandV_ct_mat::TmatmulParallel(const FandV_ct_mat& y) const {
-  // Setup destination
   FandV_ct_mat res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.mat.resize(ncol*y.ncol, zero);
+  TmatmulTo(y, res);
+  return(res);
+}
+void FandV_ct_mat::TmatmulTo(const FandV_ct_mat& y, FandV_ct_mat& res) const {
+  // Setup destination
+  res.mat.resize(ncol*y.ncol);
   res.nrow = ncol;
   res.ncol = y.ncol;
   
   FandV_TMatMul TmatmulEngine(&mat, &(y.mat), &(res.mat), ncol, nrow, y.ncol);
-  parallelFor(0, res.nrow*res.ncol, TmatmulEngine);
-  
-  return(res);
+  FandV_parallelFor(FandV_OP_MUL, mat[0]->p, 0, res.nrow*res.ncol, TmatmulEngine, nrow);
 }
 
 struct FandV_MatMulT : public Worker {
   // Input values to multiply
-  const std::vector<FandV_ct>* x;
-  const std::vector<FandV_ct>* y;
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector<FandV_ct_ptr>* y;
   const unsigned int xnrow, xncolyncol, ynrow;
   
   // Output vector of cipher texts
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructor
-  FandV_MatMulT(const std::vector<FandV_ct>* x_, const std::vector<FandV_ct>* y_, std::vector<FandV_ct>* res_, const unsigned int xnrow_, const int xncolyncol_, const int ynrow_) : xnrow(xnrow_), xncolyncol(xncolyncol_), ynrow(ynrow_) { x=x_; y=y_; res=res_; }
+  FandV_MatMulT(const std::vector<FandV_ct_ptr>* x_, const std::vector<FandV_ct_ptr>* y_, std::vector<FandV_ct_ptr>* res_, const unsigned int xnrow_, const int xncolyncol_, const int ynrow_) : xnrow(xnrow_), xncolyncol(xncolyncol_), ynrow(ynrow_) { x=x_; y=y_; res=res_; }
   
   // function call operator that work for the specified range (begin/end)
   void operator()(std::size_t begin, std::size_t end) {
@@ -333,112 +440,348 @@ struct FandV_MatMulT : public Worker {
     for(std::size_t ij = begin; ij < end; ij++) {
       i = ij/ynrow;
       j = ij%ynrow;
-      for(k=0; k<xncolyncol; k++) {
-        res->at(i + j*xnrow).addEq(x->at(i + k*xnrow).mul(y->at(j + k*ynrow)));
+      std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(x->at(i)->mul(*y->at(j)));
+      for(k=1; k<xncolyncol; k++) {
+        sum->addEq(x->at(i + k*xnrow)->mul(*y->at(j + k*ynrow)));
       }
+      res->at(i + j*xnrow) = sum;
     }
   }
 };
 FandV_ct_mat FandV_ct_mat::matmulTParallel(const FandV_ct_mat& y) const {
   // Setup destination
   FandV_ct_mat res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.mat.resize(nrow*y.nrow, zero);
+  res.mat.resize(nrow*y.nrow);
   res.nrow = nrow;
   res.ncol = y.nrow;
   
   FandV_MatMulT matmulTEngine(&mat, &(y.mat), &(res.mat), nrow, ncol, y.nrow);
-  parallelFor(0, res.nrow*res.ncol, matmulTEngine);
+  FandV_parallelFor(FandV_OP_MUL, mat[0]->p, 0, res.nrow*res.ncol, matmulTEngine, ncol);
   
   return(res);
 }
 
-struct FandV_RowSums : public Worker {
-  // Input matrix to row sum
-  const std::vector<FandV_ct>* x;
-  const unsigned int xnrow, xncol;
+// Matrix-vector products.  Output element i is the sum over k of a(i,k)*y[k],
+// where a(i,k) = x[i*si + k*sk].  Work is split by output element and, when
+// there are too few of those to occupy the threads, also into chunks of k
+// whose partial sums are joined afterwards.  For a cipher text y the products
+// are summed as unrelinearised tensors, so each output is relinearised once
+// rather than once per term; for a plaintext y each term is a scalar
+// multiply-add, zero weights being skipped.
+struct FandV_MatVec : public Worker {
+  // Input matrix and vector, y or w
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector<FandV_ct_ptr>* y;
+  const std::vector<fmpzxx>* w;
+  const unsigned int si, sk, len, chunks, chunk;
+  
+  // Partial sums, chunks per output element
+  std::vector<FandV_tensor_acc>* part;
+  
+  // Constructor
+  FandV_MatVec(const std::vector<FandV_ct_ptr>* x_, const std::vector<FandV_ct_ptr>* y_, const std::vector<fmpzxx>* w_, std::vector<FandV_tensor_acc>* part_, const unsigned int si_, const unsigned int sk_, const unsigned int len_, const unsigned int chunks_) : si(si_), sk(sk_), len(len_), chunks(chunks_), chunk((len_+chunks_-1)/chunks_) { x=x_; y=y_; w=w_; part=part_; }
+  
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    fmpz_polyxx d0, d1, d2;
+    for(std::size_t t = begin; t < end; t++) {
+      unsigned int i = t/chunks;
+      unsigned int kend = std::min(len, (unsigned int) (t%chunks + 1)*chunk);
+      FandV_tensor_acc& acc = part->at(t);
+      for(unsigned int k = (t%chunks)*chunk; k < kend; k++) {
+        const FandV_ct& a = *x->at(i*si + k*sk);
+        if(w) {
+          if(w->at(k) != 0)
+            acc.addmul(a, w->at(k));
+          continue;
+        }
+        
+        const FandV_ct& b = *y->at(k);
+        a.tensor(b, d0, d1, d2);
+        acc.add(a, b, d0, d1, d2);
+      }
+    }
+  }
+};
+
+// Join the chunks of each output element, then reduce and relinearise
+struct FandV_MatVecJoin : public Worker {
+  std::vector<FandV_tensor_acc>* part;
+  const unsigned int chunks;
+  const FandV_ct* zero;
   
   // Output vector of cipher texts
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructor
-  FandV_RowSums(const std::vector<FandV_ct>* x_, std::vector<FandV_ct>* res_, const unsigned int xnrow_, const int xncol_) : xnrow(xnrow_), xncol(xncol_) { x=x_; res=res_; }
+  FandV_MatVecJoin(std::vector<FandV_tensor_acc>* part_, std::vector<FandV_ct_ptr>* res_, const unsigned int chunks_, const FandV_ct* zero_) : chunks(chunks_), zero(zero_) { part=part_; res=res_; }
   
   // function call operator that work for the specified range (begin/end)
   void operator()(std::size_t begin, std::size_t end) {
-    for(std::size_t row = begin; row < end; row++) {
-      for(unsigned int i=0; i<xncol; i++) {
-        res->at(row).addEq(x->at(row + i*xnrow));
+    for(std::size_t i = begin; i < end; i++) {
+      FandV_tensor_acc& acc = part->at(i*chunks);
+      for(unsigned int c = 1; c < chunks; c++) {
+        acc.join(part->at(i*chunks + c));
+      }
+      
+      std::shared_ptr<FandV_ct> sum = acc.result();
+      if(!sum) { // Every weight was zero
+        res->at(i) = std::make_shared<const FandV_ct>(*zero);
+      } else {
+        res->at(i) = sum;
       }
     }
   }
 };
-FandV_ct_vec FandV_ct_mat::rowSumsParallel() const {
-  // Setup destination
+
+// Outputs n, each a sum of len terms
+static FandV_ct_vec FandV_matvec(const std::vector<FandV_ct_ptr>& mat, const std::vector<FandV_ct_ptr>* y, const std::vector<fmpzxx>* w, unsigned int n, unsigned int len, unsigned int si, unsigned int sk) {
   FandV_ct_vec res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.vec.resize(nrow, zero);
-  
-  FandV_RowSums rowSumsEngine(&mat, &(res.vec), nrow, ncol);
-  parallelFor(0, nrow, rowSumsEngine);
-  
+  if((y ? y->size() : w->size()) != len) {
+    Rcout << "Error: non-conformable arguments\n";
+    return(res);
+  }
+  if(mat.size() == 0)
+    return(res);
+  const FandV_ct& x0 = *mat[0];
+  
+  // Chunk the sums if there are fewer outputs than threads
+  int threads = FandV_getThreads();
+  if(threads == 0)
+    threads = std::max((int) std::thread::hardware_concurrency(), 1);
+  unsigned int chunks = std::max(std::min(((unsigned int) threads + n - 1)/n, len), 1u);
+  
+  std::vector<FandV_tensor_acc> part(n*chunks);
+  FandV_MatVec matvecEngine(&mat, y, w, &part, si, sk, len, chunks);
+  FandV_parallelFor(y ? FandV_OP_MUL : FandV_OP_ADD, x0.p, 0, n*chunks, matvecEngine, (double) len/chunks);
+  
+  res.vec.resize(n);
+  FandV_ct zero(x0.p, x0.rlkl, x0.rlki);
+  FandV_MatVecJoin joinEngine(&part, &(res.vec), chunks, &zero);
+  FandV_parallelFor(y ? FandV_OP_MUL : FandV_OP_ADD, x0.p, 0, n, joinEngine);
   return(res);
 }
-FandV_ct_vec FandV_ct_mat::rowSumsSerial() const {
-  FandV_ct_vec res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.vec.resize(nrow, zero);
-  for(int j=0; j<nrow; j++) {
-    for(int i=0; i<ncol; i++) {
-      res.vec.at(j).addEq(mat.at(j + i*nrow));
+
+static std::vector<fmpzxx> FandV_weights(IntegerVector y) {
+  std::vector<fmpzxx> w(y.size());
+  for(int i=0; i<y.size(); i++) {
+    w[i] = fmpzxx((long) y[i]);
+  }
+  return(w);
+}
+
+FandV_ct_vec FandV_ct_mat::matvec(const FandV_ct_vec& y) const {
+  return(FandV_matvec(mat, &(y.vec), NULL, nrow, ncol, 1, nrow));
+}
+FandV_ct_vec FandV_ct_mat::tmatvec(const FandV_ct_vec& y) const {
+  return(FandV_matvec(mat, &(y.vec), NULL, ncol, nrow, nrow, 1));
+}
+FandV_ct_vec FandV_ct_mat::matvecpt(IntegerVector y) const {
+  std::vector<fmpzxx> w(FandV_weights(y));
+  return(FandV_matvec(mat, NULL, &w, nrow, ncol, 1, nrow));
+}
+FandV_ct_vec FandV_ct_mat::tmatvecpt(IntegerVector y) const {
+  std::vector<fmpzxx> w(FandV_weights(y));
+  return(FandV_matvec(mat, NULL, &w, ncol, nrow, nrow, 1));
+}
+
+// Products with a plaintext integer matrix W, as this %*% W or W %*% this.
+// Each term is a scalar multiply-add (an add or subtract for weights of +-1),
+// so nothing is relinearised, and the nonzero weights of each row (or column)
+// of W are listed once up front so zeros cost nothing.
+struct FandV_PtMatMul : public Worker {
+  // Input cipher text matrix, nonzero weights of W and the layout
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector< std::vector< std::pair<unsigned int, fmpzxx> > >* nz;
+  const unsigned int xnrow, resnrow;
+  const bool left; // W %*% this
+  const FandV_ct* zero;
+  
+  // Output vector of cipher texts
+  std::vector<FandV_ct_ptr>* res;
+  
+  // Constructor
+  FandV_PtMatMul(const std::vector<FandV_ct_ptr>* x_, const std::vector< std::vector< std::pair<unsigned int, fmpzxx> > >* nz_, std::vector<FandV_ct_ptr>* res_, const unsigned int xnrow_, const unsigned int resnrow_, const bool left_, const FandV_ct* zero_) : xnrow(xnrow_), resnrow(resnrow_), left(left_), zero(zero_) { x=x_; nz=nz_; res=res_; }
+  
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    unsigned int i, j;
+    for(std::size_t ij = begin; ij < end; ij++) {
+      i = ij%resnrow;
+      j = ij/resnrow;
+      // Row i of W, or column j of W
+      const std::vector< std::pair<unsigned int, fmpzxx> >& w = nz->at(left ? i : j);
+      std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(*zero);
+      for(unsigned int t=0; t<w.size(); t++) {
+        unsigned int k = w[t].first;
+        sum->addmulEq(*x->at(left ? k + j*xnrow : i + k*xnrow), w[t].second);
+      }
+      res->at(ij) = sum;
     }
   }
+};
+static FandV_ct_mat FandV_ptmatmul(const FandV_ct_mat& x, IntegerVector w, int wnrow, int wncol, bool left) {
+  FandV_ct_mat res;
+  if(wnrow < 0 || wncol < 0 || (left ? wncol != x.nrow : wnrow != x.ncol) || w.size() != wnrow*wncol) {
+    Rcout << "Error: non-conformable arguments\n";
+    return(res);
+  }
+  if(x.mat.size() == 0)
+    return(res);
+  
+  // Nonzero weights by row of W (left) or by column of W (right)
+  std::vector< std::vector< std::pair<unsigned int, fmpzxx> > > nz(left ? wnrow : wncol);
+  std::size_t terms = 0;
+  for(int j=0; j<wncol; j++) {
+    for(int i=0; i<wnrow; i++) {
+      int wij = w[i + j*wnrow];
+      if(wij == 0)
+        continue;
+      if(left)
+        nz[i].push_back(std::make_pair((unsigned int) j, fmpzxx((long) wij)));
+      else
+        nz[j].push_back(std::make_pair((unsigned int) i, fmpzxx((long) wij)));
+      terms++;
+    }
+  }
+  
+  // Setup destination
+  res.nrow = left ? wnrow : x.nrow;
+  res.ncol = left ? x.ncol : wncol;
+  res.mat.resize(res.nrow*res.ncol);
+  
+  const FandV_ct& x0 = *x.mat[0];
+  FandV_ct zero(x0.p, x0.rlkl, x0.rlki);
+  FandV_PtMatMul ptmatmulEngine(&(x.mat), &nz, &(res.mat), x.nrow, res.nrow, left, &zero);
+  double per = (double) terms/std::max(nz.size(), (std::size_t) 1) + 1.0;
+  FandV_parallelFor(FandV_OP_ADD, x0.p, 0, res.mat.size(), ptmatmulEngine, per);
   return(res);
 }
+FandV_ct_mat FandV_ct_mat::matmulpt(IntegerVector w, int wnrow, int wncol) const {
+  return(FandV_ptmatmul(*this, w, wnrow, wncol, false));
+}
+FandV_ct_mat FandV_ct_mat::ptmatmul(IntegerVector w, int wnrow, int wncol) const {
+  return(FandV_ptmatmul(*this, w, wnrow, wncol, true));
+}
+
+// Cell t of the upper triangle of an n x n matrix, counting down the columns:
+// column j starts at cell j(j+1)/2
+static void FandV_triu(std::size_t t, unsigned int& i, unsigned int& j) {
+  j = (unsigned int) ((sqrt(8.0*t + 1.0) - 1.0)/2.0);
+  while((std::size_t) (j+1)*(j+2)/2 <= t) j++;
+  while((std::size_t) j*(j+1)/2 > t) j--;
+  i = t - (std::size_t) j*(j+1)/2;
+}
 
-struct FandV_ColSums : public Worker {
-  // Input matrix to row sum
-  const std::vector<FandV_ct>* x;
-  const unsigned int xnrow, xncol;
+// Symmetric product a %*% t(a) where element (i,k) of a is x[i*si + k*sk]: only
+// the upper triangle is computed, and each off diagonal result is shared with
+// its mirror image.  Every cell costs the same len multiplications, so
+// splitting the packed triangle evenly balances the work.
+struct FandV_Syrk : public Worker {
+  // Input values to multiply
+  const std::vector<FandV_ct_ptr>* x;
+  const unsigned int n, len, si, sk;
   
   // Output vector of cipher texts
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructor
-  FandV_ColSums(const std::vector<FandV_ct>* x_, std::vector<FandV_ct>* res_, const unsigned int xnrow_, const int xncol_) : xnrow(xnrow_), xncol(xncol_) { x=x_; res=res_; }
+  FandV_Syrk(const std::vector<FandV_ct_ptr>* x_, std::vector<FandV_ct_ptr>* res_, const unsigned int n_, const unsigned int len_, const unsigned int si_, const unsigned int sk_) : n(n_), len(len_), si(si_), sk(sk_) { x=x_; res=res_; }
   
   // function call operator that work for the specified range (begin/end)
   void operator()(std::size_t begin, std::size_t end) {
-    for(std::size_t col = begin; col < end; col++) {
-      for(unsigned int i=0; i<xnrow; i++) {
-        res->at(col).addEq(x->at(i + col*xnrow));
+    unsigned int i, j, k;
+    for(std::size_t t = begin; t < end; t++) {
+      FandV_triu(t, i, j);
+      std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(x->at(i*si)->mul(*x->at(j*si)));
+      for(k=1; k<len; k++) {
+        sum->addEq(x->at(i*si + k*sk)->mul(*x->at(j*si + k*sk)));
       }
+      res->at(i + j*n) = sum;
+      res->at(j + i*n) = sum;
     }
   }
 };
-FandV_ct_vec FandV_ct_mat::colSumsParallel() const {
+FandV_ct_mat FandV_ct_mat::syrkParallel() const {
   // Setup destination
-  FandV_ct_vec res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.vec.resize(ncol, zero);
+  FandV_ct_mat res;
+  res.mat.resize(ncol*ncol);
+  res.nrow = ncol;
+  res.ncol = ncol;
   
-  FandV_ColSums colSumsEngine(&mat, &(res.vec), nrow, ncol);
-  parallelFor(0, ncol, colSumsEngine);
+  // Columns of this are the rows of t(this)
+  FandV_Syrk syrkEngine(&mat, &(res.mat), ncol, nrow, nrow, 1);
+  FandV_parallelFor(FandV_OP_MUL, mat[0]->p, 0, (std::size_t) ncol*(ncol+1)/2, syrkEngine, nrow);
   
   return(res);
 }
+FandV_ct_mat FandV_ct_mat::tsyrkParallel() const {
+  // Setup destination
+  FandV_ct_mat res;
+  res.mat.resize(nrow*nrow);
+  res.nrow = nrow;
+  res.ncol = nrow;
+  
+  FandV_Syrk tsyrkEngine(&mat, &(res.mat), nrow, ncol, 1, nrow);
+  FandV_parallelFor(FandV_OP_MUL, mat[0]->p, 0, (std::size_t) nrow*(nrow+1)/2, tsyrkEngine, ncol);
+  
+  return(res);
+}
+
+FandV_ct_vec FandV_ct_mat::rowSumsParallel() const {
+  FandV_ct_vec res;
+  std::vector< std::shared_ptr<FandV_ct> > sums;
+  FandV_sums(mat, nrow, ncol, 1, nrow, sums);
+  res.vec.assign(sums.begin(), sums.end());
+  return(res);
+}
+FandV_ct_vec FandV_ct_mat::rowSumsSerial() const {
+  FandV_ct_vec res;
+  res.vec.resize(nrow);
+  for(int j=0; j<nrow; j++) {
+    std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(*mat.at(j));
+    for(int i=1; i<ncol; i++) {
+      sum->addEq(*mat.at(j + i*nrow));
+    }
+    res.vec.at(j) = sum;
+  }
+  return(res);
+}
+
+FandV_ct_vec FandV_ct_mat::colSumsParallel() const {
+  FandV_ct_vec res;
+  colSumsTo(res);
+  return(res);
+}
+void FandV_ct_mat::colSumsTo(FandV_ct_vec& res) const {
+  std::vector< std::shared_ptr<FandV_ct> > sums;
+  FandV_sums(mat, ncol, nrow, nrow, 1, sums);
+  res.vec.assign(sums.begin(), sums.end());
+}
 FandV_ct_vec FandV_ct_mat::colSumsSerial() const {
   FandV_ct_vec res;
-  FandV_ct zero(mat[0].p, mat[0].rlkl, mat[0].rlki);
-  res.vec.resize(ncol, zero);
+  res.vec.resize(ncol);
   for(int i=0; i<ncol; i++) {
-    for(int j=0; j<nrow; j++) {
-      res.vec.at(i).addEq(mat.at(j + i*nrow));
+    std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(*mat.at(i*nrow));
+    for(int j=1; j<nrow; j++) {
+      sum->addEq(*mat.at(j + i*nrow));
     }
+    res.vec.at(i) = sum;
   }
   return(res);
 }
 
+// Memory
+double FandV_ct_mat::memoryUsage() const {
+  std::unordered_set<const FandV_ct*> seen;
+  double bytes = sizeof(FandV_ct_mat) + mat.capacity()*sizeof(FandV_ct_ptr);
+  for(unsigned int i=0; i<mat.size(); i++) {
+    if(seen.insert(mat[i].get()).second)
+      bytes += mat[i]->memoryUsage();
+  }
+  return(bytes);
+}
+
 void FandV_ct_mat::show() const {
   Rcout << "Matrix of " << nrow << " x " << ncol << " Fan and Vercauteren cipher texts\n";
 }
@@ -447,7 +790,7 @@ void FandV_ct_mat::show() const {
 void FandV_ct_mat::save(FILE* fp) const {
   fprintf(fp, "=> FHE package object <=\nRcpp_FandV_ct_mat\nnrow=%d\nncol=%d\n", nrow, ncol);
   for(unsigned int i=0; i<mat.size(); i++) {
-    mat[i].save(fp);
+    mat[i]->save(fp);
   }
 }
 FandV_ct_mat::FandV_ct_mat(FILE* fp, const FandV_par& p, FandV_rlk_locker* rlkl, size_t rlki) {
@@ -469,9 +812,9 @@ FandV_ct_mat::FandV_ct_mat(FILE* fp, const FandV_par& p, FandV_rlk_locker* rlkl,
   
   len = fscanf(fp, "nrow=%d\n", &nrow);
   len = fscanf(fp, "ncol=%d\n", &ncol);
+  mat.reserve(nrow*ncol);
   for(int i=0; i<nrow*ncol; i++) {
-    FandV_ct ct(fp, p, rlkl, rlki);
-    mat.push_back(ct);
+    mat.push_back(std::make_shared<const FandV_ct>(fp, p, rlkl, rlki));
   }
   free(buf);
 }
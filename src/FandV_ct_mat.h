@@ -15,8 +15,9 @@ class FandV_ct_mat {
   public:
     // Constructors
     FandV_ct_mat();
-    FandV_ct_mat(const std::vector<FandV_ct>& v, const int nrow_, const int ncol_);
+    FandV_ct_mat(const std::vector<FandV_ct_ptr>& v, const int nrow_, const int ncol_);
     FandV_ct_mat(const FandV_ct_mat& ct_mat);
+    FandV_ct_mat(FandV_ct_mat&& ct_mat);
     ~FandV_ct_mat();
     
     // Operators
@@ -38,6 +39,8 @@ class FandV_ct_mat {
     FandV_ct_mat subset(IntegerVector i, int nrow, int ncol) const; // vector indicies i chosen to form new matrix of nrow x ncol
     FandV_ct_vec subsetV(IntegerVector i) const;
     FandV_ct_mat t() const;
+    FandV_ct_mat cbind(List y) const; // cbind(this, y[[1]], y[[2]], ...) for matrices y[[k]], elements shared
+    FandV_ct_mat rbind(List y) const; // rbind(...) likewise
     
     // R level ops
     FandV_ct_mat add(const FandV_ct_mat& x) const;
@@ -52,10 +55,25 @@ class FandV_ct_mat {
     FandV_ct_mat matmulSerial(const FandV_ct_mat& y) const;
     FandV_ct_mat TmatmulParallel(const FandV_ct_mat& y) const; // t(this) %*% y
     FandV_ct_mat matmulTParallel(const FandV_ct_mat& y) const; // this %*% t(y)
+    FandV_ct_vec matvec(const FandV_ct_vec& y) const; // this %*% y
+    FandV_ct_vec tmatvec(const FandV_ct_vec& y) const; // t(this) %*% y
+    FandV_ct_vec matvecpt(IntegerVector y) const; // ... for a plaintext integer y
+    FandV_ct_vec tmatvecpt(IntegerVector y) const;
+    FandV_ct_mat matmulpt(IntegerVector w, int wnrow, int wncol) const; // this %*% W for a plaintext integer matrix W
+    FandV_ct_mat ptmatmul(IntegerVector w, int wnrow, int wncol) const; // W %*% this
+    FandV_ct_mat syrkParallel() const; // t(this) %*% this, mirrored elements shared
+    FandV_ct_mat tsyrkParallel() const; // this %*% t(this), likewise
     FandV_ct_vec rowSumsParallel() const;
     FandV_ct_vec rowSumsSerial() const;
     FandV_ct_vec colSumsParallel() const;
     FandV_ct_vec colSumsSerial() const;
+    // ... output parameter versions, reusing the storage of res
+    void addTo(const FandV_ct_mat& x, FandV_ct_mat& res) const;
+    void mulTo(const FandV_ct_mat& x, FandV_ct_mat& res) const;
+    void mulctTo(const FandV_ct& ct, FandV_ct_mat& res) const;
+    void matmulTo(const FandV_ct_mat& y, FandV_ct_mat& res) const;
+    void TmatmulTo(const FandV_ct_mat& y, FandV_ct_mat& res) const;
+    void colSumsTo(FandV_ct_vec& res) const;
     // ADD VECTOR?  R DOES AND ADDS COLUMN WISE
     //FandV_ct sumParallel() const;
     //FandV_ct sumSerial() const;
@@ -63,6 +81,9 @@ class FandV_ct_mat {
     //FandV_ct prodSerial() const;
     //FandV_ct innerprod(const FandV_ct_vec& x) const;
     
+    // Memory
+    double memoryUsage() const; // Bytes, counting each distinct cipher text once
+    
     // Print out
     void show() const;
     
@@ -73,7 +94,7 @@ class FandV_ct_mat {
     // For performance keep public
     int nrow;
     int ncol;
-    std::vector<FandV_ct> mat;
+    std::vector<FandV_ct_ptr> mat;
 };
 
 #endif
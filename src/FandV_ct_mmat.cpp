@@ -0,0 +1,706 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include <iostream>
+#include "getline.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <flint/fmpz.h>
+#include <flint/fmpz_poly.h>
+
+#include <mutex>
+#include <set>
+
+#if defined (__WINDOWS__)
+#define FandV_fseek _fseeki64
+#define FandV_ftell _ftelli64
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define FandV_fseek fseeko
+#define FandV_ftell ftello
+#endif
+
+#include "FandV_ct.h"
+#include "FandV_ct_vec.h"
+#include "FandV_ct_mat.h"
+#include "FandV_ct_mmat.h"
+#include "FandV_sched.h"
+#include "FandV.h"
+
+// Records start on a multiple of this (covers page size and Windows allocation granularity)
+#define FandV_MMAP_ALIGN 65536
+// Default RAM budget for one tile of records
+#define FandV_MMAP_TILE 67108864
+
+// Temporary files not yet deleted, swept by FandV_mmat_cleanup at exit
+static std::mutex FandV_mmat_tmplock;
+static std::set<std::string> FandV_mmat_tmpfiles;
+
+// Owns the file and the mapping of the records region.  On Windows there is no
+// mmap, so records are read and written through a locked FILE* instead.  A
+// temporary file is deleted once the mapping is released.
+class FandV_mmap {
+  public:
+    FandV_mmap(const std::string& file_, std::size_t offset_, std::size_t recsz_, std::size_t n_) : recsz(recsz_), n(n_), offset(offset_), file(file_), temporary(false) {
+#if defined (__WINDOWS__)
+      fp = fopen(file.c_str(), "r+b");
+      if(fp == NULL) {
+        Rcout << "Error: unable to open " << file << "\n";
+      }
+#else
+      data = NULL;
+      len = recsz*n;
+      fd = ::open(file.c_str(), O_RDWR);
+      if(fd < 0) {
+        Rcout << "Error: unable to open " << file << "\n";
+        return;
+      }
+      if(len == 0) return;
+      void* addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+      if(addr == MAP_FAILED) {
+        Rcout << "Error: unable to memory map " << file << "\n";
+        return;
+      }
+      data = (unsigned char*) addr;
+      madvise(data, len, MADV_SEQUENTIAL);
+      page = sysconf(_SC_PAGESIZE);
+#endif
+    }
+    ~FandV_mmap() {
+#if defined (__WINDOWS__)
+      if(fp != NULL) fclose(fp);
+#else
+      if(data != NULL) munmap(data, len);
+      if(fd >= 0) close(fd);
+#endif
+      if(temporary) {
+        std::lock_guard<std::mutex> guard(FandV_mmat_tmplock);
+        remove(file.c_str());
+        FandV_mmat_tmpfiles.erase(file);
+      }
+    }
+
+    void setTemporary() {
+      std::lock_guard<std::mutex> guard(FandV_mmat_tmplock);
+      temporary = true;
+      FandV_mmat_tmpfiles.insert(file);
+    }
+
+    bool ok() const {
+#if defined (__WINDOWS__)
+      return(fp != NULL);
+#else
+      return(len == 0 ? fd >= 0 : data != NULL);
+#endif
+    }
+
+    // Pointer to record i, buf is only used when there is no mapping
+    const unsigned char* get(std::size_t i, std::vector<unsigned char>& buf) const {
+#if defined (__WINDOWS__)
+      buf.resize(recsz);
+      std::lock_guard<std::mutex> guard(lock);
+      FandV_fseek(fp, offset + i*recsz, SEEK_SET);
+      if(fread(buf.data(), 1, recsz, fp) != recsz)
+        std::fill(buf.begin(), buf.end(), 0);
+      return(buf.data());
+#else
+      return(data + i*recsz);
+#endif
+    }
+    void put(std::size_t i, const unsigned char* rec) {
+#if defined (__WINDOWS__)
+      std::lock_guard<std::mutex> guard(lock);
+      FandV_fseek(fp, offset + i*recsz, SEEK_SET);
+      fwrite(rec, 1, recsz, fp);
+#else
+      memcpy(data + i*recsz, rec, recsz);
+#endif
+    }
+
+    // Read-ahead hint for records [from, to)
+    void willneed(std::size_t from, std::size_t to) const {
+#if !defined (__WINDOWS__)
+      if(data == NULL || from >= to) return;
+      std::size_t start = ((from*recsz)/page)*page;
+      madvise(data + start, to*recsz - start, MADV_WILLNEED);
+#endif
+    }
+    // Drop whole pages of records [from, to) from this process (the file keeps them)
+    void release(std::size_t from, std::size_t to) const {
+#if !defined (__WINDOWS__)
+      if(data == NULL || from >= to) return;
+      std::size_t start = ((from*recsz + page - 1)/page)*page, end = ((to*recsz)/page)*page;
+      if(end > start)
+        madvise(data + start, end - start, MADV_DONTNEED);
+#endif
+    }
+
+    std::size_t recsz, n, offset;
+
+  private:
+    std::string file;
+    bool temporary;
+#if defined (__WINDOWS__)
+    FILE* fp;
+    mutable std::mutex lock;
+#else
+    int fd;
+    unsigned char* data;
+    std::size_t len, page;
+#endif
+};
+
+// Construct
+FandV_ct_mmat::FandV_ct_mmat() : nrow(0), ncol(0), rlkl(NULL), rlki(0), recsz(0), coefsz(0), offset(0), tilebytes(FandV_MMAP_TILE) { }
+FandV_ct_mmat::FandV_ct_mmat(const FandV_par& p_, FandV_rlk_locker* rlkl_, size_t rlki_, int nrow_, int ncol_, std::string file_) : nrow(nrow_), ncol(ncol_), file(file_), p(p_), rlkl(rlkl_), rlki(rlki_), tilebytes(FandV_MMAP_TILE) {
+  create();
+}
+
+struct FandV_MmatWrite : public Worker {
+  const std::vector<FandV_ct_ptr>* x;
+  FandV_ct_mmat* res;
+
+  FandV_MmatWrite(const std::vector<FandV_ct_ptr>* x_, FandV_ct_mmat* res_) : x(x_), res(res_) { }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      res->writeRecord(i, *x->at(i));
+    }
+  }
+};
+FandV_ct_mmat::FandV_ct_mmat(const FandV_ct_mat& ct_mat, std::string file_) : nrow(ct_mat.nrow), ncol(ct_mat.ncol), file(file_), rlkl(NULL), rlki(0), recsz(0), coefsz(0), offset(0), tilebytes(FandV_MMAP_TILE) {
+  if(ct_mat.mat.size() == 0) {
+    Rcout << "Error: cannot map an empty cipher text matrix\n";
+    nrow = ncol = 0;
+    return;
+  }
+  p = ct_mat.mat[0]->p;
+  rlkl = ct_mat.mat[0]->rlkl;
+  rlki = ct_mat.mat[0]->rlki;
+  create();
+
+  FandV_MmatWrite writeEngine(&(ct_mat.mat), this);
+  FandV_parallelFor(FandV_OP_IO, p, 0, ct_mat.mat.size(), writeEngine);
+}
+FandV_ct_mmat::FandV_ct_mmat(std::string file_, FandV_rlk_locker* rlkl_) : nrow(0), ncol(0), file(file_), rlkl(rlkl_), rlki(0), recsz(0), coefsz(0), offset(0), tilebytes(FandV_MMAP_TILE) {
+  open();
+}
+
+// Copy constructor (shares the mapping)
+FandV_ct_mmat::FandV_ct_mmat(const FandV_ct_mmat& ct_mmat) : nrow(ct_mmat.nrow), ncol(ct_mmat.ncol), file(ct_mmat.file), p(ct_mmat.p), rlkl(ct_mmat.rlkl), rlki(ct_mmat.rlki), recsz(ct_mmat.recsz), coefsz(ct_mmat.coefsz), offset(ct_mmat.offset), tilebytes(ct_mmat.tilebytes), map(ct_mmat.map) { }
+
+// Assignment (copy-and-swap idiom)
+void FandV_ct_mmat::swap(FandV_ct_mmat& a, FandV_ct_mmat& b) {
+  std::swap(a.nrow, b.nrow);
+  std::swap(a.ncol, b.ncol);
+  std::swap(a.file, b.file);
+  a.p.swap(a.p, b.p);
+  std::swap(a.rlkl, b.rlkl);
+  std::swap(a.rlki, b.rlki);
+  std::swap(a.recsz, b.recsz);
+  std::swap(a.coefsz, b.coefsz);
+  std::swap(a.offset, b.offset);
+  std::swap(a.tilebytes, b.tilebytes);
+  std::swap(a.map, b.map);
+}
+FandV_ct_mmat& FandV_ct_mmat::operator=(FandV_ct_mmat ct_mmat) {
+  swap(*this, ct_mmat);
+  return(*this);
+}
+
+// Destructor (mapping is released when the last copy goes)
+FandV_ct_mmat::~FandV_ct_mmat() { }
+
+// Write the header and size the file for nrow*ncol records
+void FandV_ct_mmat::create() {
+  coefsz = FandV_ct_coefsz(p);
+  recsz = FandV_ct_recsz(p);
+
+  FILE *fp = fopen(file.c_str(), "wb");
+  if(fp == NULL) {
+    perror("Error");
+    nrow = ncol = 0;
+    return;
+  }
+
+  // header
+  fprintf(fp, "=> FHE pkg obj <=\nRcpp_FandV_ct_mmat\n");
+  // pars
+  p.save(fp);
+  // rlk
+  rlkl->get(rlki)->save(fp);
+  // dimensions and layout
+  fprintf(fp, "nrow=%d\nncol=%d\nrecsz=%lu\n", nrow, ncol, (unsigned long) recsz);
+  std::size_t pos = ftell(fp) + 28; // "offset=" + 20 digits + "\n"
+  offset = ((pos + FandV_MMAP_ALIGN - 1)/FandV_MMAP_ALIGN)*FandV_MMAP_ALIGN;
+  fprintf(fp, "offset=%020lu\n", (unsigned long) offset);
+  // extend to full size, which most filesystems store sparsely
+  std::size_t n = (std::size_t) nrow*ncol;
+  if(n > 0) {
+    FandV_fseek(fp, offset + n*recsz - 1, SEEK_SET);
+    fputc(0, fp);
+  }
+  fclose(fp);
+
+  map = std::make_shared<FandV_mmap>(file, offset, recsz, n);
+  if(!map->ok()) {
+    nrow = ncol = 0;
+  }
+}
+
+// Element-wise results belong to the object, their file going with its mapping
+void FandV_ct_mmat::setTemporary() {
+  if(map)
+    map->setTemporary();
+}
+void FandV_mmat_cleanup() {
+  std::lock_guard<std::mutex> guard(FandV_mmat_tmplock);
+  for(std::set<std::string>::const_iterator f = FandV_mmat_tmpfiles.begin(); f != FandV_mmat_tmpfiles.end(); ++f)
+    remove(f->c_str());
+  FandV_mmat_tmpfiles.clear();
+}
+
+// Read the header of an existing file and map it
+void FandV_ct_mmat::open() {
+  FILE *fp = fopen(file.c_str(), "rb");
+  if(fp == NULL) {
+    perror("Error");
+    return;
+  }
+
+  // Check for header line
+  char *buf = NULL; size_t bufn = 0;
+  size_t len;
+  len = getline(&buf, &bufn, fp);
+  if(strncmp("=> FHE pkg obj <=\n", buf, len) != 0) {
+    Rcout << "Error: file does not contain an FHE object (MMAT)\n";
+    free(buf);
+    fclose(fp);
+    return;
+  }
+  len = getline(&buf, &bufn, fp);
+  if(strncmp("Rcpp_FandV_ct_mmat\n", buf, len) != 0) {
+    Rcout << "Error: file does not contain a memory mapped ciphertext matrix\n";
+    free(buf);
+    fclose(fp);
+    return;
+  }
+
+  // pars
+  p = FandV_par(fp);
+  len = getline(&buf, &bufn, fp); // Advance past the new line
+  // rlk
+  FandV_rlk rlk(fp);
+  rlki = rlkl->add(rlk);
+  len = getline(&buf, &bufn, fp); // Advance past the new line
+  // dimensions and layout
+  unsigned long recsz_, offset_;
+  if(fscanf(fp, "nrow=%d\nncol=%d\nrecsz=%lu\noffset=%lu\n", &nrow, &ncol, &recsz_, &offset_) != 4 ||
+     nrow < 0 || ncol < 0 || recsz_ != FandV_ct_recsz(p)) {
+    Rcout << "Error: corrupt memory mapped ciphertext matrix header\n";
+    nrow = ncol = 0;
+    free(buf);
+    fclose(fp);
+    return;
+  }
+  // The records must all lie within the file, or touching the mapping past
+  // its end raises SIGBUS
+  FandV_fseek(fp, 0, SEEK_END);
+  double fsize = (double) FandV_ftell(fp);
+  if(offset_ % FandV_MMAP_ALIGN != 0 || (double) offset_ + (double) nrow*ncol*recsz_ > fsize) {
+    Rcout << "Error: truncated memory mapped ciphertext matrix\n";
+    nrow = ncol = 0;
+    free(buf);
+    fclose(fp);
+    return;
+  }
+  recsz = recsz_;
+  offset = offset_;
+  coefsz = FandV_ct_coefsz(p);
+  fclose(fp);
+  free(buf);
+
+  map = std::make_shared<FandV_mmap>(file, offset, recsz, (std::size_t) nrow*ncol);
+  if(!map->ok()) {
+    nrow = ncol = 0;
+  }
+}
+
+// Records are: int32 depth, 4 bytes padding, then the d coefficients of c0 and
+// of c1, each reduced into [0,q) and stored little endian in coefsz bytes
+std::size_t FandV_ct_coefsz(const FandV_par& p) {
+  return((p.qpow+7)/8);
+}
+std::size_t FandV_ct_recsz(const FandV_par& p) {
+  return(8 + 2*(p.Phi.length()-1)*FandV_ct_coefsz(p));
+}
+void FandV_ct_unpack(const unsigned char* rec, FandV_ct& ct) {
+  const FandV_par& p = ct.p;
+  std::size_t coefsz = FandV_ct_coefsz(p);
+  int d = p.Phi.length()-1;
+
+  int32_t depth;
+  memcpy(&depth, rec, 4);
+  ct.depth = depth;
+
+  fmpz_t c, qo2;
+  mpz_t z;
+  fmpz_init(c);
+  fmpz_init(qo2);
+  mpz_init(z);
+  fmpz_fdiv_q_2exp(qo2, p.q._fmpz(), 1);
+  fmpz_poly_struct* polys[2] = { ct.c0._poly(), ct.c1._poly() };
+  for(int k=0; k<2; k++) {
+    const unsigned char* coef = rec + 8 + k*d*coefsz;
+    fmpz_poly_zero(polys[k]);
+    fmpz_poly_fit_length(polys[k], d);
+    for(int j=0; j<d; j++) {
+      mpz_import(z, coefsz, -1, 1, 0, 0, coef + j*coefsz);
+      fmpz_set_mpz(c, z);
+      if(fmpz_cmp(c, qo2) > 0)
+        fmpz_sub(c, c, p.q._fmpz());
+      fmpz_poly_set_coeff_fmpz(polys[k], j, c);
+    }
+  }
+  mpz_clear(z);
+  fmpz_clear(qo2);
+  fmpz_clear(c);
+}
+void FandV_ct_pack(const FandV_ct& ct, unsigned char* rec) {
+  const FandV_par& p = ct.p;
+  std::size_t coefsz = FandV_ct_coefsz(p);
+  int d = p.Phi.length()-1;
+
+  memset(rec, 0, FandV_ct_recsz(p));
+  int32_t depth = ct.depth;
+  memcpy(rec, &depth, 4);
+
+  fmpz_t c;
+  mpz_t z;
+  fmpz_init(c);
+  mpz_init(z);
+  const fmpz_poly_struct* polys[2] = { ct.c0._poly(), ct.c1._poly() };
+  for(int k=0; k<2; k++) {
+    unsigned char* coef = rec + 8 + k*d*coefsz;
+    for(int j=0; j<d; j++) {
+      fmpz_poly_get_coeff_fmpz(c, polys[k], j);
+      fmpz_mod(c, c, p.q._fmpz());
+      fmpz_get_mpz(z, c);
+      mpz_export(coef + j*coefsz, NULL, -1, 1, 0, 0, z);
+    }
+  }
+  mpz_clear(z);
+  fmpz_clear(c);
+}
+
+void FandV_ct_mmat::readRecord(std::size_t i, FandV_ct& ct) const {
+  std::vector<unsigned char> buf;
+  FandV_ct_unpack(map->get(i, buf), ct);
+}
+void FandV_ct_mmat::writeRecord(std::size_t i, const FandV_ct& ct) {
+  std::vector<unsigned char> rec(recsz);
+  FandV_ct_pack(ct, &rec[0]);
+  map->put(i, &rec[0]);
+}
+void FandV_ct_mmat::prefetch(std::size_t from, std::size_t to) const {
+  map->willneed(from, to);
+}
+void FandV_ct_mmat::release(std::size_t from, std::size_t to) const {
+  map->release(from, to);
+}
+std::size_t FandV_ct_mmat::tileRecords() const {
+  return(std::max((std::size_t) 1, tilebytes/std::max(recsz, (std::size_t) 1)));
+}
+void FandV_ct_mmat::setTile(double bytes) {
+  tilebytes = std::max(bytes, 1.0);
+}
+
+// Access ...
+int FandV_ct_mmat::size() const {
+  return(nrow*ncol);
+}
+FandV_ct FandV_ct_mmat::get(int i) const {
+  FandV_ct ct(p, rlkl, rlki);
+  readRecord(i, ct);
+  return(ct);
+}
+void FandV_ct_mmat::setelt(int i, const FandV_ct& ct) {
+  writeRecord(i, ct);
+}
+
+struct FandV_MmatRead : public Worker {
+  const FandV_ct_mmat* x;
+  const std::vector<int>* idx;
+  std::vector<FandV_ct_ptr>* res;
+
+  FandV_MmatRead(const FandV_ct_mmat* x_, const std::vector<int>* idx_, std::vector<FandV_ct_ptr>* res_) : x(x_), idx(idx_), res(res_) { }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      std::shared_ptr<FandV_ct> ct = std::make_shared<FandV_ct>(x->p, x->rlkl, x->rlki);
+      x->readRecord(idx->at(i), *ct);
+      res->at(i) = ct;
+    }
+  }
+};
+FandV_ct_mat FandV_ct_mmat::load() const {
+  std::vector<int> idx(nrow*ncol);
+  for(unsigned int i=0; i<idx.size(); i++)
+    idx[i] = i;
+
+  FandV_ct_mat res;
+  res.nrow = nrow;
+  res.ncol = ncol;
+  res.mat.resize(idx.size());
+  FandV_MmatRead readEngine(this, &idx, &(res.mat));
+  FandV_parallelFor(FandV_OP_IO, p, 0, idx.size(), readEngine);
+  return(res);
+}
+FandV_ct_mat FandV_ct_mmat::subset(IntegerVector i, int nrow_, int ncol_) const {
+  std::vector<int> idx(i.begin(), i.end());
+
+  FandV_ct_mat res;
+  res.nrow = nrow_;
+  res.ncol = ncol_;
+  res.mat.resize(idx.size());
+  FandV_MmatRead readEngine(this, &idx, &(res.mat));
+  FandV_parallelFor(FandV_OP_IO, p, 0, idx.size(), readEngine);
+  return(res);
+}
+FandV_ct_vec FandV_ct_mmat::subsetV(IntegerVector i) const {
+  std::vector<int> idx(i.begin(), i.end());
+
+  FandV_ct_vec res;
+  res.vec.resize(idx.size());
+  FandV_MmatRead readEngine(this, &idx, &(res.vec));
+  FandV_parallelFor(FandV_OP_IO, p, 0, idx.size(), readEngine);
+  return(res);
+}
+
+// R level ops
+enum FandV_MmatOp { FandV_MMAT_ADD, FandV_MMAT_MUL, FandV_MMAT_ADDCT, FandV_MMAT_MULCT };
+struct FandV_MmatElt : public Worker {
+  // Input values
+  const FandV_ct_mmat* x;
+  const FandV_ct_mmat* y;
+  const FandV_ct* ct;
+  const FandV_MmatOp op;
+
+  // Output matrix
+  FandV_ct_mmat* res;
+
+  // Constructor
+  FandV_MmatElt(const FandV_ct_mmat* x_, const FandV_ct_mmat* y_, const FandV_ct* ct_, FandV_MmatOp op_, FandV_ct_mmat* res_) : x(x_), y(y_), ct(ct_), op(op_), res(res_) { }
+
+  // Element wise op, record by record
+  void operator()(std::size_t begin, std::size_t end) {
+    FandV_ct a(x->p, x->rlkl, x->rlki), b(x->p, x->rlkl, x->rlki);
+    for(std::size_t i = begin; i < end; i++) {
+      x->readRecord(i, a);
+      switch(op) {
+        case FandV_MMAT_ADD:
+          y->readRecord(i, b);
+          a.addEq(b);
+          break;
+        case FandV_MMAT_MUL:
+          y->readRecord(i, b);
+          a.mulEq(b);
+          break;
+        case FandV_MMAT_ADDCT:
+          a.addEq(*ct);
+          break;
+        case FandV_MMAT_MULCT:
+          a.mulEq(*ct);
+          break;
+      }
+      res->writeRecord(i, a);
+    }
+  }
+};
+// Run an element-wise worker over all records a tile at a time, hinting the
+// next tile to the kernel while the current one is computed
+static void FandV_mmat_stream(const FandV_ct_mmat& x, const FandV_ct_mmat* y, const FandV_ct_mmat& res, FandV_sched_op op, Worker& w) {
+  std::size_t n = x.size(), tile = x.tileRecords();
+
+  x.prefetch(0, std::min(tile, n));
+  if(y != NULL) y->prefetch(0, std::min(tile, n));
+  for(std::size_t t=0; t<n; t+=tile) {
+    std::size_t end = std::min(t+tile, n);
+    x.prefetch(end, std::min(end+tile, n));
+    if(y != NULL) y->prefetch(end, std::min(end+tile, n));
+
+    FandV_parallelFor(op, x.p, t, end, w);
+
+    x.release(t, end);
+    if(y != NULL) y->release(t, end);
+    res.release(t, end);
+  }
+}
+FandV_ct_mmat FandV_ct_mmat::add(const FandV_ct_mmat& x, std::string file_) const {
+  if(nrow!=x.nrow || ncol!=x.ncol) {
+    Rcout << "Error: non-conformable memory mapped matrices\n";
+    return(FandV_ct_mmat());
+  }
+  FandV_ct_mmat res(p, rlkl, rlki, nrow, ncol, file_);
+  res.setTemporary();
+  FandV_MmatElt addEngine(this, &x, NULL, FandV_MMAT_ADD, &res);
+  FandV_mmat_stream(*this, &x, res, FandV_OP_ADD, addEngine);
+  return(res);
+}
+FandV_ct_mmat FandV_ct_mmat::mul(const FandV_ct_mmat& x, std::string file_) const {
+  if(nrow!=x.nrow || ncol!=x.ncol) {
+    Rcout << "Error: non-conformable memory mapped matrices\n";
+    return(FandV_ct_mmat());
+  }
+  FandV_ct_mmat res(p, rlkl, rlki, nrow, ncol, file_);
+  res.setTemporary();
+  FandV_MmatElt mulEngine(this, &x, NULL, FandV_MMAT_MUL, &res);
+  FandV_mmat_stream(*this, &x, res, FandV_OP_MUL, mulEngine);
+  return(res);
+}
+FandV_ct_mmat FandV_ct_mmat::addct(const FandV_ct& ct, std::string file_) const {
+  FandV_ct_mmat res(p, rlkl, rlki, nrow, ncol, file_);
+  res.setTemporary();
+  FandV_MmatElt addEngine(this, NULL, &ct, FandV_MMAT_ADDCT, &res);
+  FandV_mmat_stream(*this, NULL, res, FandV_OP_ADD, addEngine);
+  return(res);
+}
+FandV_ct_mmat FandV_ct_mmat::mulct(const FandV_ct& ct, std::string file_) const {
+  FandV_ct_mmat res(p, rlkl, rlki, nrow, ncol, file_);
+  res.setTemporary();
+  FandV_MmatElt mulEngine(this, NULL, &ct, FandV_MMAT_MULCT, &res);
+  FandV_mmat_stream(*this, NULL, res, FandV_OP_MUL, mulEngine);
+  return(res);
+}
+
+struct FandV_MmatColSums : public Worker {
+  // Input matrix and the tile of rows [r0, r1) to add in
+  const FandV_ct_mmat* x;
+  const std::size_t r0, r1;
+
+  // Running column totals
+  std::vector<std::shared_ptr<FandV_ct> >* acc;
+
+  // Constructor
+  FandV_MmatColSums(const FandV_ct_mmat* x_, std::size_t r0_, std::size_t r1_, std::vector<std::shared_ptr<FandV_ct> >* acc_) : x(x_), r0(r0_), r1(r1_), acc(acc_) { }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    FandV_ct a(x->p, x->rlkl, x->rlki);
+    for(std::size_t col = begin; col < end; col++) {
+      std::size_t r = r0;
+      if(!acc->at(col)) {
+        acc->at(col) = std::make_shared<FandV_ct>(x->p, x->rlkl, x->rlki);
+        x->readRecord(r++ + col*x->nrow, *acc->at(col));
+      }
+      for(; r < r1; r++) {
+        x->readRecord(r + col*x->nrow, a);
+        acc->at(col)->addEq(a);
+      }
+    }
+  }
+};
+FandV_ct_vec FandV_ct_mmat::colSumsParallel() const {
+  std::vector<std::shared_ptr<FandV_ct> > acc(ncol);
+  std::size_t tile = std::max((std::size_t) 1, tileRecords()/std::max(ncol, 1));
+
+  for(std::size_t r0=0; r0<(std::size_t) nrow; r0+=tile) {
+    std::size_t r1 = std::min(r0+tile, (std::size_t) nrow);
+    for(int j=0; j<ncol; j++)
+      prefetch(r1 + j*nrow, std::min(r1+tile, (std::size_t) nrow) + j*nrow);
+
+    FandV_MmatColSums colSumsEngine(this, r0, r1, &acc);
+    FandV_parallelFor(FandV_OP_ADD, p, 0, ncol, colSumsEngine, r1-r0);
+
+    for(int j=0; j<ncol; j++)
+      release(r0 + j*nrow, r1 + j*nrow);
+  }
+
+  FandV_ct_vec res;
+  res.vec.assign(acc.begin(), acc.end());
+  return(res);
+}
+
+struct FandV_MmatTMatMul : public Worker {
+  // Decoded tile of rows [r0, r0+rows) of x, column major
+  const std::vector<FandV_ct_ptr>* xt;
+  const std::size_t rows, r0;
+  // In RAM right hand matrix
+  const std::vector<FandV_ct_ptr>* y;
+  const std::size_t ynrow, xncol;
+
+  // Running totals of t(x) %*% y
+  std::vector<std::shared_ptr<FandV_ct> >* acc;
+
+  // Constructor
+  FandV_MmatTMatMul(const std::vector<FandV_ct_ptr>* xt_, std::size_t rows_, std::size_t r0_, const std::vector<FandV_ct_ptr>* y_, std::size_t ynrow_, std::size_t xncol_, std::vector<std::shared_ptr<FandV_ct> >* acc_) : xt(xt_), rows(rows_), r0(r0_), y(y_), ynrow(ynrow_), xncol(xncol_), acc(acc_) { }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t ij = begin; ij < end; ij++) {
+      std::size_t i = ij%xncol, j = ij/xncol;
+      std::size_t r = 0;
+      if(!acc->at(ij)) {
+        acc->at(ij) = std::make_shared<FandV_ct>(xt->at(i*rows)->mul(*y->at(r0 + j*ynrow)));
+        r++;
+      }
+      for(; r < rows; r++) {
+        acc->at(ij)->addEq(xt->at(r + i*rows)->mul(*y->at(r0 + r + j*ynrow)));
+      }
+    }
+  }
+};
+FandV_ct_mat FandV_ct_mmat::TmatmulParallel(const FandV_ct_mat& y) const {
+  FandV_ct_mat res;
+  if(nrow!=y.nrow) {
+    Rcout << "Error: non-conformable arguments\n";
+    return(res);
+  }
+
+  std::vector<std::shared_ptr<FandV_ct> > acc(ncol*y.ncol);
+  std::size_t tile = std::max((std::size_t) 1, tileRecords()/std::max(ncol, 1));
+  std::vector<int> idx;
+  std::vector<FandV_ct_ptr> xt;
+
+  for(std::size_t r0=0; r0<(std::size_t) nrow; r0+=tile) {
+    std::size_t r1 = std::min(r0+tile, (std::size_t) nrow), rows = r1-r0;
+
+    // Decode this tile of x into RAM
+    idx.resize(rows*ncol);
+    for(int j=0; j<ncol; j++)
+      for(std::size_t r=0; r<rows; r++)
+        idx[r + j*rows] = r0 + r + j*nrow;
+    xt.assign(idx.size(), FandV_ct_ptr());
+    FandV_MmatRead readEngine(this, &idx, &xt);
+    FandV_parallelFor(FandV_OP_IO, p, 0, idx.size(), readEngine);
+    for(int j=0; j<ncol; j++) {
+      release(r0 + j*nrow, r1 + j*nrow);
+      prefetch(r1 + j*nrow, std::min(r1+tile, (std::size_t) nrow) + j*nrow);
+    }
+
+    FandV_MmatTMatMul TmatmulEngine(&xt, rows, r0, &(y.mat), y.nrow, ncol, &acc);
+    FandV_parallelFor(FandV_OP_MUL, p, 0, acc.size(), TmatmulEngine, rows);
+  }
+
+  res.nrow = ncol;
+  res.ncol = y.ncol;
+  res.mat.assign(acc.begin(), acc.end());
+  return(res);
+}
+
+void FandV_ct_mmat::show() const {
+  Rcout << "Memory mapped matrix of " << nrow << " x " << ncol << " Fan and Vercauteren cipher texts\n";
+  Rcout << "File: " << file << "\n";
+}
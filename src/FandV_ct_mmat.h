@@ -0,0 +1,97 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_ct_mmat_H
+#define FandV_ct_mmat_H
+
+#include <vector>
+#include <memory>
+#include <string>
+
+#include "FandV_par.h"
+
+class FandV_ct;
+class FandV_ct_vec;
+class FandV_ct_mat;
+class FandV_rlk_locker;
+class FandV_mmap;
+
+// Matrix of cipher texts held on disk rather than in RAM.  The file is a text
+// header (parameters, relin key, dimensions) followed by a page aligned region
+// of fixed size binary records, one per cipher text in column major order, which
+// is memory mapped.  Operations stream through the records a tile at a time.
+class FandV_ct_mmat {
+  public:
+    // Constructors
+    FandV_ct_mmat();
+    FandV_ct_mmat(const FandV_ct_mat& ct_mat, std::string file_); // Write ct_mat to file_ and map it
+    FandV_ct_mmat(std::string file_, FandV_rlk_locker* rlkl_); // Map an existing file
+    FandV_ct_mmat(const FandV_ct_mmat& ct_mmat);
+    ~FandV_ct_mmat();
+
+    // Operators
+    FandV_ct_mmat& operator=(FandV_ct_mmat ct_mmat);
+    void swap(FandV_ct_mmat& a, FandV_ct_mmat& b);
+
+    // Access ...
+    int size() const;
+    FandV_ct get(int i) const; // Specify vector-like the element counting columnwise
+    void setelt(int i, const FandV_ct& ct);
+    FandV_ct_mat load() const; // Read the whole matrix into RAM
+    FandV_ct_mat subset(IntegerVector i, int nrow_, int ncol_) const;
+    FandV_ct_vec subsetV(IntegerVector i) const;
+    void setTile(double bytes); // RAM budget for each streamed tile
+
+    // R level ops ... element-wise results are written to another mapped file,
+    // which is deleted along with the result
+    FandV_ct_mmat add(const FandV_ct_mmat& x, std::string file_) const;
+    FandV_ct_mmat mul(const FandV_ct_mmat& x, std::string file_) const;
+    FandV_ct_mmat addct(const FandV_ct& ct, std::string file_) const;
+    FandV_ct_mmat mulct(const FandV_ct& ct, std::string file_) const;
+    FandV_ct_vec colSumsParallel() const;
+    FandV_ct_mat TmatmulParallel(const FandV_ct_mat& y) const; // t(this) %*% y
+
+    // Print out
+    void show() const;
+
+    // Record I/O (thread safe for distinct i)
+    void readRecord(std::size_t i, FandV_ct& ct) const;
+    void writeRecord(std::size_t i, const FandV_ct& ct);
+    void prefetch(std::size_t from, std::size_t to) const;
+    void release(std::size_t from, std::size_t to) const;
+    std::size_t tileRecords() const;
+
+    // For performance keep public
+    int nrow;
+    int ncol;
+    std::string file;
+    FandV_par p;
+    FandV_rlk_locker* rlkl;
+    size_t rlki;
+
+  private:
+    FandV_ct_mmat(const FandV_par& p_, FandV_rlk_locker* rlkl_, size_t rlki_, int nrow_, int ncol_, std::string file_); // Create empty file
+    void create();
+    void open();
+    void setTemporary(); // Delete the file once the last copy goes
+
+    std::size_t recsz; // Bytes per cipher text record
+    std::size_t coefsz; // Bytes per coefficient
+    std::size_t offset; // Start of records in the file
+    std::size_t tilebytes;
+    std::shared_ptr<FandV_mmap> map; // Shared between copies
+};
+
+// Fixed size binary records of a single cipher text, shared with the other
+// binary file formats.  ct must already carry the parameters when unpacking.
+std::size_t FandV_ct_coefsz(const FandV_par& p); // Bytes per coefficient
+std::size_t FandV_ct_recsz(const FandV_par& p); // Bytes per record
+void FandV_ct_pack(const FandV_ct& ct, unsigned char* rec);
+void FandV_ct_unpack(const unsigned char* rec, FandV_ct& ct);
+
+// Delete the files of element-wise results still alive, at exit
+void FandV_mmat_cleanup();
+
+#endif
@@ -0,0 +1,498 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include <iostream>
+#include "getline.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_set>
+
+#include "FandV_ct.h"
+#include "FandV_ct_vec.h"
+#include "FandV_ct_mat.h"
+#include "FandV_ct_mmat.h"
+#include "FandV_ct_smat.h"
+#include "FandV_sched.h"
+#include "FandV.h"
+
+// Records are packed and unpacked this many at a time when saving and loading
+#define FandV_SMAT_BLOCK 4096
+
+// Construct
+FandV_ct_smat::FandV_ct_smat() : nrow(0), ncol(0), rowptr(1, 0), rlkl(NULL), rlki(0) { }
+FandV_ct_smat::FandV_ct_smat(const FandV_ct_vec& x, IntegerVector i, IntegerVector j, int nrow_, int ncol_) : nrow(nrow_), ncol(ncol_), rowptr(nrow_+1, 0), rlkl(NULL), rlki(0) {
+  if(x.vec.size() == 0 || i.size() != (int) x.vec.size() || j.size() != (int) x.vec.size()) {
+    Rcout << "Error: need one row and column index per cipher text\n";
+    nrow = ncol = 0;
+    rowptr.assign(1, 0);
+    return;
+  }
+  for(int k=0; k<i.size(); k++) {
+    if(i[k] < 0 || i[k] >= nrow || j[k] < 0 || j[k] >= ncol) {
+      Rcout << "Error: sparse matrix index out of range\n";
+      nrow = ncol = 0;
+      rowptr.assign(1, 0);
+      return;
+    }
+  }
+  p = x.vec[0]->p;
+  rlkl = x.vec[0]->rlkl;
+  rlki = x.vec[0]->rlki;
+
+  // Bucket the triplets by row, then order each row by column
+  for(int k=0; k<i.size(); k++) {
+    rowptr[i[k]+1]++;
+  }
+  for(int r=0; r<nrow; r++) {
+    rowptr[r+1] += rowptr[r];
+  }
+  std::vector<int> next(rowptr.begin(), rowptr.end()-1), order(i.size());
+  for(int k=0; k<i.size(); k++) {
+    order[next[i[k]]++] = k;
+  }
+
+  // Duplicated cells are summed
+  std::vector<int> start(rowptr);
+  colidx.reserve(i.size());
+  val.reserve(i.size());
+  for(int r=0; r<nrow; r++) {
+    std::stable_sort(order.begin()+start[r], order.begin()+start[r+1], [&j](int a, int b) { return(j[a] < j[b]); });
+    rowptr[r] = colidx.size();
+    for(int e=start[r]; e<start[r+1]; e++) {
+      int k = order[e];
+      if(e > start[r] && j[k] == colidx.back()) {
+        std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(*val.back());
+        sum->addEq(*x.vec[k]);
+        val.back() = sum;
+        continue;
+      }
+      colidx.push_back(j[k]);
+      val.push_back(x.vec[k]);
+    }
+  }
+  rowptr[nrow] = colidx.size();
+}
+
+// Copy constructor
+FandV_ct_smat::FandV_ct_smat(const FandV_ct_smat& ct_smat) : nrow(ct_smat.nrow), ncol(ct_smat.ncol), rowptr(ct_smat.rowptr), colidx(ct_smat.colidx), val(ct_smat.val), p(ct_smat.p), rlkl(ct_smat.rlkl), rlki(ct_smat.rlki) { }
+
+// Assignment (copy-and-swap idiom)
+void FandV_ct_smat::swap(FandV_ct_smat& a, FandV_ct_smat& b) {
+  std::swap(a.nrow, b.nrow);
+  std::swap(a.ncol, b.ncol);
+  std::swap(a.rowptr, b.rowptr);
+  std::swap(a.colidx, b.colidx);
+  std::swap(a.val, b.val);
+  a.p.swap(a.p, b.p);
+  std::swap(a.rlkl, b.rlkl);
+  std::swap(a.rlki, b.rlki);
+}
+FandV_ct_smat& FandV_ct_smat::operator=(FandV_ct_smat ct_smat) {
+  swap(*this, ct_smat);
+  return(*this);
+}
+
+// Destructor
+FandV_ct_smat::~FandV_ct_smat() { }
+
+// Access ...
+double FandV_ct_smat::size() const {
+  return((double) nrow*ncol);
+}
+int FandV_ct_smat::nnz() const {
+  return(val.size());
+}
+IntegerVector FandV_ct_smat::rows() const {
+  IntegerVector res(val.size());
+  for(int r=0; r<nrow; r++) {
+    for(int e=rowptr[r]; e<rowptr[r+1]; e++) {
+      res[e] = r+1;
+    }
+  }
+  return(res);
+}
+IntegerVector FandV_ct_smat::cols() const {
+  IntegerVector res(val.size());
+  for(unsigned int e=0; e<colidx.size(); e++) {
+    res[e] = colidx[e]+1;
+  }
+  return(res);
+}
+FandV_ct_vec FandV_ct_smat::values() const {
+  return(FandV_ct_vec(val));
+}
+FandV_ct_ptr FandV_ct_smat::zero() const {
+  return(std::make_shared<const FandV_ct>(p, rlkl, rlki));
+}
+FandV_ct_mat FandV_ct_smat::dense() const {
+  FandV_ct_mat res;
+  if(size() == 0)
+    return(res);
+  res = FandV_ct_mat(std::vector<FandV_ct_ptr>((std::size_t) nrow*ncol, zero()), nrow, ncol);
+  for(int r=0; r<nrow; r++) {
+    for(int e=rowptr[r]; e<rowptr[r+1]; e++) {
+      res.mat[r + (std::size_t) colidx[e]*nrow] = val[e];
+    }
+  }
+  return(res);
+}
+
+// Transposing swaps rows for columns, which is a counting sort of the stored
+// cells by column; the cipher texts themselves are shared, not copied
+FandV_ct_smat FandV_ct_smat::t() const {
+  FandV_ct_smat res(*this);
+  res.nrow = ncol;
+  res.ncol = nrow;
+  res.rowptr.assign(ncol+1, 0);
+  for(unsigned int e=0; e<colidx.size(); e++) {
+    res.rowptr[colidx[e]+1]++;
+  }
+  for(int c=0; c<ncol; c++) {
+    res.rowptr[c+1] += res.rowptr[c];
+  }
+  std::vector<int> next(res.rowptr.begin(), res.rowptr.end()-1);
+  for(int r=0; r<nrow; r++) {
+    for(int e=rowptr[r]; e<rowptr[r+1]; e++) {
+      int to = next[colidx[e]]++;
+      res.colidx[to] = r;
+      res.val[to] = val[e];
+    }
+  }
+  return(res);
+}
+
+// Products this %*% Y, for Y a dense cipher text matrix (or vector) or plaintext
+// integer matrix with ycol columns, column major.  Output cell (i,c) is the sum
+// over the stored cells (i,k) of row i of x(i,k)*Y(k,c), so structural zeros do
+// no work.  Cipher text products are summed as unrelinearised tensors and each
+// output relinearised once; plaintext terms are scalar multiply-adds with zero
+// weights skipped.  Cells with no terms share zero.
+struct FandV_SmatMul : public Worker {
+  // Input sparse matrix and y or w
+  const FandV_ct_smat* x;
+  const std::vector<FandV_ct_ptr>* y;
+  const std::vector<fmpzxx>* w;
+  const FandV_ct_ptr zero;
+
+  // Output vector of cipher texts, column major
+  std::vector<FandV_ct_ptr>* res;
+
+  // Constructor
+  FandV_SmatMul(const FandV_ct_smat* x_, const std::vector<FandV_ct_ptr>* y_, const std::vector<fmpzxx>* w_, std::vector<FandV_ct_ptr>* res_, const FandV_ct_ptr zero_) : zero(zero_) { x=x_; y=y_; w=w_; res=res_; }
+
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    fmpz_polyxx d0, d1, d2;
+    for(std::size_t t = begin; t < end; t++) {
+      unsigned int i = t % x->nrow;
+      std::size_t yoff = (t / x->nrow) * x->ncol;
+      FandV_tensor_acc acc;
+      for(int e = x->rowptr[i]; e < x->rowptr[i+1]; e++) {
+        const FandV_ct& a = *x->val[e];
+        std::size_t k = yoff + x->colidx[e];
+        if(w) {
+          if(w->at(k) != 0)
+            acc.addmul(a, w->at(k));
+          continue;
+        }
+
+        const FandV_ct& b = *y->at(k);
+        a.tensor(b, d0, d1, d2);
+        acc.add(a, b, d0, d1, d2);
+      }
+
+      std::shared_ptr<FandV_ct> sum = acc.result();
+      if(!sum) {
+        res->at(t) = zero;
+      } else {
+        res->at(t) = sum;
+      }
+    }
+  }
+};
+void FandV_ct_smat::product(const std::vector<FandV_ct_ptr>* y, const std::vector<fmpzxx>* w, int ycol, std::vector<FandV_ct_ptr>& res) const {
+  res.resize((std::size_t) nrow*ycol);
+  if(res.size() == 0)
+    return;
+
+  FandV_SmatMul smatmulEngine(this, y, w, &res, zero());
+  FandV_parallelFor(y ? FandV_OP_MUL : FandV_OP_ADD, p, 0, res.size(), smatmulEngine, std::max((double) val.size()/nrow, 1.0));
+}
+FandV_ct_mat FandV_ct_smat::matmul(const FandV_ct_mat& y) const {
+  FandV_ct_mat res;
+  if(y.nrow != ncol) {
+    Rcout << "Error: non-conformable arguments\n";
+    return(res);
+  }
+  res.nrow = nrow;
+  res.ncol = y.ncol;
+  product(&(y.mat), NULL, y.ncol, res.mat);
+  return(res);
+}
+FandV_ct_vec FandV_ct_smat::matvec(const FandV_ct_vec& y) const {
+  FandV_ct_vec res;
+  if((int) y.vec.size() != ncol) {
+    Rcout << "Error: non-conformable arguments\n";
+    return(res);
+  }
+  product(&(y.vec), NULL, 1, res.vec);
+  return(res);
+}
+FandV_ct_mat FandV_ct_smat::matmulpt(IntegerVector w, int wnrow, int wncol) const {
+  FandV_ct_mat res;
+  if(wnrow != ncol || (double) w.size() != (double) wnrow*wncol) {
+    Rcout << "Error: non-conformable arguments\n";
+    return(res);
+  }
+  std::vector<fmpzxx> wz(w.size());
+  for(int k=0; k<w.size(); k++) {
+    wz[k] = fmpzxx((long) w[k]);
+  }
+  res.nrow = nrow;
+  res.ncol = wncol;
+  product(NULL, &wz, wncol, res.mat);
+  return(res);
+}
+
+struct FandV_SmatRowSums : public Worker {
+  // Input sparse matrix
+  const FandV_ct_smat* x;
+  const FandV_ct_ptr zero;
+
+  // Output vector of cipher texts
+  std::vector<FandV_ct_ptr>* res;
+
+  // Constructor
+  FandV_SmatRowSums(const FandV_ct_smat* x_, std::vector<FandV_ct_ptr>* res_, const FandV_ct_ptr zero_) : zero(zero_) { x=x_; res=res_; }
+
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t row = begin; row < end; row++) {
+      int from = x->rowptr[row], to = x->rowptr[row+1];
+      if(from == to) {
+        res->at(row) = zero;
+        continue;
+      }
+      if(to - from == 1) { // Nothing to add, so share the cell
+        res->at(row) = x->val[from];
+        continue;
+      }
+      std::shared_ptr<FandV_ct> sum = std::make_shared<FandV_ct>(*x->val[from]);
+      for(int e=from+1; e<to; e++) {
+        sum->addEq(*x->val[e]);
+      }
+      res->at(row) = sum;
+    }
+  }
+};
+FandV_ct_vec FandV_ct_smat::rowSums() const {
+  FandV_ct_vec res;
+  res.vec.resize(nrow);
+  if(nrow == 0)
+    return(res);
+
+  FandV_SmatRowSums rowSumsEngine(this, &(res.vec), zero());
+  FandV_parallelFor(FandV_OP_ADD, p, 0, nrow, rowSumsEngine, std::max((double) val.size()/nrow, 1.0));
+  return(res);
+}
+FandV_ct_vec FandV_ct_smat::colSums() const {
+  return(t().rowSums());
+}
+
+// Memory
+double FandV_ct_smat::memoryUsage() const {
+  std::unordered_set<const FandV_ct*> seen;
+  double bytes = sizeof(FandV_ct_smat) + (rowptr.capacity() + colidx.capacity())*sizeof(int) + val.capacity()*sizeof(FandV_ct_ptr);
+  for(unsigned int i=0; i<val.size(); i++) {
+    if(seen.insert(val[i].get()).second)
+      bytes += val[i]->memoryUsage();
+  }
+  return(bytes);
+}
+
+void FandV_ct_smat::show() const {
+  Rcout << "Sparse matrix of " << nrow << " x " << ncol << " Fan and Vercauteren cipher texts (" << val.size() << " stored)\n";
+}
+
+// Save/load.  The text header (parameters, relin key, dimensions) is followed,
+// at the byte offset it records, by rowptr and colidx as int32 and then one
+// fixed size binary record per stored cell, as for memory mapped matrices.
+struct FandV_SmatPack : public Worker {
+  const std::vector<FandV_ct_ptr>* val;
+  const std::size_t from, recsz;
+  unsigned char* buf;
+
+  FandV_SmatPack(const std::vector<FandV_ct_ptr>* val_, unsigned char* buf_, const std::size_t from_, const std::size_t recsz_) : from(from_), recsz(recsz_) { val=val_; buf=buf_; }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      FandV_ct_pack(*val->at(from+i), buf + i*recsz);
+    }
+  }
+};
+struct FandV_SmatUnpack : public Worker {
+  std::vector<FandV_ct_ptr>* val;
+  const std::size_t from, recsz;
+  const unsigned char* buf;
+  const FandV_ct_smat* x;
+
+  FandV_SmatUnpack(std::vector<FandV_ct_ptr>* val_, const unsigned char* buf_, const std::size_t from_, const std::size_t recsz_, const FandV_ct_smat* x_) : from(from_), recsz(recsz_) { val=val_; buf=buf_; x=x_; }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      std::shared_ptr<FandV_ct> ct = std::make_shared<FandV_ct>(x->p, x->rlkl, x->rlki);
+      FandV_ct_unpack(buf + i*recsz, *ct);
+      val->at(from+i) = ct;
+    }
+  }
+};
+
+void FandV_ct_smat::save(const std::string& file) const {
+  if(rlkl == NULL) {
+    Rcout << "Error: cannot save an empty sparse cipher text matrix\n";
+    return;
+  }
+  FILE *fp = fopen(file.c_str(), "wb");
+  if(fp == NULL) {
+    perror("Error");
+    return;
+  }
+  std::size_t recsz = FandV_ct_recsz(p);
+
+  // header
+  fprintf(fp, "=> FHE pkg obj <=\nRcpp_FandV_ct_smat\n");
+  // pars
+  p.save(fp);
+  // rlk
+  rlkl->get(rlki)->save(fp);
+  // dimensions and layout
+  fprintf(fp, "nrow=%d\nncol=%d\nnnz=%d\nrecsz=%lu\n", nrow, ncol, nnz(), (unsigned long) recsz);
+  unsigned long offset = ftell(fp) + 28; // "offset=" + 20 digits + "\n"
+  fprintf(fp, "offset=%020lu\n", offset);
+
+  // indices
+  std::vector<int32_t> idx(rowptr.begin(), rowptr.end());
+  idx.insert(idx.end(), colidx.begin(), colidx.end());
+  fwrite(&idx[0], sizeof(int32_t), idx.size(), fp);
+
+  // records, packed in parallel a block at a time
+  std::vector<unsigned char> buf(std::min(val.size(), (std::size_t) FandV_SMAT_BLOCK)*recsz);
+  for(std::size_t from = 0; from < val.size(); from += FandV_SMAT_BLOCK) {
+    std::size_t n = std::min(val.size() - from, (std::size_t) FandV_SMAT_BLOCK);
+    FandV_SmatPack packEngine(&val, &buf[0], from, recsz);
+    FandV_parallelFor(FandV_OP_IO, p, 0, n, packEngine);
+    if(fwrite(&buf[0], recsz, n, fp) != n) {
+      Rcout << "Error: failed writing sparse ciphertext matrix records\n";
+      break;
+    }
+  }
+  fclose(fp);
+}
+FandV_ct_smat::FandV_ct_smat(const std::string& file, FandV_rlk_locker* rlkl_) : nrow(0), ncol(0), rowptr(1, 0), rlkl(rlkl_), rlki(0) {
+  FILE *fp = fopen(file.c_str(), "rb");
+  if(fp == NULL) {
+    perror("Error");
+    return;
+  }
+
+  // Check for header line
+  char *buf = NULL; size_t bufn = 0;
+  size_t len;
+  len = getline(&buf, &bufn, fp);
+  if(strncmp("=> FHE pkg obj <=\n", buf, len) != 0) {
+    Rcout << "Error: file does not contain an FHE object (SMAT)\n";
+    free(buf);
+    fclose(fp);
+    return;
+  }
+  len = getline(&buf, &bufn, fp);
+  if(strncmp("Rcpp_FandV_ct_smat\n", buf, len) != 0) {
+    Rcout << "Error: file does not contain a sparse ciphertext matrix\n";
+    free(buf);
+    fclose(fp);
+    return;
+  }
+
+  // pars
+  p = FandV_par(fp);
+  len = getline(&buf, &bufn, fp); // Advance past the new line
+  // rlk
+  FandV_rlk rlk(fp);
+  rlki = rlkl->add(rlk);
+  len = getline(&buf, &bufn, fp); // Advance past the new line
+  free(buf);
+  // dimensions and layout
+  int nrow_, ncol_, nnz_;
+  unsigned long recsz, offset;
+  if(fscanf(fp, "nrow=%d\nncol=%d\nnnz=%d\nrecsz=%lu\noffset=%lu", &nrow_, &ncol_, &nnz_, &recsz, &offset) != 5 || recsz != FandV_ct_recsz(p)
+     || nrow_ < 0 || ncol_ < 0 || nnz_ < 0 || (double) nnz_ > (double) nrow_*ncol_) {
+    Rcout << "Error: corrupt sparse ciphertext matrix header\n";
+    fclose(fp);
+    return;
+  }
+  // The file must hold everything the header promises before anything is
+  // allocated for it
+  std::size_t nidx = (std::size_t) nrow_ + 1 + nnz_;
+  fseek(fp, 0, SEEK_END);
+  double fsize = (double) ftell(fp);
+  if((double) offset + (double) nidx*sizeof(int32_t) + (double) nnz_*recsz > fsize) {
+    Rcout << "Error: truncated sparse ciphertext matrix\n";
+    fclose(fp);
+    return;
+  }
+  fseek(fp, offset, SEEK_SET);
+
+  // indices: rowptr from 0 to nnz without decreasing, and columns increasing
+  // within each row
+  std::vector<int32_t> idx(nidx);
+  if(fread(&idx[0], sizeof(int32_t), idx.size(), fp) != idx.size()) {
+    Rcout << "Error: truncated sparse ciphertext matrix\n";
+    fclose(fp);
+    return;
+  }
+  bool ok = idx[0] == 0 && idx[nrow_] == nnz_;
+  for(int i = 0; ok && i < nrow_; i++) {
+    const int32_t *col = &idx[nrow_ + 1];
+    ok = idx[i] <= idx[i+1] && idx[i+1] <= nnz_;
+    for(int32_t e = idx[i]; ok && e < idx[i+1]; e++) {
+      ok = col[e] >= 0 && col[e] < ncol_ && (e == idx[i] || col[e-1] < col[e]);
+    }
+  }
+  if(!ok) {
+    Rcout << "Error: corrupt sparse ciphertext matrix indices\n";
+    fclose(fp);
+    return;
+  }
+  rowptr.assign(idx.begin(), idx.begin() + nrow_ + 1);
+  colidx.assign(idx.begin() + nrow_ + 1, idx.end());
+
+  // records, unpacked in parallel a block at a time
+  val.resize(nnz_);
+  std::vector<unsigned char> rec(std::min(val.size(), (std::size_t) FandV_SMAT_BLOCK)*recsz);
+  for(std::size_t from = 0; from < val.size(); from += FandV_SMAT_BLOCK) {
+    std::size_t n = std::min(val.size() - from, (std::size_t) FandV_SMAT_BLOCK);
+    if(fread(&rec[0], recsz, n, fp) != n) {
+      Rcout << "Error: truncated sparse ciphertext matrix\n";
+      rowptr.assign(1, 0);
+      colidx.clear();
+      val.clear();
+      fclose(fp);
+      return;
+    }
+    FandV_SmatUnpack unpackEngine(&val, &rec[0], from, recsz, this);
+    FandV_parallelFor(FandV_OP_IO, p, 0, n, unpackEngine);
+  }
+  nrow = nrow_;
+  ncol = ncol_;
+  fclose(fp);
+}
@@ -0,0 +1,81 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_ct_smat_H
+#define FandV_ct_smat_H
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <vector>
+#include <string>
+
+#include "FandV_par.h"
+#include "FandV_ct.h"
+
+class FandV_ct_vec;
+class FandV_ct_mat;
+class FandV_rlk_locker;
+
+// Sparse matrix of cipher texts in compressed sparse row form: the entries of
+// row i are val[rowptr[i]] ... val[rowptr[i+1]-1], in columns colidx[...] in
+// increasing order.  Cells not stored are structural zeros, which take no
+// memory and are skipped by every operation; where a result cell has no terms
+// at all it shares a single trivial (noiseless) zero cipher text with the other
+// such cells.
+class FandV_ct_smat {
+  public:
+    // Constructors
+    FandV_ct_smat();
+    FandV_ct_smat(const FandV_ct_vec& x, IntegerVector i, IntegerVector j, int nrow_, int ncol_); // Triplets (0-based), duplicates summed
+    FandV_ct_smat(const FandV_ct_smat& ct_smat);
+    ~FandV_ct_smat();
+
+    // Operators
+    FandV_ct_smat& operator=(FandV_ct_smat ct_smat);
+    void swap(FandV_ct_smat& a, FandV_ct_smat& b);
+
+    // Access ...
+    double size() const; // Cells, stored or not, which can exceed an int
+    int nnz() const;
+    IntegerVector rows() const; // 1-based indices of the stored cells
+    IntegerVector cols() const;
+    FandV_ct_vec values() const;
+    FandV_ct_mat dense() const; // Structural zeros all share one trivial (noiseless) zero cipher text
+    FandV_ct_smat t() const;
+
+    // R level ops
+    FandV_ct_mat matmul(const FandV_ct_mat& y) const; // this %*% y
+    FandV_ct_vec matvec(const FandV_ct_vec& y) const;
+    FandV_ct_mat matmulpt(IntegerVector w, int wnrow, int wncol) const; // this %*% W for a plaintext integer matrix W
+    FandV_ct_vec rowSums() const;
+    FandV_ct_vec colSums() const;
+
+    // Memory
+    double memoryUsage() const; // Bytes, counting each distinct cipher text once
+
+    // Print out
+    void show() const;
+
+    // Save/load, as a text header followed by binary index arrays and records
+    void save(const std::string& file) const;
+    FandV_ct_smat(const std::string& file, FandV_rlk_locker* rlkl_);
+
+    // For performance keep public
+    int nrow;
+    int ncol;
+    std::vector<int> rowptr;
+    std::vector<int> colidx;
+    std::vector<FandV_ct_ptr> val;
+    FandV_par p;
+    FandV_rlk_locker* rlkl;
+    size_t rlki;
+
+  private:
+    FandV_ct_ptr zero() const;
+    void product(const std::vector<FandV_ct_ptr>* y, const std::vector<fmpzxx>* w, int ycol, std::vector<FandV_ct_ptr>& res) const;
+};
+
+#endif
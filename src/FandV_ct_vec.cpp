@@ -12,18 +12,26 @@ using namespace RcppParallel;
 #include <iostream>
 #include "getline.h"
 #include <math.h>
+#include <unordered_set>
 
 #include "FandV_ct.h"
 #include "FandV_ct_vec.h"
+#include "FandV_sched.h"
+#include "FandV_reduce.h"
 #include "FandV.h"
 
+RCPP_EXPOSED_CLASS(FandV_ct_vec)
+
 // Construct from parameters
 FandV_ct_vec::FandV_ct_vec() { }
-FandV_ct_vec::FandV_ct_vec(const std::vector<FandV_ct> v) : vec(v) { }
+FandV_ct_vec::FandV_ct_vec(const std::vector<FandV_ct_ptr>& v) : vec(v) { }
 
-// Copy constructor
+// Copy constructor (elements are shared, not duplicated)
 FandV_ct_vec::FandV_ct_vec(const FandV_ct_vec& ct_vec) : vec(ct_vec.vec) { }
 
+// Move constructor
+FandV_ct_vec::FandV_ct_vec(FandV_ct_vec&& ct_vec) : vec(std::move(ct_vec.vec)) { }
+
 // Assignment (copy-and-swap idiom)
 void FandV_ct_vec::swap(FandV_ct_vec& a, FandV_ct_vec& b) {
   std::swap(a.vec, b.vec);
@@ -40,14 +48,14 @@ FandV_ct_vec::~FandV_ct_vec() {
 
 // Manipulate vector
 void FandV_ct_vec::push(const FandV_ct& ct) {
-  vec.push_back(ct);
+  vec.push_back(std::make_shared<const FandV_ct>(ct));
 }
 void FandV_ct_vec::pushvec(const FandV_ct_vec& ct_vec) {
-  for(unsigned int i=0; i<ct_vec.vec.size(); i++)
-    vec.push_back(ct_vec.vec[i]);
+  vec.insert(vec.end(), ct_vec.vec.begin(), ct_vec.vec.end());
 }
 void FandV_ct_vec::set(int i, const FandV_ct& ct_vec) {
-  vec[i] = ct_vec;
+  // Copy-on-write: any other vector sharing the old element keeps it
+  vec[i] = std::make_shared<const FandV_ct>(ct_vec);
 }
 
 // Access vector
@@ -55,194 +63,243 @@ int FandV_ct_vec::size() const {
   return(vec.size());
 }
 FandV_ct FandV_ct_vec::get(int i) const {
-  return(vec[i]);
+  return(*vec[i]);
 }
 FandV_ct_vec FandV_ct_vec::subset(NumericVector i) const {
   FandV_ct_vec res;
+  res.vec.reserve(i.size());
   for(NumericVector::iterator it = i.begin(); it != i.end(); ++it) {
-    res.push(vec[*it]);
+    res.vec.push_back(vec[*it]);
   }
   return(res);
 }
 FandV_ct_vec FandV_ct_vec::without(NumericVector i) const { // NB must be sorted largest to smallest
-  FandV_ct_vec res(vec);
+  std::vector<bool> drop(vec.size(), false);
   for(NumericVector::iterator it = i.begin(); it != i.end(); ++it) {
-    res.vec.erase(res.vec.begin()+*it);
+    drop[*it] = true;
+  }
+  FandV_ct_vec res;
+  res.vec.reserve(vec.size());
+  for(unsigned int j=0; j<vec.size(); j++) {
+    if(!drop[j])
+      res.vec.push_back(vec[j]);
   }
   return(res);
 }
 
-// R level ops
-FandV_ct_vec FandV_ct_vec::add(const FandV_ct_vec& x) const {
-  int sz = vec.size(), xsz = x.vec.size();
+
+// Bulk assembly: result element t is element idx[t] of the source, so only the
+// pointers are copied, in parallel when there are enough of them
+struct FandV_Share : public Worker {
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector<int>* idx;
+  
+  // Output vector of cipher texts
+  std::vector<FandV_ct_ptr>* res;
+  
+  // Constructor
+  FandV_Share(const std::vector<FandV_ct_ptr>* x_, const std::vector<int>* idx_, std::vector<FandV_ct_ptr>* res_) { x=x_; idx=idx_; res=res_; }
   
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t t = begin; t < end; t++) {
+      res->at(t) = x->at(idx->at(t));
+    }
+  }
+};
+FandV_ct_vec FandV_ct_vec::rep(IntegerVector times, int each, int lengthOut) const {
   FandV_ct_vec res;
-  if(sz>=xsz) {
-    res.vec = vec;
-    for(int i=0; i<sz; i++) {
-      res.vec[i].addEq(x.vec[i%xsz]);
+  std::size_t n = vec.size()*std::max(each, 0);
+  
+  // Work out the source of each element as R does: each first, then times
+  // (one count, or one per element) unless lengthOut is given
+  std::vector<int> idx;
+  if(lengthOut >= 0) {
+    idx.resize(n > 0 ? lengthOut : 0);
+    for(std::size_t t=0; t<idx.size(); t++) {
+      idx[t] = (t % n)/each;
     }
-  } else {
-    res.vec = x.vec;
-    for(int i=0; i<xsz; i++) {
-      res.vec[i].addEq(vec[i%sz]);
+  } else if(times.size() == 1) {
+    idx.reserve(n*std::max((int) times[0], 0));
+    for(int r=0; r<(int) times[0]; r++) {
+      for(std::size_t k=0; k<n; k++) {
+        idx.push_back(k/each);
+      }
+    }
+  } else if((std::size_t) times.size() == n) {
+    for(std::size_t k=0; k<n; k++) {
+      idx.insert(idx.end(), std::max((int) times[k], 0), k/each);
     }
+  } else {
+    Rcout << "Error: invalid 'times' argument\n";
+    return(res);
+  }
+  
+  res.vec.resize(idx.size());
+  if(idx.size() == 0)
+    return(res);
+  FandV_Share shareEngine(&vec, &idx, &(res.vec));
+  FandV_parallelFor(FandV_OP_PTR, vec[0]->p, 0, idx.size(), shareEngine);
+  return(res);
+}
+FandV_ct_vec FandV_ct_vec::cat(List y) const {
+  std::vector<FandV_ct_vec> parts;
+  parts.reserve(y.size());
+  std::size_t n = vec.size();
+  for(int k=0; k<y.size(); k++) {
+    parts.push_back(as<FandV_ct_vec>(y[k]));
+    n += parts.back().vec.size();
+  }
+  
+  FandV_ct_vec res;
+  res.vec.reserve(n);
+  res.vec.insert(res.vec.end(), vec.begin(), vec.end());
+  for(unsigned int k=0; k<parts.size(); k++) {
+    res.vec.insert(res.vec.end(), parts[k].vec.begin(), parts[k].vec.end());
   }
   return(res);
 }
-FandV_ct_vec FandV_ct_vec::sub(const FandV_ct_vec& x) const {
+
+// R level ops
+FandV_ct_vec FandV_ct_vec::add(const FandV_ct_vec& x) const {
+  FandV_ct_vec res;
+  addTo(x, res);
+  return(res);
+}
+void FandV_ct_vec::addTo(const FandV_ct_vec& x, FandV_ct_vec& res) const {
   int sz = vec.size(), xsz = x.vec.size();
+  int n = std::max(sz, xsz);
   
-  FandV_ct_vec res;
-  if(sz>=xsz) {
-    res.vec = vec;
-    for(int i=0; i<sz; i++) {
-      res.vec[i] = vec[i].sub(x.vec[i%xsz]);
-    }
-  } else {
-    res.vec = x.vec;
-    for(int i=0; i<xsz; i++) {
-      res.vec[i] = vec[i%sz].sub(x.vec[i]);
-    }
+  res.vec.resize(n);
+  for(int i=0; i<n; i++) {
+    res.vec[i] = std::make_shared<const FandV_ct>(vec[i%sz]->add(*x.vec[i%xsz]));
   }
+}
+FandV_ct_vec FandV_ct_vec::sub(const FandV_ct_vec& x) const {
+  FandV_ct_vec res;
+  subTo(x, res);
   return(res);
 }
+void FandV_ct_vec::subTo(const FandV_ct_vec& x, FandV_ct_vec& res) const {
+  int sz = vec.size(), xsz = x.vec.size();
+  int n = std::max(sz, xsz);
+  
+  res.vec.resize(n);
+  for(int i=0; i<n; i++) {
+    res.vec[i] = std::make_shared<const FandV_ct>(vec[i%sz]->sub(*x.vec[i%xsz]));
+  }
+}
 struct FandV_Mul : public Worker {   
   // Source vectors
-  const std::vector<FandV_ct>* ctvec;
-  const std::vector<FandV_ct>* ctvecX;
+  const std::vector<FandV_ct_ptr>* ctvec;
+  const std::vector<FandV_ct_ptr>* ctvecX;
   const int sz, xsz;
   
   // Destination vector
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructors
-  FandV_Mul(std::vector<FandV_ct>* res_, const std::vector<FandV_ct>* ctvec_, const std::vector<FandV_ct>* ctvecX_, int sz_, int xsz_) : sz(sz_), xsz(xsz_) { res = res_; ctvec = ctvec_; ctvecX = ctvecX_; }
+  FandV_Mul(std::vector<FandV_ct_ptr>* res_, const std::vector<FandV_ct_ptr>* ctvec_, const std::vector<FandV_ct_ptr>* ctvecX_, int sz_, int xsz_) : sz(sz_), xsz(xsz_) { res = res_; ctvec = ctvec_; ctvecX = ctvecX_; }
   
   // Element wise multiply
   void operator()(std::size_t begin, std::size_t end) {
     for(; begin<end; begin++) {
-      if(sz>=xsz)
-        res->at(begin) = ctvec->at(begin).mul(ctvecX->at(begin%xsz));
-      else
-        res->at(begin) = ctvecX->at(begin).mul(ctvec->at(begin%sz));
+      res->at(begin) = std::make_shared<const FandV_ct>(ctvec->at(begin%sz)->mul(*ctvecX->at(begin%xsz)));
     }
   }
 };
 FandV_ct_vec FandV_ct_vec::mulParallel(const FandV_ct_vec& x) const {
+  FandV_ct_vec res;
+  mulTo(x, res);
+  return(res);
+}
+void FandV_ct_vec::mulTo(const FandV_ct_vec& x, FandV_ct_vec& res) const {
   int sz = vec.size(), xsz = x.vec.size();
   
-  FandV_ct_vec res;
-  if(sz>=xsz) {
-    res.vec = vec;
-  } else {
-    res.vec = x.vec;
-  }
+  res.vec.resize(std::max(sz, xsz));
   FandV_Mul mul(&(res.vec), &vec, &(x.vec), sz, xsz);
-  parallelFor(0, res.vec.size(), mul);
-  return(res);
+  FandV_parallelFor(FandV_OP_MUL, vec[0]->p, 0, res.vec.size(), mul);
 }
 FandV_ct_vec FandV_ct_vec::mulSerial(const FandV_ct_vec& x) const {
   int sz = vec.size(), xsz = x.vec.size();
+  int n = std::max(sz, xsz);
   
   FandV_ct_vec res;
-  if(sz>=xsz) {
-    res.vec = vec;
-    for(int i=0; i<sz; i++) {
-      res.vec[i] = vec[i].mul(x.vec[i%xsz]);
-    }
-  } else {
-    res.vec = x.vec;
-    for(int i=0; i<xsz; i++) {
-      res.vec[i] = x.vec[i].mul(vec[i%sz]);
-    }
+  res.vec.resize(n);
+  for(int i=0; i<n; i++) {
+    res.vec[i] = std::make_shared<const FandV_ct>(vec[i%sz]->mul(*x.vec[i%xsz]));
   }
   return(res);
 }
 FandV_ct_vec FandV_ct_vec::addct(const FandV_ct& ct) const {
-  FandV_ct_vec res(vec);
+  FandV_ct_vec res;
+  res.vec.resize(vec.size());
   for(unsigned int i=0; i<vec.size(); i++) {
-    res.vec[i].addEq(ct);
+    res.vec[i] = std::make_shared<const FandV_ct>(vec[i]->add(ct));
   }
   return(res);
 }
 FandV_ct_vec FandV_ct_vec::subct(const FandV_ct& ct, const int rev) const {
-  FandV_ct_vec res(vec);
+  FandV_ct_vec res;
+  res.vec.resize(vec.size());
   for(unsigned int i=0; i<vec.size(); i++) {
     if(rev==0) {
-      res.vec[i] = vec[i].sub(ct);
+      res.vec[i] = std::make_shared<const FandV_ct>(vec[i]->sub(ct));
     } else {
-      res.vec[i] = ct.sub(vec[i]);
+      res.vec[i] = std::make_shared<const FandV_ct>(ct.sub(*vec[i]));
     }
   }
   return(res);
 }
 struct FandV_MulCT : public Worker {   
   // Source vector
-  const std::vector<FandV_ct>* ctvec;
+  const std::vector<FandV_ct_ptr>* ctvec;
   
   // Constant multiplier
   const FandV_ct* ct;
   
   // Destination vector
-  std::vector<FandV_ct>* res;
+  std::vector<FandV_ct_ptr>* res;
   
   // Constructors
-  FandV_MulCT(std::vector<FandV_ct>* res_, const std::vector<FandV_ct>* ctvec_, const FandV_ct* ct_)  { res = res_; ctvec = ctvec_; ct = ct_; }
+  FandV_MulCT(std::vector<FandV_ct_ptr>* res_, const std::vector<FandV_ct_ptr>* ctvec_, const FandV_ct* ct_)  { res = res_; ctvec = ctvec_; ct = ct_; }
   
   // Accumulate
   void operator()(std::size_t begin, std::size_t end) {
     for(; begin<end; begin++) {
-      res->at(begin) = ctvec->at(begin).mul(*ct);
+      res->at(begin) = std::make_shared<const FandV_ct>(ctvec->at(begin)->mul(*ct));
     }
   }
 };
 FandV_ct_vec FandV_ct_vec::mulctParallel(const FandV_ct& ct) const {
-  FandV_ct_vec res(vec);
-  FandV_MulCT mulct(&(res.vec), &vec, &ct);
-  parallelFor(0, vec.size(), mulct);
+  FandV_ct_vec res;
+  mulctTo(ct, res);
   return(res);
 }
+void FandV_ct_vec::mulctTo(const FandV_ct& ct, FandV_ct_vec& res) const {
+  res.vec.resize(vec.size());
+  FandV_MulCT mulct(&(res.vec), &vec, &ct);
+  FandV_parallelFor(FandV_OP_MUL, ct.p, 0, vec.size(), mulct);
+}
 FandV_ct_vec FandV_ct_vec::mulctSerial(const FandV_ct& ct) const {
-  FandV_ct_vec res(vec);
+  FandV_ct_vec res;
+  res.vec.resize(vec.size());
   for(unsigned int i=0; i<vec.size(); i++) {
-    res.vec[i] = vec[i].mul(ct);
+    res.vec[i] = std::make_shared<const FandV_ct>(vec[i]->mul(ct));
   }
   return(res);
 }
 
-struct FandV_Sum : public Worker {   
-  // Source vector
-  const std::vector<FandV_ct>* input;
-  
-  // Accumulated value
-  FandV_ct value;
-  
-  // Constructors
-  FandV_Sum(const std::vector<FandV_ct>* input_) : value(input_->at(0).sub(input_->at(0))) { input = input_; }
-  FandV_Sum(const FandV_Sum& sum, Split) : value(sum.input->at(0).sub(sum.input->at(0))) { input = sum.input; }
-  
-  // Accumulate
-  void operator()(std::size_t begin, std::size_t end) {
-    for(; begin<end; begin++) {
-      value.addEq(input->at(begin));
-    }
-  }
-  
-  void join(const FandV_Sum& rhs) {
-    value.addEq(rhs.value);
-  }
-};
 FandV_ct FandV_ct_vec::sumParallel() const {
-  FandV_Sum sum(&vec);
-  parallelReduce(0, vec.size(), sum);
-  return(sum.value);
+  std::vector< std::shared_ptr<FandV_ct> > sums;
+  FandV_sums(vec, 1, vec.size(), 0, 1, sums);
+  return(std::move(*sums[0]));
 }
 FandV_ct FandV_ct_vec::sumSerial() const {
-  FandV_ct res(vec[0]);
+  FandV_ct res(*vec[0]);
   
   for(unsigned int i=1; i<vec.size(); i++) {
-    res.addEq(vec[i]);
+    res.addEq(*vec[i]);
   }
   
   return(res);
@@ -250,42 +307,42 @@ FandV_ct FandV_ct_vec::sumSerial() const {
 
 struct FandV_Prod : public Worker {   
   // Source vector
-  const std::vector<FandV_ct>* input;
+  const std::vector<FandV_ct_ptr>* input;
   
   // Accumulated value
   bool valueSet;
   FandV_ct value;
   
   // Constructors
-  FandV_Prod(const std::vector<FandV_ct>* input_) : valueSet(false), value(input_->at(0).p, input_->at(0).rlkl, input_->at(0).rlki) { input = input_; }
-  FandV_Prod(const FandV_Prod& prod, Split) : valueSet(false), value(prod.input->at(0).p, prod.input->at(0).rlkl, prod.input->at(0).rlki) { input = prod.input; }
+  FandV_Prod(const std::vector<FandV_ct_ptr>* input_) : valueSet(false), value(input_->at(0)->p, input_->at(0)->rlkl, input_->at(0)->rlki) { input = input_; }
+  FandV_Prod(const FandV_Prod& prod, Split) : valueSet(false), value(prod.input->at(0)->p, prod.input->at(0)->rlkl, prod.input->at(0)->rlki) { input = prod.input; }
   
   // Accumulate
   void operator()(std::size_t begin, std::size_t end) {
     for(; begin<end; begin++) {
       if(!valueSet) {
-        value = input->at(begin);
+        value = *input->at(begin);
         valueSet = true;
       } else {
-        value = value.mul(input->at(begin));
+        value.mulEq(*input->at(begin));
       }
     }
   }
   
   void join(const FandV_Prod& rhs) {
-    value = value.mul(rhs.value);
+    value.mulEq(rhs.value);
   }
 };
 FandV_ct FandV_ct_vec::prodParallel() const {
   FandV_Prod prod(&vec);
-  parallelReduce(0, vec.size(), prod);
-  return(prod.value);
+  FandV_parallelReduce(FandV_OP_MUL, vec[0]->p, 0, vec.size(), prod);
+  return(std::move(prod.value));
 }
 FandV_ct FandV_ct_vec::prodSerial() const {
-  FandV_ct res(vec[0]);
+  FandV_ct res(*vec[0]);
   
   for(unsigned int i=1; i<vec.size(); i++) {
-    res = res.mul(vec[i]);
+    res.mulEq(*vec[i]);
   }
   
   return(res);
@@ -293,25 +350,25 @@ FandV_ct FandV_ct_vec::prodSerial() const {
 
 struct FandV_InnerProd : public Worker {   
   // Source vector
-  const std::vector<FandV_ct>* x;
-  const std::vector<FandV_ct>* y;
+  const std::vector<FandV_ct_ptr>* x;
+  const std::vector<FandV_ct_ptr>* y;
   
   // Accumulated value
   bool resSet;
   FandV_ct res;
   
   // Constructors
-  FandV_InnerProd(const std::vector<FandV_ct>* x_, const std::vector<FandV_ct>* y_) : resSet(false), res(x_->at(0).p, x_->at(0).rlkl, x_->at(0).rlki) { x = x_; y = y_; }
-  FandV_InnerProd(const FandV_InnerProd& innerprod, Split) : resSet(false), res(innerprod.x->at(0).p, innerprod.x->at(0).rlkl, innerprod.x->at(0).rlki) { x = innerprod.x; y = innerprod.y; }
+  FandV_InnerProd(const std::vector<FandV_ct_ptr>* x_, const std::vector<FandV_ct_ptr>* y_) : resSet(false), res(x_->at(0)->p, x_->at(0)->rlkl, x_->at(0)->rlki) { x = x_; y = y_; }
+  FandV_InnerProd(const FandV_InnerProd& innerprod, Split) : resSet(false), res(innerprod.x->at(0)->p, innerprod.x->at(0)->rlkl, innerprod.x->at(0)->rlki) { x = innerprod.x; y = innerprod.y; }
   
   // Accumulate
   void operator()(std::size_t begin, std::size_t end) {
     for(; begin<end; begin++) {
       if(!resSet) {
-        res = x->at(begin).mul(y->at(begin));
+        res = x->at(begin)->mul(*y->at(begin));
         resSet = true;
       } else {
-        res.addEq(x->at(begin).mul(y->at(begin)));
+        res.addEq(x->at(begin)->mul(*y->at(begin)));
       }
     }
   }
@@ -322,8 +379,19 @@ struct FandV_InnerProd : public Worker {
 };
 FandV_ct FandV_ct_vec::innerprod(const FandV_ct_vec& x) const {
   FandV_InnerProd innerprod(&vec, &(x.vec));
-  parallelReduce(0, vec.size(), innerprod);
-  return(innerprod.res);
+  FandV_parallelReduce(FandV_OP_MUL, vec[0]->p, 0, vec.size(), innerprod);
+  return(std::move(innerprod.res));
+}
+
+// Memory
+double FandV_ct_vec::memoryUsage() const {
+  std::unordered_set<const FandV_ct*> seen;
+  double bytes = sizeof(FandV_ct_vec) + vec.capacity()*sizeof(FandV_ct_ptr);
+  for(unsigned int i=0; i<vec.size(); i++) {
+    if(seen.insert(vec[i].get()).second)
+      bytes += vec[i]->memoryUsage();
+  }
+  return(bytes);
 }
 
 void FandV_ct_vec::show() const {
@@ -334,7 +402,7 @@ void FandV_ct_vec::show() const {
 void FandV_ct_vec::save(FILE* fp) const {
   fprintf(fp, "=> FHE package object <=\nRcpp_FandV_ct_vec\nn=%d\n", (int) vec.size());
   for(unsigned int i=0; i<vec.size(); i++) {
-    vec[i].save(fp);
+    vec[i]->save(fp);
   }
 }
 FandV_ct_vec::FandV_ct_vec(FILE* fp, const FandV_par& p, FandV_rlk_locker* rlkl, size_t rlki) {
@@ -356,9 +424,9 @@ FandV_ct_vec::FandV_ct_vec(FILE* fp, const FandV_par& p, FandV_rlk_locker* rlkl,
   
   int vecsz;
   len = fscanf(fp, "n=%d\n", &vecsz);
+  vec.reserve(vecsz);
   for(int i=0; i<vecsz; i++) {
-    FandV_ct ct(fp, p, rlkl, rlki);
-    vec.push_back(ct);
+    vec.push_back(std::make_shared<const FandV_ct>(fp, p, rlkl, rlki));
   }
   free(buf);
 }
@@ -12,8 +12,9 @@ class FandV_ct_vec {
   public:
     // Constructors
     FandV_ct_vec();
-    FandV_ct_vec(const std::vector<FandV_ct> v);
+    FandV_ct_vec(const std::vector<FandV_ct_ptr>& v);
     FandV_ct_vec(const FandV_ct_vec& ct_vec);
+    FandV_ct_vec(FandV_ct_vec&& ct_vec);
     ~FandV_ct_vec();
     
     // Operators
@@ -30,6 +31,8 @@ class FandV_ct_vec {
     FandV_ct get(int i) const;
     FandV_ct_vec subset(NumericVector i) const;
     FandV_ct_vec without(NumericVector i) const; // NB must be sorted largest to smallest
+    FandV_ct_vec rep(IntegerVector times, int each, int lengthOut) const; // As R's rep(), elements shared (lengthOut < 0 for none)
+    FandV_ct_vec cat(List y) const; // c(this, y[[1]], y[[2]], ...) for vectors y[[k]]
     
     // R level ops
     FandV_ct_vec add(const FandV_ct_vec& x) const;
@@ -45,6 +48,14 @@ class FandV_ct_vec {
     FandV_ct prodParallel() const;
     FandV_ct prodSerial() const;
     FandV_ct innerprod(const FandV_ct_vec& x) const;
+    // ... output parameter versions, reusing the storage of res
+    void addTo(const FandV_ct_vec& x, FandV_ct_vec& res) const;
+    void subTo(const FandV_ct_vec& x, FandV_ct_vec& res) const;
+    void mulTo(const FandV_ct_vec& x, FandV_ct_vec& res) const;
+    void mulctTo(const FandV_ct& ct, FandV_ct_vec& res) const;
+    
+    // Memory
+    double memoryUsage() const; // Bytes, counting each distinct cipher text once
     
     // Print out
     void show() const;
@@ -54,7 +65,7 @@ class FandV_ct_vec {
     FandV_ct_vec(FILE* fp, const FandV_par& p, FandV_rlk_locker* rlkl, size_t rlki);
     
     // For performance keep public
-    std::vector<FandV_ct> vec;
+    std::vector<FandV_ct_ptr> vec;
 };
 
 #endif
@@ -0,0 +1,259 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include <stdio.h>
+#include <string.h>
+#include "getline.h"
+
+#include "FandV_keyring.h"
+#include "FandV_sched.h"
+
+// Keys are wrapped into lists here, not only in the module file
+RCPP_EXPOSED_CLASS(FandV_pk)
+RCPP_EXPOSED_CLASS(FandV_sk)
+RCPP_EXPOSED_CLASS(FandV_rlk)
+
+//// Tenant key registry ////
+FandV_keyring::FandV_keyring(std::string dir_, FandV_rlk_locker* rlkl_, int maxRlk) : dir(dir_), rlkl(rlkl_), clock(0) {
+  group = rlkl->addGroup(maxRlk);
+}
+
+std::string FandV_keyring::file(const std::string& id) const {
+  return(dir + "/" + id + ".keys");
+}
+
+// Tenant IDs become file names, so must not be able to leave the directory
+bool FandV_keyring::valid(const std::string& id) const {
+  if(id.empty() || id[0] == '.' || id.find_first_of("/\\") != std::string::npos) {
+    Rcout << "Error: invalid tenant ID '" << id << "'\n";
+    return(false);
+  }
+  return(true);
+}
+
+// Move past a saved relinearisation key without reading it: two header lines,
+// then one line per polynomial
+static bool FandV_rlk_skip(FILE* fp) {
+  char *buf = NULL; size_t bufn = 0;
+  size_t len;
+  len = getline(&buf, &bufn, fp);
+  bool ok = strncmp("=> FHE pkg obj <=\n", buf, len) == 0;
+  len = getline(&buf, &bufn, fp);
+  ok = ok && strncmp("Rcpp_FandV_rlk\n", buf, len) == 0;
+  for(int k=0; ok && k<4; k++) {
+    ok = getline(&buf, &bufn, fp) != (size_t) -1;
+  }
+  free(buf);
+  return(ok);
+}
+
+void FandV_keyring::put(std::string id, const FandV_pk& pk, const FandV_sk& sk, const FandV_rlk& rlk) {
+  if(!valid(id))
+    return;
+  
+  // Cipher texts under a replaced key still need it, but can no longer reread
+  // it from the file
+  std::map<std::string, int>::iterator sl = slots.find(id);
+  if(sl != slots.end())
+    rlkl->pin(sl->second);
+  
+  FILE *fp = fopen(file(id).c_str(), "w");
+  if(fp == NULL) {
+    perror("Error");
+    return;
+  }
+  fprintf(fp, "=> FHE pkg obj <=\nFandV_keys\n");
+  pk.p.save(fp);
+  rlk.save(fp);
+  pk.save(fp);
+  sk.save(fp);
+  fclose(fp);
+  
+  FandV_pk pk2(pk);
+  pk2.rlkl = rlkl;
+  pk2.rlki = rlkl->add(rlk);
+  rlkl->setSource(pk2.rlki, file(id), group);
+  slots[id] = pk2.rlki;
+  std::shared_ptr<tenant> t = std::make_shared<tenant>(pk2, sk);
+  t->used = ++clock;
+  loaded[id] = t;
+  known.insert(id);
+  trim();
+}
+
+List FandV_keyring::get(std::string id) {
+  List keys;
+  if(!valid(id))
+    return(keys);
+  
+  std::map< std::string, std::shared_ptr<tenant> >::iterator it = loaded.find(id);
+  if(it == loaded.end()) {
+    FILE *fp = fopen(file(id).c_str(), "r");
+    if(fp == NULL) {
+      Rcout << "Error: no keys for tenant '" << id << "'\n";
+      return(keys);
+    }
+    
+    // Check for header line
+    char *buf = NULL; size_t bufn = 0;
+    size_t len;
+    len = getline(&buf, &bufn, fp);
+    if(strncmp("=> FHE pkg obj <=\n", buf, len) != 0) {
+      Rcout << "Error: file does not contain an FHE object (KEYS)\n";
+      free(buf);
+      fclose(fp);
+      return(keys);
+    }
+    len = getline(&buf, &bufn, fp);
+    if(strncmp("FandV_keys\n", buf, len) != 0) {
+      Rcout << "Error: file does not contain key objects\n";
+      free(buf);
+      fclose(fp);
+      return(keys);
+    }
+    
+    // pars
+    FandV_par p(fp);
+    len = getline(&buf, &bufn, fp); // Advance past the new line
+    // rlk, which the locker may drop and reread from this file later.  Once
+    // the tenant has a slot it is only skipped: the slot rereads it when needed
+    int rlki;
+    std::map<std::string, int>::iterator sl = slots.find(id);
+    if(sl == slots.end()) {
+      FandV_rlk rlk(fp);
+      len = getline(&buf, &bufn, fp); // Advance past the new line
+      rlki = rlkl->add(rlk);
+      rlkl->setSource(rlki, file(id), group);
+      slots[id] = rlki;
+    } else {
+      if(!FandV_rlk_skip(fp)) {
+        Rcout << "Error: file does not contain a relinearisation key\n";
+        free(buf);
+        fclose(fp);
+        return(keys);
+      }
+      rlki = sl->second;
+    }
+    // pk
+    FandV_pk pk(fp, p, rlkl, rlki);
+    len = getline(&buf, &bufn, fp); // Advance past the new line
+    // sk
+    FandV_sk sk(fp, p.Phi.length()-1);
+    
+    fclose(fp);
+    free(buf);
+    it = loaded.insert(std::make_pair(id, std::make_shared<tenant>(pk, sk))).first;
+    known.insert(id);
+  }
+  it->second->used = ++clock;
+  
+  keys["sk"] = it->second->sk;
+  keys["pk"] = it->second->pk;
+  trim();
+  return(keys);
+}
+
+void FandV_keyring::trim() {
+  std::size_t max = rlkl->getGroupMax(group);
+  while(max > 0 && loaded.size() > max) {
+    std::map< std::string, std::shared_ptr<tenant> >::iterator oldest = loaded.begin();
+    for(std::map< std::string, std::shared_ptr<tenant> >::iterator it = loaded.begin(); it != loaded.end(); ++it) {
+      if(it->second->used < oldest->second->used)
+        oldest = it;
+    }
+    loaded.erase(oldest);
+  }
+}
+
+bool FandV_keyring::has(std::string id) const {
+  if(!valid(id))
+    return(false);
+  if(loaded.count(id) > 0)
+    return(true);
+  FILE *fp = fopen(file(id).c_str(), "r");
+  if(fp == NULL)
+    return(false);
+  fclose(fp);
+  return(true);
+}
+
+std::vector<std::string> FandV_keyring::ids() const {
+  std::vector<std::string> res;
+  for(std::set<std::string>::const_iterator it = known.begin(); it != known.end(); ++it) {
+    res.push_back(*it);
+  }
+  return(res);
+}
+
+void FandV_keyring::setMaxRlk(int maxRlk) {
+  rlkl->setGroupMax(group, maxRlk);
+  trim();
+}
+int FandV_keyring::resident() const {
+  return(rlkl->residentIn(group));
+}
+
+void FandV_keyring::show() const {
+  Rcout << "Fan and Vercauteren key ring in " << dir << "\n";
+  int max = rlkl->getGroupMax(group);
+  Rcout << known.size() << " tenants loaded, " << rlkl->residentIn(group) << " relinearisation keys in memory";
+  if(max > 0)
+    Rcout << " (at most " << max << ")";
+  Rcout << "\n";
+}
+
+//// Batched key generation ////
+struct FandV_KeygenBatch : public Worker {
+  const FandV_par* p;
+  unsigned long seed;
+  
+  // Output keys
+  std::vector<FandV_pk>* pk;
+  std::vector<FandV_sk>* sk;
+  std::vector<FandV_rlk>* rlk;
+  
+  // Constructor
+  FandV_KeygenBatch(const FandV_par* p_, unsigned long seed_, std::vector<FandV_pk>* pk_, std::vector<FandV_sk>* sk_, std::vector<FandV_rlk>* rlk_) : p(p_), seed(seed_), pk(pk_), sk(sk_), rlk(rlk_) { }
+  
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      p->keygenseeded((*pk)[i], (*sk)[i], (*rlk)[i], seed, i);
+    }
+  }
+};
+
+List keygen_FandV_batch(const FandV_par& p, FandV_rlk_locker* rlkl, int n) {
+  List res;
+  if(n <= 0)
+    return(res);
+  
+  // Draw the seed here, on the main thread, so the keys follow set.seed()
+  RNGScope scope;
+  unsigned long seed = ((unsigned long) (R::runif(0.0, 4294967296.0)) << 32) ^ (unsigned long) (R::runif(0.0, 4294967296.0));
+  
+  std::vector<FandV_pk> pk(n, FandV_pk(rlkl, 0));
+  std::vector<FandV_sk> sk(n);
+  std::vector<FandV_rlk> rlk(n);
+  FandV_KeygenBatch keygenEngine(&p, seed, &pk, &sk, &rlk);
+  // Key generation is about three polynomial products, as an encryption
+  FandV_parallelFor(FandV_OP_ENC, p, 0, n, keygenEngine, 3.0);
+  
+  // The locker is only added to here, once all the keys exist
+  for(int i=0; i<n; i++) {
+    pk[i].rlki = rlkl->add(rlk[i]);
+    List keys;
+    keys["sk"] = sk[i];
+    keys["pk"] = pk[i];
+    keys["rlk"] = rlk[i];
+    res.push_back(keys);
+  }
+  return(res);
+}
@@ -0,0 +1,71 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_keyring_H
+#define FandV_keyring_H
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+
+#include "FandV_par.h"
+#include "FandV_keys.h"
+
+// Keys for many tenants, each saved as <dir>/<id>.keys in the format written by
+// saveFHE().  A tenant's keys are only read from disk when they are asked for,
+// and their relinearisation key is registered with the locker as evictable in
+// this ring's own group, so that no more than maxRlk of them are held in memory
+// at once and the rest are reread when a multiplication needs them.  With a
+// limit set, only the maxRlk most recently used tenants' public and secret keys
+// are cached either.
+class FandV_keyring {
+  public:
+    // Constructors
+    FandV_keyring(std::string dir_, FandV_rlk_locker* rlkl_, int maxRlk);
+    
+    // Register a tenant's keys, writing them to disk
+    void put(std::string id, const FandV_pk& pk, const FandV_sk& sk, const FandV_rlk& rlk);
+    // A tenant's secret and public keys, read from disk on first use
+    List get(std::string id);
+    bool has(std::string id) const;
+    std::vector<std::string> ids() const; // Tenants read or registered so far
+    
+    // Relinearisation keys held in memory
+    void setMaxRlk(int maxRlk);
+    int resident() const;
+    
+    // Print
+    void show() const;
+    
+  private:
+    struct tenant {
+      tenant(const FandV_pk& pk_, const FandV_sk& sk_) : pk(pk_), sk(sk_), used(0) { }
+      FandV_pk pk;
+      FandV_sk sk;
+      unsigned long used;
+    };
+    std::string file(const std::string& id) const;
+    bool valid(const std::string& id) const;
+    void trim(); // Drop least recently used tenants beyond the limit
+    
+    std::string dir;
+    FandV_rlk_locker* rlkl;
+    int group; // This ring's group in the locker
+    unsigned long clock;
+    std::map< std::string, std::shared_ptr<tenant> > loaded;
+    std::map<std::string, int> slots; // Each tenant's relinearisation key in the locker
+    std::set<std::string> known;
+};
+
+// Generate n independent key sets in parallel from native generators seeded
+// from R's, as a list of lists of sk, pk and rlk
+List keygen_FandV_batch(const FandV_par& p, FandV_rlk_locker* rlkl, int n);
+
+#endif
@@ -10,13 +10,25 @@ using namespace Rcpp;
 using namespace RcppParallel;
 
 #include <limits.h>
+#include <random>
 #include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <string.h>
+#if !defined (__WINDOWS__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "getline.h"
 
 #include "FandV_keys.h"
 #include "FandV_ct.h"
 #include "FandV_ct_vec.h"
 #include "FandV_ct_mat.h"
+#include "FandV_pool.h"
+#include "FandV_prof.h"
+#include "FandV_sched.h"
+#include "FandV_ntt.h"
 #include "FandV.h"
 
 #include <flint/fmpz_polyxx.h>
@@ -25,97 +37,231 @@ using namespace flint;
 //// Public keys ////
 FandV_pk::FandV_pk(FandV_rlk_locker* rlkl, size_t rlki) : p(0, 0.0, 0, "1"), rlkl(rlkl), rlki(rlki) { }
 
-FandV_pk::FandV_pk(const FandV_pk& pk) : p(pk.p), rlkl(pk.rlkl), rlki(pk.rlki), p0(pk.p0), p1(pk.p1) { }
+FandV_pk::FandV_pk(const FandV_pk& pk) : p(pk.p), rlkl(pk.rlkl), rlki(pk.rlki), p0(pk.p0), p1(pk.p1), pool(pk.pool), ntt(pk.ntt) { }
+
+// Noise u larger than this (so, never in practice) takes the generic product
+#define FandV_NTT_UBITS 20
+
+// The public key in transform form: p0*u and p1*u are exact, their
+// coefficients being below d*(q/2)*2^FandV_NTT_UBITS
+struct FandV_pk_ntt {
+  FandV_pk_ntt(const FandV_pk& pk) : ntt(pk.p.Phi.length()-1, pk.p.qpow + FLINT_BIT_COUNT(pk.p.Phi.length()-1) + FandV_NTT_UBITS) {
+    ntt.forward(pk.p0, P0);
+    ntt.forward(pk.p1, P1);
+  }
+  
+  FandV_ntt ntt;
+  std::vector<ulong> P0, P1;
+};
+
+void FandV_pk::precompute() {
+  ntt.reset();
+  int d = p.Phi.length()-1;
+  if(d < 2 || (d & (d-1)) != 0)
+    return;
+  ntt = std::make_shared<const FandV_pk_ntt>(*this);
+}
 
 // Encrypt
-void FandV_pk::enc(int m, FandV_ct& ct) const {
+void FandV_pk::enczero(FandV_ct& ct, std::function<long()> rnorm) const {
+  int d = p.Phi.length()-1;
   ct.c0.realloc(p.Phi.length());
   ct.c1.realloc(p.Phi.length());
   
-  fmpz_polyxx u, mP;
-  u.realloc(p.Phi.length());
-  mP.realloc(31);
+  std::vector<long> u(d);
+  long umax = 0;
   
   // Random numbers
-  for(int i=0; i<p.Phi.length()-1; i++) {
-    u.set_coeff(i, (int) lround(R::rnorm(0.0,p.sigma))); // u
-    ct.c0.set_coeff(i, (int) lround(R::rnorm(0.0,p.sigma))); // e1
-    ct.c1.set_coeff(i, (int) lround(R::rnorm(0.0,p.sigma))); // e2
+  for(int i=0; i<d; i++) {
+    u[i] = (int) rnorm(); // u
+    ct.c0.set_coeff(i, (int) rnorm()); // e1
+    ct.c1.set_coeff(i, (int) rnorm()); // e2
+    umax = std::max(umax, std::abs(u[i]));
   }
   
-  // Binary conversion of message
-  int sign = 1;
-  sign = copysign(sign, m);
-  m = abs(m);
-  for(int i=0; i<31; i++) {
-    mP.set_coeff(i, (m&1)*sign);
-    m >>= 1;
+  if(ntt && umax < (1L << FandV_NTT_UBITS)) {
+    // One forward transform of u, then the products are pointwise
+    std::vector<ulong> U, X;
+    fmpz_polyxx pu;
+    ntt->ntt.forward(u.data(), U);
+    ntt->ntt.mul(ntt->P0, U, X);
+    ntt->ntt.inverse(X, pu);
+    ct.c0 = pu + ct.c0;
+    ntt->ntt.mul(ntt->P1, U, X);
+    ntt->ntt.inverse(X, ct.c1);
+  } else {
+    fmpz_polyxx up;
+    up.realloc(p.Phi.length());
+    for(int i=0; i<d; i++) {
+      up.set_coeff(i, u[i]);
+    }
+    ct.c0 = ((p0*up)%p.Phi) + ct.c0;
+    ct.c1 = ((p1*up)%p.Phi);
   }
-  
-  ct.c0 = ((p0*u)%p.Phi) + ct.c0 + p.Delta*mP;
   fmpz_polyxx_q(ct.c0, p.q);
-  
-  ct.c1 = ((p1*u)%p.Phi);
   fmpz_polyxx_q(ct.c1, p.q);
 }
-// TIDY THIS FUNCTION TO BE CALLED BY enc TO REDUCE REDUNDANCY
-void FandV_pk::encbinary(IntegerVector m, FandV_ct& ct) const {
-  ct.c0.realloc(p.Phi.length());
-  ct.c1.realloc(p.Phi.length());
+void FandV_pk::encpoly(const fmpz_polyxx& mP, FandV_ct& ct) const {
+  encpoly(mP, ct, [this]() { return(lround(R::rnorm(0.0,p.sigma))); });
+}
+void FandV_pk::encpoly(const fmpz_polyxx& mP, FandV_ct& ct, std::function<long()> rnorm) const {
+  FHE_PROF(FandV_PROF_ENC);
+  // Only the cheap Delta*m step is left if the pool has an entry ready
+  if(!(pool && pool->pop(ct))) {
+    enczero(ct, rnorm);
+  }
   
-  fmpz_polyxx u, mP;
-  u.realloc(p.Phi.length());
+  ct.c0 = ct.c0 + p.Delta*mP;
+  fmpz_polyxx_q(ct.c0, p.q);
+  FHE_PROF_ALLOC(FandV_PROF_CT, fmpz_polyxx_bytes(ct.c0) + fmpz_polyxx_bytes(ct.c1));
+}
+void FandV_pk::enc(int m, FandV_ct& ct) const {
+  fmpz_polyxx mP;
+  p.encode(fmpzxx(m), mP);
+  encpoly(mP, ct);
+}
+void FandV_pk::encbig(std::string m, FandV_ct& ct) const {
+  fmpz_polyxx mP;
+  p.encode(fmpzxx(m.c_str()), mP);
+  encpoly(mP, ct);
+}
+void FandV_pk::encfrac(double m, FandV_ct& ct) const {
+  fmpz_polyxx mP;
+  p.encodefrac(m, mP);
+  encpoly(mP, ct);
+}
+void FandV_pk::encbinary(IntegerVector m, FandV_ct& ct) const {
+  fmpz_polyxx mP;
   mP.realloc(m.length());
   
-  // Random numbers
-  for(int i=0; i<p.Phi.length()-1; i++) {
-    u.set_coeff(i, (int) lround(R::rnorm(0.0,p.sigma))); // u
-    ct.c0.set_coeff(i, (int) lround(R::rnorm(0.0,p.sigma))); // e1
-    ct.c1.set_coeff(i, (int) lround(R::rnorm(0.0,p.sigma))); // e2
-  }
-  
-  // Binary conversion of message
+  // Message supplied already as polynomial coefficients
   for(int i=0; i<m.length(); i++) {
     mP.set_coeff(i, m[i]);
   }
   
-  ct.c0 = ((p0*u)%p.Phi) + ct.c0 + p.Delta*mP;
-  fmpz_polyxx_q(ct.c0, p.q);
-  
-  ct.c1 = ((p1*u)%p.Phi);
-  fmpz_polyxx_q(ct.c1, p.q);
+  encpoly(mP, ct);
 }
+template <typename VecType>
 struct FandV_EncVec : public Worker {
   // Input values to encrypt & key
-  const IntegerVector* input;
+  const VecType* input;
   const FandV_pk* pk;
   
   // Output vector of cipher texts
-  std::vector<FandV_ct>* output;
+  std::vector<FandV_ct_ptr>* output;
   
   // Constructor
-  FandV_EncVec(const FandV_pk* pk_, const IntegerVector* input_, std::vector<FandV_ct>* output_) { pk=pk_; input=input_; output=output_; }
+  FandV_EncVec(const FandV_pk* pk_, const VecType* input_, std::vector<FandV_ct_ptr>* output_) { pk=pk_; input=input_; output=output_; }
   
   // function call operator that work for the specified range (begin/end)
-  void operator()(std::size_t begin, std::size_t end) {
-    for(std::size_t i = begin; i < end; i++) {
-      pk->enc((*input)[i], output->at(i));
-    }
-  }
+  void operator()(std::size_t begin, std::size_t end);
 };
+template <>
+void FandV_EncVec<IntegerVector>::operator()(std::size_t begin, std::size_t end) {
+  for(std::size_t i = begin; i < end; i++) {
+    std::shared_ptr<FandV_ct> ct = std::make_shared<FandV_ct>(pk->p, pk->rlkl, pk->rlki);
+    pk->enc((*input)[i], *ct);
+    output->at(i) = ct;
+  }
+}
+template <>
+void FandV_EncVec<NumericVector>::operator()(std::size_t begin, std::size_t end) {
+  for(std::size_t i = begin; i < end; i++) {
+    std::shared_ptr<FandV_ct> ct = std::make_shared<FandV_ct>(pk->p, pk->rlkl, pk->rlki);
+    pk->encfrac((*input)[i], *ct);
+    output->at(i) = ct;
+  }
+}
 void FandV_pk::encvec(IntegerVector m, FandV_ct_vec& ctvec) {
-  FandV_ct ct(p, rlkl, rlki);
-  ctvec.vec.resize(m.size(), ct);
-  FandV_EncVec encEngine(this, &m, &(ctvec.vec));
-  parallelFor(0, m.size(), encEngine);
+  ctvec.vec.resize(m.size());
+  FHE_PROF_ALLOC(FandV_PROF_CT_VEC, ctvec.vec.capacity()*sizeof(FandV_ct_ptr));
+  FandV_EncVec<IntegerVector> encEngine(this, &m, &(ctvec.vec));
+  FandV_parallelFor(FandV_OP_ENC, p, 0, m.size(), encEngine);
 }
 void FandV_pk::encmat(IntegerVector m, int nrow, int ncol, FandV_ct_mat& ctmat) {
-  FandV_ct ct(p, rlkl, rlki);
-  ctmat.mat.resize(m.size(), ct);
+  ctmat.mat.resize(m.size());
+  FHE_PROF_ALLOC(FandV_PROF_CT_MAT, ctmat.mat.capacity()*sizeof(FandV_ct_ptr));
   ctmat.nrow = nrow;
   ctmat.ncol = ncol;
-  FandV_EncVec encEngine(this, &m, &(ctmat.mat));
-  parallelFor(0, m.size(), encEngine);
+  FandV_EncVec<IntegerVector> encEngine(this, &m, &(ctmat.mat));
+  FandV_parallelFor(FandV_OP_ENC, p, 0, m.size(), encEngine);
+}
+void FandV_pk::encfracvec(NumericVector m, FandV_ct_vec& ctvec) {
+  ctvec.vec.resize(m.size());
+  FHE_PROF_ALLOC(FandV_PROF_CT_VEC, ctvec.vec.capacity()*sizeof(FandV_ct_ptr));
+  FandV_EncVec<NumericVector> encEngine(this, &m, &(ctvec.vec));
+  FandV_parallelFor(FandV_OP_ENC, p, 0, m.size(), encEngine);
+}
+void FandV_pk::encfracmat(NumericVector m, int nrow, int ncol, FandV_ct_mat& ctmat) {
+  ctmat.mat.resize(m.size());
+  FHE_PROF_ALLOC(FandV_PROF_CT_MAT, ctmat.mat.capacity()*sizeof(FandV_ct_ptr));
+  ctmat.nrow = nrow;
+  ctmat.ncol = ncol;
+  FandV_EncVec<NumericVector> encEngine(this, &m, &(ctmat.mat));
+  FandV_parallelFor(FandV_OP_ENC, p, 0, m.size(), encEngine);
+}
+struct FandV_EncSeeded : public Worker {
+  // Input values to encrypt & key
+  const std::vector<int>* input;
+  const FandV_pk* pk;
+  unsigned long seed;
+  
+  // Output vector of cipher texts
+  std::vector<FandV_ct_ptr>* output;
+  
+  // Constructor
+  FandV_EncSeeded(const FandV_pk* pk_, const std::vector<int>* input_, unsigned long seed_, std::vector<FandV_ct_ptr>* output_) : input(input_), pk(pk_), seed(seed_), output(output_) { }
+  
+  // Each element gets its own generator so the result does not depend on how
+  // the range is split between threads
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      std::seed_seq ss{(unsigned long) seed, (unsigned long) i};
+      std::mt19937_64 rng(ss);
+      std::normal_distribution<double> rnorm(0.0, pk->p.sigma);
+      
+      std::shared_ptr<FandV_ct> ct = std::make_shared<FandV_ct>(pk->p, pk->rlkl, pk->rlki);
+      fmpz_polyxx mP;
+      pk->p.encode(fmpzxx((*input)[i]), mP);
+      pk->encpoly(mP, *ct, [&]() { return(lround(rnorm(rng))); });
+      output->at(i) = ct;
+    }
+  }
+};
+void FandV_pk::encvecseeded(const std::vector<int>& m, unsigned long seed, std::vector<FandV_ct_ptr>& out) const {
+  out.resize(m.size());
+  FandV_EncSeeded encEngine(this, &m, seed, &out);
+  FandV_parallelFor(FandV_OP_ENC, p, 0, m.size(), encEngine);
+}
+
+// Pool of encryptions of zero
+void FandV_pk::startPool(int size, int refill, double maxMB, int threads) {
+  pool.reset(); // Stops any existing pool first
+  if(size <= 0)
+    return;
+  if(refill < 0 || refill > size) {
+    Rcout << "Error: refill threshold must be between 0 and the pool size\n";
+    return;
+  }
+  pool = std::make_shared<FandV_enc_pool>(*this, size, refill, maxMB*1048576.0, threads);
+}
+void FandV_pk::stopPool() {
+  pool.reset();
+}
+int FandV_pk::poolAvailable() const {
+  if(!pool)
+    return(0);
+  return(pool->available());
+}
+
+// Memory (including any pooled encryptions of zero)
+double FandV_pk::memoryUsage() const {
+  double bytes = sizeof(FandV_pk) - sizeof(FandV_par) + p.memoryUsage() + fmpz_polyxx_bytes(p0) + fmpz_polyxx_bytes(p1);
+  if(ntt)
+    bytes += ntt->ntt.memoryUsage() + (ntt->P0.capacity() + ntt->P1.capacity())*sizeof(ulong);
+  if(pool)
+    bytes += pool->memoryUsage();
+  return(bytes);
 }
   
 void FandV_pk::show() {
@@ -125,6 +271,9 @@ void FandV_pk::show() {
   Rcout << ",\np\u2081 = ";
   printPoly(p1);
   Rcout << " )\n";
+  if(pool) {
+    Rcout << "Encryption pool: " << pool->available() << " of " << pool->capacity() << " encryptions of zero ready\n";
+  }
 }
 
 // Save/load
@@ -154,61 +303,280 @@ FandV_pk::FandV_pk(FILE* fp, const FandV_par& p_, FandV_rlk_locker* rlkl_, size_
   
   read(fp, p0);
   read(fp, p1);
+  precompute();
   
   free(buf);
 }
 
 
 //// Private keys ////
+
+// Weight of a ternary secret up to which c1*s is done by signed rotations of
+// c1 (weight*d additions) rather than by transforms
+#define FandV_SK_SPARSE 128
+
+// Secret buffers get whole pages of their own, so unlocking one can never
+// unlock pages another key still holds.  They are locked into memory where the
+// platform allows, so never written to swap, and zeroed before being freed.
+template <typename T>
+class FandV_secure {
+  public:
+    FandV_secure(std::size_t n_) : n(n_), bytes(0), data(NULL), locked(false) {
+      if(n == 0)
+        return;
+#if defined (__WINDOWS__)
+      bytes = n*sizeof(T);
+      data = (T*) calloc(n, sizeof(T));
+#else
+      std::size_t page = sysconf(_SC_PAGESIZE);
+      bytes = ((n*sizeof(T) + page - 1)/page)*page;
+      void* addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(addr != MAP_FAILED) {
+        data = (T*) addr; // Anonymous pages start zeroed
+        locked = mlock(data, bytes) == 0;
+      }
+#endif
+      if(data == NULL)
+        throw std::bad_alloc();
+    }
+    ~FandV_secure() {
+      if(data == NULL)
+        return;
+      volatile unsigned char* b = (volatile unsigned char*) data;
+      for(std::size_t i=0; i<bytes; i++)
+        b[i] = 0;
+#if defined (__WINDOWS__)
+      free(data);
+#else
+      if(locked)
+        munlock(data, bytes);
+      munmap(data, bytes);
+#endif
+    }
+    
+    T& operator[](std::size_t i) { return(data[i]); }
+    const T& operator[](std::size_t i) const { return(data[i]); }
+    
+    std::size_t n, bytes;
+    T* data;
+    bool locked;
+    
+  private:
+    FandV_secure(const FandV_secure&);
+    FandV_secure& operator=(const FandV_secure&);
+};
+static void FandV_wipe(void* x, std::size_t bytes) {
+  volatile unsigned char* b = (volatile unsigned char*) x;
+  for(std::size_t i=0; i<bytes; i++)
+    b[i] = 0;
+}
+// Zero a polynomial's coefficients in place (secrets have small coefficients,
+// which fmpz holds inline) and release them
+static void FandV_wipe(fmpz_polyxx& x) {
+  fmpz_poly_struct* xp = x._poly();
+  for(slong i=0; i<xp->alloc; i++)
+    fmpz_zero(xp->coeffs+i);
+  if(xp->alloc > 0)
+    FandV_wipe(xp->coeffs, xp->alloc*sizeof(fmpz));
+  fmpz_poly_zero(xp);
+  fmpz_poly_realloc(xp, 0);
+}
+
+// The secret in transform form for the d and qpow of the cipher texts in hand.
+// c1 is at most FandV_REDUCE_TERMS*q/2 and s ternary, so the product's
+// coefficients are below d*2^(qpow+6).
+struct FandV_sk_ntt {
+  FandV_sk_ntt(const fmpz_polyxx& s, const FandV_par& p) : ntt(p.Phi.length()-1, p.qpow + 6 + FLINT_BIT_COUNT(p.Phi.length()-1)), S(ntt.size()), qpow(p.qpow) {
+    ntt.forward(s, S.data);
+  }
+  
+  FandV_ntt ntt;
+  FandV_secure<ulong> S;
+  int qpow;
+};
+
+// A ternary secret as two bit vectors of len bits, words [0, n) flagging the
+// nonzero coefficients and words [n, 2n) the negative ones.  Once packed this is
+// the only copy of the secret a key holds.
+struct FandV_sk_packed {
+  FandV_sk_packed(int len_) : len(len_), weight(0), n((len_+63)/64), bits(2*n) { }
+  
+  void set(int i, bool minus) {
+    bits[i/64] |= UINT64_C(1) << (i%64);
+    if(minus)
+      bits[n + i/64] |= UINT64_C(1) << (i%64);
+    weight++;
+  }
+  bool nz(int i) const { return((bits[i/64] >> (i%64)) & 1); }
+  bool neg(int i) const { return((bits[n + i/64] >> (i%64)) & 1); }
+  
+  // s itself, which the caller wipes once done with it
+  void unpack(fmpz_polyxx& s) const {
+    s.realloc(len);
+    for(int i=0; i<len; i++) {
+      if(nz(i))
+        s.set_coeff(i, neg(i) ? -1 : 1);
+    }
+  }
+  
+  // Transform of s, made on first use (and remade if the parameters change)
+  // then published so later decryptions take no lock
+  std::shared_ptr<const FandV_sk_ntt> transform(const FandV_par& p) {
+    std::shared_ptr<const FandV_sk_ntt> t = std::atomic_load(&ntt);
+    if(t && t->ntt.d == p.Phi.length()-1 && t->qpow == p.qpow)
+      return(t);
+    std::lock_guard<std::mutex> guard(lock);
+    t = std::atomic_load(&ntt);
+    if(!t || t->ntt.d != p.Phi.length()-1 || t->qpow != p.qpow) {
+      fmpz_polyxx s;
+      unpack(s);
+      t = std::make_shared<const FandV_sk_ntt>(s, p);
+      FandV_wipe(s);
+      std::atomic_store(&ntt, t);
+    }
+    return(t);
+  }
+  
+  int len, weight;
+  std::size_t n;
+  FandV_secure<uint64_t> bits;
+  std::mutex lock; // Only taken to make the transform
+  std::shared_ptr<const FandV_sk_ntt> ntt; // Only accessed with std::atomic_load/store
+};
+
 FandV_sk::FandV_sk() { }
 
-FandV_sk::FandV_sk(const FandV_sk& sk) : s(sk.s) { }
+FandV_sk::FandV_sk(const FandV_sk& sk) : s(sk.s), packed(sk.packed) { }
 
-// Decrypt
-fmpz_polyxx FandV_sk::decraw(const FandV_ct& ct) const {
-  fmpz_polyxx res, res2;
-  fmpzxx tmp(1);
+FandV_sk::~FandV_sk() {
+  FandV_wipe(s);
+}
+
+void FandV_sk::pack() {
+  packed.reset();
+  std::shared_ptr<FandV_sk_packed> x = std::make_shared<FandV_sk_packed>(s.length());
+  const fmpz* c = s._poly()->coeffs;
+  for(int i=0; i<s.length(); i++) {
+    if(fmpz_is_zero(c+i))
+      continue;
+    if(fmpz_is_one(c+i))
+      x->set(i, false);
+    else if(fmpz_cmp_si(c+i, -1) == 0)
+      x->set(i, true);
+    else
+      return;
+  }
+  packed = x;
+  FandV_wipe(s);
+}
+
+// With s ternary and Phi = x^d+1, c1*s is a signed sum of rotations of c1 for a
+// sparse secret, or a pointwise product in transform form otherwise
+void FandV_sk::mulS(const FandV_ct& ct, fmpz_polyxx& res) const {
+  int d = ct.p.Phi.length()-1;
+  if(!packed) {
+    res = (ct.c1*s)%ct.p.Phi;
+    return;
+  }
+  if(d < 2 || (d & (d-1)) != 0 || packed->len > d || ct.bound > FandV_REDUCE_TERMS) {
+    fmpz_polyxx s_;
+    packed->unpack(s_);
+    res = (ct.c1*s_)%ct.p.Phi;
+    FandV_wipe(s_);
+    return;
+  }
   
-  res = ct.c0+((ct.c1*s)%ct.p.Phi);
-  fmpz_polyxx_q(res, ct.p.q);
-  res2 = (ct.p.t*res)%ct.p.q;
-  res = (ct.p.t*res)/ct.p.q;
-  for(int i=0; i<ct.p.Phi.length(); i++) {
-    if(res2.get_coeff(i) > ct.p.q/2)
-      res.set_coeff(i, res.get_coeff(i)+tmp);
+  if(packed->weight <= FandV_SK_SPARSE) {
+    // c1*x^j is c1 moved up j places, wrapping round with a change of sign
+    const fmpz_poly_struct* c1 = ct.c1._poly();
+    fmpz_poly_struct* rp = res._poly();
+    fmpz_poly_zero(rp);
+    fmpz_poly_fit_length(rp, d);
+    _fmpz_poly_set_length(rp, d);
+    for(int j=0; j<packed->len; j++) {
+      if(!packed->nz(j))
+        continue;
+      bool minus = packed->neg(j);
+      for(slong i=0; i<c1->length; i++) {
+        slong k = i+j;
+        bool wrap = k >= d;
+        if(wrap)
+          k -= d;
+        if(minus != wrap)
+          fmpz_sub(rp->coeffs+k, rp->coeffs+k, c1->coeffs+i);
+        else
+          fmpz_add(rp->coeffs+k, rp->coeffs+k, c1->coeffs+i);
+      }
+    }
+    _fmpz_poly_normalise(rp);
+    return;
   }
-  fmpz_polyxx_q(res, ct.p.t);
   
-  return(res);
+  std::shared_ptr<const FandV_sk_ntt> t = packed->transform(ct.p);
+  std::vector<ulong> C, X;
+  t->ntt.forward(ct.c1, C);
+  t->ntt.mul(t->S.data, C, X);
+  t->ntt.inverse(X, res);
 }
-std::string FandV_sk::dec(const FandV_ct& ct) const {
+
+// Decrypt
+fmpz_polyxx FandV_sk::decraw(const FandV_ct& ct) const {
+  FHE_PROF(FandV_PROF_DEC);
   fmpz_polyxx res;
-  fmpzxx tmp(1), m(0);
   
-  res = decraw(ct);
+  // No need to reduce mod q first: adding kq to a coefficient moves the
+  // rounded value by kt, which vanishes mod t
+  mulS(ct, res);
+  res = ct.c0+res;
+  ct.p.scaleRound(res, ct.p.t);
   
-  for(unsigned int i=0; i<res.length(); i++) {
-    m += res.get_coeff(i)*tmp;
-    tmp *= 2;
+  return(res);
+}
+std::string FandV_sk::dec(const FandV_ct& ct) const {
+  return(ct.p.decode(decraw(ct)));
+}
+
+double FandV_sk::memoryUsage() const {
+  double bytes = sizeof(FandV_sk) + fmpz_polyxx_bytes(s);
+  if(packed) {
+    bytes += sizeof(FandV_sk_packed) + packed->bits.bytes;
+    std::shared_ptr<const FandV_sk_ntt> t = std::atomic_load(&packed->ntt);
+    if(t)
+      bytes += t->ntt.memoryUsage() + t->S.bytes;
   }
-  
-  return(m.to_string());
+  return(bytes);
 }
 
 void FandV_sk::show() {
   Rcout << "Fan and Vercauteren private key\n";
   Rcout << "s = ";
-  printPoly(s);
+  if(packed) {
+    fmpz_polyxx s_;
+    packed->unpack(s_);
+    printPoly(s_);
+    FandV_wipe(s_);
+  } else {
+    printPoly(s);
+  }
   Rcout << "\n";
 }
 
 // Save/load
 void FandV_sk::save(FILE* fp) const {
   fprintf(fp, "=> FHE package object <=\nRcpp_FandV_sk\n");
+  if(packed) {
+    // Two bits a coefficient, in hex, instead of the polynomial in decimal
+    fprintf(fp, "packed=%d\n", packed->len);
+    for(std::size_t i=0; i<packed->bits.n; i++) {
+      fprintf(fp, "%016llx", (unsigned long long) packed->bits[i]);
+    }
+    fprintf(fp, "\n");
+    return;
+  }
   print(fp, s);
   fprintf(fp, "\n");
 }
-FandV_sk::FandV_sk(FILE* fp) {
+FandV_sk::FandV_sk(FILE* fp, int d) {
   // Check for header line
   char *buf = NULL; size_t bufn = 0;
   size_t len;
@@ -225,8 +593,45 @@ FandV_sk::FandV_sk(FILE* fp) {
     return;
   }
   
-  read(fp, s);
+  // Older files hold the polynomial itself
+  long pos = ftell(fp);
+  int plen;
+  len = getline(&buf, &bufn, fp);
+  if(sscanf(buf, "packed=%d", &plen) != 1) {
+    fseek(fp, pos, SEEK_SET);
+    read(fp, s);
+    pack();
+    free(buf);
+    return;
+  }
+  if(plen <= 0 || plen > d) {
+    Rcout << "Error: corrupt secret key\n";
+    free(buf);
+    return;
+  }
+  
+  std::shared_ptr<FandV_sk_packed> x = std::make_shared<FandV_sk_packed>(plen);
+  len = getline(&buf, &bufn, fp);
+  if(len == (size_t) -1 || len < 16*x->bits.n) {
+    Rcout << "Error: secret key is truncated\n";
+    free(buf);
+    return;
+  }
+  char word[17];
+  word[16] = '\0';
+  for(std::size_t i=0; i<x->bits.n; i++) {
+    memcpy(word, buf + 16*i, 16);
+    x->bits[i] = strtoull(word, NULL, 16);
+  }
+  FandV_wipe(word, sizeof(word));
+  FandV_wipe(buf, bufn);
   free(buf);
+  
+  for(int i=0; i<plen; i++) {
+    if(x->nz(i))
+      x->weight++;
+  }
+  packed = x;
 }
 
 
@@ -235,6 +640,10 @@ FandV_rlk::FandV_rlk() { }
 
 FandV_rlk::FandV_rlk(const FandV_rlk& rlk) : rlk00(rlk.rlk00), rlk01(rlk.rlk01), rlk10(rlk.rlk10), rlk11(rlk.rlk11) { }
 
+double FandV_rlk::memoryUsage() const {
+  return(sizeof(FandV_rlk) + fmpz_polyxx_bytes(rlk00) + fmpz_polyxx_bytes(rlk01) + fmpz_polyxx_bytes(rlk10) + fmpz_polyxx_bytes(rlk11));
+}
+
 void FandV_rlk::show() {
   Rcout << "Fan and Vercauteren relinearisation key\n";
   Rcout << "( rlk\u2080\u2080 = ";
@@ -285,18 +694,207 @@ FandV_rlk::FandV_rlk(FILE* fp) {
   free(buf);
 }
 
-FandV_rlk_locker::FandV_rlk_locker() { }
+FandV_rlk_locker::FandV_rlk_locker() : n(0), clock(0) {
+  for(int c=0; c<FandV_RLK_CHUNKS; c++)
+    chunks[c] = NULL;
+}
+FandV_rlk_locker::~FandV_rlk_locker() {
+  for(int c=0; c<FandV_RLK_CHUNKS; c++)
+    delete[] chunks[c].load();
+}
+
+FandV_rlk_locker::slot& FandV_rlk_locker::at(std::size_t i) const {
+  return(chunks[i/FandV_RLK_CHUNK].load(std::memory_order_acquire)[i%FandV_RLK_CHUNK]);
+}
 
 int FandV_rlk_locker::add(const FandV_rlk &rlk) {
-  for(unsigned int i=0; i<x.size(); i++) {
-    if(x[i].rlk00 == rlk.rlk00 && x[i].rlk01 == rlk.rlk01 && x[i].rlk10 == rlk.rlk10 && x[i].rlk11 == rlk.rlk11) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::size_t m = n.load();
+  for(std::size_t i=0; i<m; i++) {
+    std::shared_ptr<const FandV_rlk> r = std::atomic_load(&at(i).rlk);
+    if(r && r->rlk00 == rlk.rlk00 && r->rlk01 == rlk.rlk01 && r->rlk10 == rlk.rlk10 && r->rlk11 == rlk.rlk11) {
+      at(i).used = ++clock;
       return(i);
     }
   }
-  x.push_back(rlk);
-  return(x.size()-1);
+  if(m >= (std::size_t) FandV_RLK_CHUNK*FandV_RLK_CHUNKS)
+    throw std::runtime_error("relinearisation key locker is full");
+  if(m % FandV_RLK_CHUNK == 0)
+    chunks[m/FandV_RLK_CHUNK].store(new slot[FandV_RLK_CHUNK], std::memory_order_release);
+  slot& s = at(m);
+  std::atomic_store(&s.rlk, std::make_shared<const FandV_rlk>(rlk));
+  s.used = ++clock;
+  n.store(m+1, std::memory_order_release); // Publish only once the slot is filled
+  return(m);
+}
+
+// Read the relinearisation key from a keys file (as written by saveFHE), which
+// follows the header and the parameters
+static std::shared_ptr<const FandV_rlk> FandV_rlk_reload(const std::string& file) {
+  FILE *fp = fopen(file.c_str(), "r");
+  if(fp == NULL)
+    throw std::runtime_error("cannot reopen keys file " + file);
+  
+  char *buf = NULL; size_t bufn = 0;
+  size_t len;
+  len = getline(&buf, &bufn, fp);
+  bool ok = strncmp("=> FHE pkg obj <=\n", buf, len) == 0;
+  len = getline(&buf, &bufn, fp);
+  ok = ok && strncmp("FandV_keys\n", buf, len) == 0;
+  if(!ok) {
+    free(buf);
+    fclose(fp);
+    throw std::runtime_error(file + " does not contain key objects");
+  }
+  FandV_par p(fp);
+  len = getline(&buf, &bufn, fp); // Advance past the new line
+  std::shared_ptr<const FandV_rlk> rlk = std::make_shared<const FandV_rlk>(fp);
+  
+  free(buf);
+  fclose(fp);
+  return(rlk);
+}
+
+std::shared_ptr<const FandV_rlk> FandV_rlk_locker::get(std::size_t i) {
+  if(i == FandV_RLK_NONE)
+    throw std::runtime_error("cipher text has no relinearisation key (it was loaded from a compressed file saved without one)");
+  if(i >= n.load(std::memory_order_acquire))
+    throw std::runtime_error("no such relinearisation key");
+  slot& s = at(i);
+  
+  // Fast path: only evictable keys need their use recorded, and a stale stamp
+  // merely makes eviction slightly less exact
+  if(s.evictable.load(std::memory_order_relaxed))
+    s.used.store(clock.fetch_add(1, std::memory_order_relaxed)+1, std::memory_order_relaxed);
+  std::shared_ptr<const FandV_rlk> rlk = std::atomic_load(&s.rlk);
+  if(rlk)
+    return(rlk);
+  
+  std::string file;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    rlk = std::atomic_load(&s.rlk);
+    if(rlk)
+      return(rlk);
+    file = s.file;
+  }
+  
+  // Read without holding the lock so other keys stay available meanwhile
+  rlk = FandV_rlk_reload(file);
+  
+  std::lock_guard<std::mutex> guard(lock);
+  std::shared_ptr<const FandV_rlk> cur = std::atomic_load(&s.rlk);
+  if(cur)
+    return(cur);
+  std::atomic_store(&s.rlk, rlk);
+  evict(s.group);
+  return(rlk);
+}
+
+int FandV_rlk_locker::addGroup(int max) {
+  std::lock_guard<std::mutex> guard(lock);
+  groupMax.push_back(std::max(max, 0));
+  return(groupMax.size()-1);
+}
+void FandV_rlk_locker::setGroupMax(int g, int max) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(g < 0 || g >= (int) groupMax.size())
+    return;
+  groupMax[g] = std::max(max, 0);
+  evict(g);
+}
+int FandV_rlk_locker::getGroupMax(int g) const {
+  std::lock_guard<std::mutex> guard(lock);
+  if(g < 0 || g >= (int) groupMax.size())
+    return(0);
+  return(groupMax[g]);
+}
+
+void FandV_rlk_locker::setSource(std::size_t i, const std::string& file, int g) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(i >= n.load() || g < 0 || g >= (int) groupMax.size())
+    return;
+  slot& s = at(i);
+  int old = s.group;
+  s.file = file;
+  s.group = g;
+  s.evictable = true;
+  evict(g);
+  if(old >= 0 && old != g)
+    evict(old);
+}
+
+void FandV_rlk_locker::pin(std::size_t i) {
+  if(i >= n.load())
+    return;
+  std::shared_ptr<const FandV_rlk> rlk = get(i); // Reloaded while the file still holds it
+  std::lock_guard<std::mutex> guard(lock);
+  slot& s = at(i);
+  std::atomic_store(&s.rlk, rlk);
+  s.evictable = false;
+  s.file.clear();
+  s.group = -1;
+}
+
+int FandV_rlk_locker::resident() const {
+  std::lock_guard<std::mutex> guard(lock);
+  int res = 0;
+  for(std::size_t i=0; i<n.load(); i++) {
+    if(std::atomic_load(&at(i).rlk))
+      res++;
+  }
+  return(res);
+}
+int FandV_rlk_locker::residentIn(int g) const {
+  std::lock_guard<std::mutex> guard(lock);
+  int res = 0;
+  for(std::size_t i=0; i<n.load(); i++) {
+    if(at(i).group == g && std::atomic_load(&at(i).rlk))
+      res++;
+  }
+  return(res);
+}
+
+// Drop the least recently used keys of group g until no more than its limit are
+// held.  Cipher texts in the middle of a multiplication keep their own
+// reference, so the memory goes once they are done.
+void FandV_rlk_locker::evict(int g) {
+  if(g < 0 || g >= (int) groupMax.size() || groupMax[g] == 0)
+    return;
+  std::vector< std::pair<unsigned long, std::size_t> > held;
+  for(std::size_t i=0; i<n.load(); i++) {
+    slot& s = at(i);
+    if(s.group == g && std::atomic_load(&s.rlk))
+      held.push_back(std::make_pair(s.used.load(), i));
+  }
+  if(held.size() <= (std::size_t) groupMax[g])
+    return;
+  std::size_t k = held.size() - groupMax[g];
+  std::nth_element(held.begin(), held.begin()+(k-1), held.end());
+  for(std::size_t j=0; j<k; j++) {
+    std::atomic_store(&at(held[j].second).rlk, std::shared_ptr<const FandV_rlk>());
+  }
+}
+
+double FandV_rlk_locker::memoryUsage() const {
+  std::lock_guard<std::mutex> guard(lock);
+  double bytes = sizeof(FandV_rlk_locker) + groupMax.capacity()*sizeof(int);
+  for(std::size_t i=0; i<n.load(); i++) {
+    if(i % FandV_RLK_CHUNK == 0)
+      bytes += FandV_RLK_CHUNK*sizeof(slot);
+    const slot& s = at(i);
+    bytes += s.file.capacity();
+    std::shared_ptr<const FandV_rlk> r = std::atomic_load(&s.rlk);
+    if(r)
+      bytes += r->memoryUsage();
+  }
+  return(bytes);
 }
 
 void FandV_rlk_locker::show() const {
-  Rcout << "Locker contains " << x.size() << " Fan and Vercauteren relinearisation keys\n";
+  int held = resident();
+  Rcout << "Locker contains " << n.load() << " Fan and Vercauteren relinearisation keys";
+  if(held < (int) n.load())
+    Rcout << " (" << held << " held in memory)";
+  Rcout << "\n";
 }
@@ -15,12 +15,21 @@ using namespace flint;
 #include "FandV_par.h"
 
 #include <vector>
+#include <memory>
+#include <functional>
+#include <string>
+#include <mutex>
+#include <atomic>
 
 class FandV_ct;
 class FandV_ct_vec;
 class FandV_ct_mat;
 class FandV_sk;
 class FandV_pk;
+class FandV_enc_pool;
+struct FandV_EncSeeded;
+struct FandV_pk_ntt;
+struct FandV_sk_packed;
 
 class FandV_rlk {
   public:
@@ -31,10 +40,13 @@ class FandV_rlk {
     // Relinearise
     //int relin(FandV_ct& ct);
     
+    // Memory
+    double memoryUsage() const;
+    
     // Print
     void show();
     
-    friend void FandV_par::keygen(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk);
+    friend class FandV_par; // Key generation
     
     // Save/load
     void save(FILE* fp) const;
@@ -43,17 +55,63 @@ class FandV_rlk {
     fmpz_polyxx rlk00, rlk01, rlk10, rlk11;
 };
 
+// Relinearisation keys are held once here and referred to by index from keys
+// and cipher texts.  A key with a file to reload from may be evicted when the
+// number resident in its group exceeds that group's limit (least recently used
+// first), so many tenants' keys can be registered without all being held in
+// memory.  Capacity is FandV_RLK_CHUNKS chunks of FandV_RLK_CHUNK keys.
+#define FandV_RLK_CHUNK 1024
+#define FandV_RLK_CHUNKS 4096
+// Index of cipher texts which carry no relin key, so cannot be multiplied
+#define FandV_RLK_NONE ((std::size_t) -1)
 class FandV_rlk_locker {
   public:
     // Constructors
     FandV_rlk_locker();
+    ~FandV_rlk_locker();
     
     // Add a relin key to the locker and return the index
     int add(const FandV_rlk &rlk);
+    // The key at index i, reloading it if it was evicted.  Safe from any thread
+    // and lock free while the key is in memory; holding the pointer keeps the
+    // key in memory while it is used.
+    std::shared_ptr<const FandV_rlk> get(std::size_t i);
+    // Evictable keys are kept in groups (one per key ring), each with its own
+    // limit on how many of its keys are held in memory at once (0 for no limit)
+    int addGroup(int max);
+    void setGroupMax(int g, int max);
+    int getGroupMax(int g) const;
+    // Allow key i to be evicted as a member of group g, reloading it from a keys
+    // file when next needed
+    void setSource(std::size_t i, const std::string& file, int g);
+    // Hold key i in memory for good, no longer tied to its file (which is about
+    // to be overwritten with another key)
+    void pin(std::size_t i);
+    int resident() const;
+    int residentIn(int g) const;
+    
+    double memoryUsage() const;
     void show() const;
     
-    // The locker containing relin keys
-    std::vector<FandV_rlk> x;
+  private:
+    struct slot {
+      slot() : group(-1), evictable(false), used(0) { }
+      std::shared_ptr<const FandV_rlk> rlk; // Empty while evicted, only accessed with std::atomic_load/store
+      std::string file; // Keys file to reload from, empty if not evictable
+      int group;
+      std::atomic<bool> evictable;
+      std::atomic<unsigned long> used; // Approximate clock value at last use
+    };
+    slot& at(std::size_t i) const;
+    void evict(int g); // Called holding lock
+    
+    // The locker containing relin keys, in chunks which never move once
+    // allocated so that resident keys can be found without the lock
+    std::atomic<slot*> chunks[FandV_RLK_CHUNKS];
+    std::atomic<std::size_t> n;
+    std::vector<int> groupMax;
+    mutable std::mutex lock; // Held to add, reload and evict keys
+    std::atomic<unsigned long> clock;
 };
 
 class FandV_pk {
@@ -64,14 +122,32 @@ class FandV_pk {
     
     // Encrypt
     void enc(int m, FandV_ct& ct) const;
+    void encbig(std::string m, FandV_ct& ct) const;
+    void encfrac(double m, FandV_ct& ct) const;
     void encbinary(IntegerVector m, FandV_ct& ct) const;
     void encvec(IntegerVector m, FandV_ct_vec& ctvec);
     void encmat(IntegerVector m, int nrow, int ncol, FandV_ct_mat& ctmat);
+    void encfracvec(NumericVector m, FandV_ct_vec& ctvec);
+    void encfracmat(NumericVector m, int nrow, int ncol, FandV_ct_mat& ctmat);
+    // ... safe off the main thread: noise comes from the pool or from generators
+    // seeded by seed, never from R's
+    void encvecseeded(const std::vector<int>& m, unsigned long seed, std::vector< std::shared_ptr<const FandV_ct> >& out) const;
+    
+    // Background pool of precomputed encryptions of zero
+    void startPool(int size, int refill, double maxMB, int threads);
+    void stopPool();
+    int poolAvailable() const;
+    
+    // Memory
+    double memoryUsage() const;
     
     // Print
     void show();
     
-    friend void FandV_par::keygen(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk);
+    friend class FandV_par; // Key generation
+    friend class FandV_enc_pool;
+    friend struct FandV_EncSeeded;
+    friend struct FandV_pk_ntt;
 
     // Save/load
     void save(FILE* fp) const;
@@ -82,7 +158,14 @@ class FandV_pk {
     size_t rlki;
     
   private:
+    void encpoly(const fmpz_polyxx& mP, FandV_ct& ct) const; // Encrypt an already encoded message
+    void encpoly(const fmpz_polyxx& mP, FandV_ct& ct, std::function<long()> rnorm) const; // ... error terms drawn from rnorm if the pool is empty
+    void enczero(FandV_ct& ct, std::function<long()> rnorm) const; // Encrypt zero, error terms drawn from rnorm
+    void precompute(); // Transform p0 and p1 for enczero, after keygen or load
+    
     fmpz_polyxx p0, p1; // Cyclotomic polynomial defining ring modulo
+    std::shared_ptr<FandV_enc_pool> pool; // Shared by copies of this key
+    std::shared_ptr<const FandV_pk_ntt> ntt; // p0 and p1 in transform form (shared, empty if d is not a power of two)
 };
 
 class FandV_sk {
@@ -90,22 +173,30 @@ class FandV_sk {
     // Constructors
     FandV_sk();
     FandV_sk(const FandV_sk& sk);
+    ~FandV_sk(); // Zeroes s
     
     // Decrypt
     fmpz_polyxx decraw(const FandV_ct& ct) const;
     std::string dec(const FandV_ct& ct) const;
     
+    // Memory
+    double memoryUsage() const;
+    
     // Print
     void show();
     
-    friend void FandV_par::keygen(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk);
+    friend class FandV_par; // Key generation
     
     // Save/load
-    void save(FILE* fp) const;
-    FandV_sk(FILE* fp);
+    void save(FILE* fp) const; // Bit packed when s is ternary
+    FandV_sk(FILE* fp, int d); // ... d is the degree of Phi, bounding a packed key
 
   private:
-    fmpz_polyxx s; // Cyclotomic polynomial defining ring modulo
+    void pack(); // Bit pack s if its coefficients are all in {-1,0,1}, after keygen or load, wiping s
+    void mulS(const FandV_ct& ct, fmpz_polyxx& res) const; // res <- c1*s mod Phi
+    
+    fmpz_polyxx s; // The secret, empty once packed
+    std::shared_ptr<FandV_sk_packed> packed; // Shared by copies of this key, empty unless s is ternary
 };
 
 #endif
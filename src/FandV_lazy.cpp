@@ -0,0 +1,617 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "FandV_ct.h"
+#include "FandV_ct_vec.h"
+#include "FandV_ct_mat.h"
+#include "FandV_lazy.h"
+#include "FandV_sched.h"
+#include "FandV.h"
+
+typedef std::shared_ptr<FandV_lazy_node> FandV_lazy_ptr;
+
+//// Recording ////
+// Dimensions of the arguments of a matrix product: vectors are columns, except
+// on the left of a matrix where they are rows (as %*% does in R)
+static void FandV_lazy_dims(const FandV_lazy_node& x, const FandV_lazy_node& y, int& xr, int& xc, int& yr, int& yc) {
+  xr = x.nrow; xc = x.ncol;
+  yr = y.nrow; yc = y.ncol;
+  if(x.kind == FandV_LZ_VEC && y.kind == FandV_LZ_MAT) {
+    xr = 1; xc = x.nrow;
+  }
+}
+
+// Set the shape of a node from its operation and arguments
+static void FandV_lazy_shape(FandV_lazy_node& n) {
+  if(n.op == FandV_LZ_SUM || n.op == FandV_LZ_PROD) {
+    n.kind = FandV_LZ_CT; n.nrow = 1; n.ncol = 1;
+  } else if(n.op == FandV_LZ_MATMUL) {
+    int xr, xc, yr, yc;
+    FandV_lazy_dims(*n.args[0], *n.args[1], xr, xc, yr, yc);
+    n.kind = FandV_LZ_MAT; n.nrow = xr; n.ncol = yc;
+  } else if(n.elementwise()) {
+    // The longer argument gives the shape, a matrix winning a tie
+    const FandV_lazy_node& x = *n.args[0];
+    const FandV_lazy_node& y = *n.args[1];
+    const FandV_lazy_node& a = (y.size() > x.size() || (y.size() == x.size() && y.kind > x.kind)) ? y : x;
+    n.kind = a.kind; n.nrow = a.nrow; n.ncol = a.ncol;
+  }
+}
+
+static FandV_lazy_ptr FandV_lazy_make(FandV_lazy_op op, const FandV_lazy_ptr& x, const FandV_lazy_ptr& y) {
+  FandV_lazy_ptr n = std::make_shared<FandV_lazy_node>();
+  n->op = op;
+  n->args.push_back(x);
+  if(y) n->args.push_back(y);
+  FandV_lazy_shape(*n);
+  return(n);
+}
+
+FandV_lazy::FandV_lazy() : node(std::make_shared<FandV_lazy_node>()) {
+  node->op = FandV_LZ_LEAF;
+  node->kind = FandV_LZ_VEC;
+  node->nrow = 0;
+  node->ncol = 1;
+}
+FandV_lazy::FandV_lazy(const FandV_lazy& x) : node(x.node) { }
+FandV_lazy::FandV_lazy(FandV_lazy_op op, const FandV_lazy& x, const FandV_lazy& y) : node(FandV_lazy_make(op, x.node, y.node)) { }
+
+FandV_lazy FandV_lazy::add(const FandV_lazy& y) const {
+  return(FandV_lazy(FandV_LZ_ADD, *this, y));
+}
+FandV_lazy FandV_lazy::sub(const FandV_lazy& y) const {
+  return(FandV_lazy(FandV_LZ_SUB, *this, y));
+}
+FandV_lazy FandV_lazy::mul(const FandV_lazy& y) const {
+  return(FandV_lazy(FandV_LZ_MUL, *this, y));
+}
+// Repeated squaring, so the multiplicative depth is only log2(k)
+FandV_lazy FandV_lazy::pow(int k) const {
+  if(k <= 1)
+    return(*this);
+  FandV_lazy h(pow(k/2));
+  FandV_lazy res(h.mul(h));
+  if(k%2 == 1)
+    res = res.mul(*this);
+  return(res);
+}
+FandV_lazy FandV_lazy::sum() const {
+  FandV_lazy res;
+  res.node = FandV_lazy_make(FandV_LZ_SUM, node, FandV_lazy_ptr());
+  return(res);
+}
+FandV_lazy FandV_lazy::prod() const {
+  FandV_lazy res;
+  res.node = FandV_lazy_make(FandV_LZ_PROD, node, FandV_lazy_ptr());
+  return(res);
+}
+// An inner product is recorded as the sum of an element-wise product, so that
+// it is fused and relinearised once
+FandV_lazy FandV_lazy::matmul(const FandV_lazy& y) const {
+  if(node->kind == FandV_LZ_VEC && y.node->kind == FandV_LZ_VEC)
+    return(mul(y).sum());
+  return(FandV_lazy(FandV_LZ_MATMUL, *this, y));
+}
+
+std::string FandV_lazy::kind() const {
+  switch(node->kind) {
+    case FandV_LZ_CT:
+      return("ct");
+    case FandV_LZ_VEC:
+      return("ctvec");
+    case FandV_LZ_MAT:
+      return("ctmat");
+  }
+  return("");
+}
+int FandV_lazy::size() const {
+  return(node->size());
+}
+int FandV_lazy::nrow() const {
+  return(node->nrow);
+}
+int FandV_lazy::ncol() const {
+  return(node->ncol);
+}
+
+static void FandV_lazy_reach(FandV_lazy_node* n, std::unordered_set<FandV_lazy_node*>& seen) {
+  if(!seen.insert(n).second || n->op == FandV_LZ_LEAF)
+    return;
+  for(unsigned int i=0; i<n->args.size(); i++)
+    FandV_lazy_reach(n->args[i].get(), seen);
+}
+int FandV_lazy::pending() const {
+  std::unordered_set<FandV_lazy_node*> seen;
+  FandV_lazy_reach(node.get(), seen);
+  int n = 0;
+  for(std::unordered_set<FandV_lazy_node*>::iterator it=seen.begin(); it!=seen.end(); ++it) {
+    if((*it)->op != FandV_LZ_LEAF) n++;
+  }
+  return(n);
+}
+
+FandV_lazy lazy_FandV_ct(const FandV_ct& ct) {
+  FandV_lazy res;
+  res.node->kind = FandV_LZ_CT;
+  res.node->nrow = 1;
+  res.node->value.push_back(std::make_shared<const FandV_ct>(ct));
+  return(res);
+}
+FandV_lazy lazy_FandV_vec(const FandV_ct_vec& ct_vec) {
+  FandV_lazy res;
+  res.node->nrow = ct_vec.vec.size();
+  res.node->value = ct_vec.vec;
+  return(res);
+}
+FandV_lazy lazy_FandV_mat(const FandV_ct_mat& ct_mat) {
+  FandV_lazy res;
+  res.node->kind = FandV_LZ_MAT;
+  res.node->nrow = ct_mat.nrow;
+  res.node->ncol = ct_mat.ncol;
+  res.node->value = ct_mat.mat;
+  return(res);
+}
+
+//// Fused element-wise programs ////
+// An element-wise subexpression flattened into instructions, each writing the
+// slot of the same index.  Nodes appearing more than once get one instruction.
+struct FandV_lazy_prog {
+  struct instr {
+    FandV_lazy_op op; // FandV_LZ_LEAF loads element i of inputs[a]
+    int a, b;
+  };
+  std::vector<instr> code;
+  std::vector<const std::vector<FandV_ct_ptr>*> inputs;
+  int muls;
+
+  FandV_lazy_prog() : muls(0) { }
+
+  // Evaluate the first upto instructions for element i
+  void run(std::size_t i, std::size_t upto, std::vector<FandV_ct_ptr>& slots) const {
+    for(std::size_t k=0; k<upto; k++) {
+      const instr& c = code[k];
+      switch(c.op) {
+        case FandV_LZ_LEAF:
+          slots[k] = (*inputs[c.a])[i % inputs[c.a]->size()];
+          break;
+        case FandV_LZ_ADD:
+          slots[k] = std::make_shared<const FandV_ct>(slots[c.a]->add(*slots[c.b]));
+          break;
+        case FandV_LZ_SUB:
+          slots[k] = std::make_shared<const FandV_ct>(slots[c.a]->sub(*slots[c.b]));
+          break;
+        default:
+          slots[k] = std::make_shared<const FandV_ct>(slots[c.a]->mul(*slots[c.b]));
+          break;
+      }
+    }
+  }
+  // Kind and number of operations per element, for scheduling
+  FandV_sched_op cost(double& per) const {
+    per = muls > 0 ? muls : code.size();
+    return(muls > 0 ? FandV_OP_MUL : FandV_OP_ADD);
+  }
+};
+
+struct FandV_LazyMap : public Worker {
+  const FandV_lazy_prog* prog;
+  std::vector<FandV_ct_ptr>* output;
+
+  FandV_LazyMap(const FandV_lazy_prog* prog_, std::vector<FandV_ct_ptr>* output_) : prog(prog_), output(output_) { }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    std::vector<FandV_ct_ptr> slots(prog->code.size());
+    for(std::size_t i=begin; i<end; i++) {
+      prog->run(i, slots.size(), slots);
+      output->at(i) = slots.back();
+    }
+  }
+};
+
+// Sum over the elements of a program.  If the last instruction is a product,
+// the unrelinearised tensors are summed (relinearisation being linear) and the
+// total relinearised once at the end.
+struct FandV_LazySum : public Worker {
+  const FandV_lazy_prog* prog;
+  bool deferred;
+
+  // Accumulated value, relinearisation deferred when the last op is a product
+  FandV_tensor_acc acc;
+
+  FandV_LazySum(const FandV_lazy_prog* prog_) : prog(prog_), deferred(prog_->code.back().op == FandV_LZ_MUL) { }
+  FandV_LazySum(const FandV_LazySum& s, Split) : prog(s.prog), deferred(s.deferred) { }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    std::vector<FandV_ct_ptr> slots(prog->code.size());
+    fmpz_polyxx d0, d1, d2;
+    for(std::size_t i=begin; i<end; i++) {
+      if(!deferred) {
+        prog->run(i, slots.size(), slots);
+        acc.add(*slots.back());
+        continue;
+      }
+
+      prog->run(i, slots.size()-1, slots);
+      const FandV_lazy_prog::instr& c = prog->code.back();
+      const FandV_ct &a = *slots[c.a], &b = *slots[c.b];
+      a.tensor(b, d0, d1, d2);
+      acc.add(a, b, d0, d1, d2);
+    }
+  }
+
+  void join(FandV_LazySum& rhs) {
+    acc.join(rhs.acc);
+  }
+
+  FandV_ct_ptr result() {
+    return(acc.result());
+  }
+};
+
+// One level of a balanced product tree: pairs (2i, 2i+1) into element i
+struct FandV_LazyPair : public Worker {
+  const std::vector<FandV_ct_ptr>* input;
+  std::vector<FandV_ct_ptr>* output;
+
+  FandV_LazyPair(const std::vector<FandV_ct_ptr>* input_, std::vector<FandV_ct_ptr>* output_) : input(input_), output(output_) { }
+
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i=begin; i<end; i++) {
+      if(2*i+1 < input->size()) {
+        output->at(i) = std::make_shared<const FandV_ct>(input->at(2*i)->mul(*input->at(2*i+1)));
+      } else {
+        output->at(i) = input->at(2*i);
+      }
+    }
+  }
+};
+
+//// Evaluation ////
+class FandV_lazy_eval {
+  public:
+    FandV_lazy_eval(const FandV_lazy_ptr& root_) : root(root_) { }
+
+    void run() {
+      count();
+      rebalance(root);
+      count();
+      mark();
+      countUses(root.get()); // Every consumer of a formed value, before anything is run
+      evaluate(root.get());
+    }
+
+  private:
+    // Number of parents of each node within the graph
+    void count() {
+      parents.clear();
+      std::unordered_set<FandV_lazy_node*> seen;
+      count(root.get(), seen);
+    }
+    void count(FandV_lazy_node* n, std::unordered_set<FandV_lazy_node*>& seen) {
+      if(!seen.insert(n).second || n->op == FandV_LZ_LEAF)
+        return;
+      for(unsigned int i=0; i<n->args.size(); i++) {
+        parents[n->args[i].get()]++;
+        count(n->args[i].get(), seen);
+      }
+    }
+
+    // Flatten chains of multiplications whose intermediate results are used
+    // nowhere else, then rebuild them as balanced trees
+    void rebalance(const FandV_lazy_ptr& n) {
+      if(!balanced.insert(n.get()).second || n->op == FandV_LZ_LEAF)
+        return;
+      for(unsigned int i=0; i<n->args.size(); i++)
+        rebalance(n->args[i]);
+      if(n->op != FandV_LZ_MUL)
+        return;
+
+      std::vector<FandV_lazy_ptr> ops;
+      flatten(n, n->size(), ops);
+      if(ops.size() <= 2)
+        return;
+      // Regrouping only gives the same elements if every length divides the
+      // result's, so that recycling does not depend on the grouping
+      for(unsigned int i=0; i<ops.size(); i++) {
+        if(ops[i]->size() == 0 || n->size() % ops[i]->size() != 0)
+          return;
+      }
+      std::size_t mid = ops.size()/2;
+      n->args.clear();
+      n->args.push_back(build(ops, 0, mid));
+      n->args.push_back(build(ops, mid, ops.size()));
+    }
+    void flatten(const FandV_lazy_ptr& n, std::size_t len, std::vector<FandV_lazy_ptr>& ops) {
+      for(unsigned int i=0; i<n->args.size(); i++) {
+        const FandV_lazy_ptr& a = n->args[i];
+        if(a->op == FandV_LZ_MUL && parents[a.get()] == 1 && a->value.empty() && a->size() == len) {
+          flatten(a, len, ops);
+        } else {
+          ops.push_back(a);
+        }
+      }
+    }
+    FandV_lazy_ptr build(const std::vector<FandV_lazy_ptr>& ops, std::size_t lo, std::size_t hi) {
+      if(hi-lo == 1)
+        return(ops[lo]);
+      std::size_t mid = (lo+hi)/2;
+      return(FandV_lazy_make(FandV_LZ_MUL, build(ops, lo, mid), build(ops, mid, hi)));
+    }
+
+    // Decide which nodes have their values formed: the root, leaves, matrix
+    // products and their arguments, reductions, and any element-wise node
+    // reached from more than one fused region
+    void mark() {
+      std::vector<FandV_lazy_node*> all;
+      std::unordered_set<FandV_lazy_node*> seen;
+      FandV_lazy_reach(root.get(), seen);
+      all.assign(seen.begin(), seen.end());
+
+      formed.clear();
+      formed.insert(root.get());
+      for(unsigned int i=0; i<all.size(); i++) {
+        FandV_lazy_node* n = all[i];
+        if(n->op == FandV_LZ_LEAF || n->op == FandV_LZ_SUM || n->op == FandV_LZ_PROD || n->op == FandV_LZ_MATMUL)
+          formed.insert(n);
+        if(n->op == FandV_LZ_MATMUL) {
+          formed.insert(n->args[0].get());
+          formed.insert(n->args[1].get());
+        }
+      }
+
+      bool changed = true;
+      while(changed) {
+        changed = false;
+        owner.clear();
+        for(unsigned int i=0; i<all.size(); i++) {
+          FandV_lazy_node* n = all[i];
+          if(formed.count(n) == 0 || n->op == FandV_LZ_LEAF)
+            continue;
+          if(n->elementwise()) {
+            changed = assign(n, n, true) || changed;
+          } else if(n->op == FandV_LZ_SUM || n->op == FandV_LZ_PROD) {
+            changed = assign(n->args[0].get(), n, false) || changed;
+          }
+        }
+      }
+    }
+    bool assign(FandV_lazy_node* n, FandV_lazy_node* region, bool top) {
+      if(!top && formed.count(n) > 0)
+        return(false);
+      std::unordered_map<FandV_lazy_node*, FandV_lazy_node*>::iterator it = owner.find(n);
+      if(it != owner.end()) {
+        if(it->second == region)
+          return(false);
+        formed.insert(n);
+        return(true);
+      }
+      owner[n] = region;
+      bool changed = false;
+      for(unsigned int i=0; i<n->args.size(); i++)
+        changed = assign(n->args[i].get(), region, false) || changed;
+      return(changed);
+    }
+
+    // Formed values a node's computation reads directly
+    std::vector<FandV_lazy_node*>& inputs(FandV_lazy_node* n) {
+      std::unordered_map<FandV_lazy_node*, std::vector<FandV_lazy_node*> >::iterator it = deps.find(n);
+      if(it != deps.end())
+        return(it->second);
+      std::vector<FandV_lazy_node*>& d = deps[n];
+      std::unordered_set<FandV_lazy_node*> seen;
+      if(n->op == FandV_LZ_MATMUL) {
+        d.push_back(n->args[0].get());
+        if(n->args[1] != n->args[0]) d.push_back(n->args[1].get());
+      } else if(n->op != FandV_LZ_LEAF) {
+        for(unsigned int i=0; i<n->args.size(); i++)
+          boundary(n->args[i].get(), seen, d);
+      }
+      return(d);
+    }
+    void boundary(FandV_lazy_node* n, std::unordered_set<FandV_lazy_node*>& seen, std::vector<FandV_lazy_node*>& d) {
+      if(!seen.insert(n).second)
+        return;
+      if(formed.count(n) > 0) {
+        d.push_back(n);
+        return;
+      }
+      for(unsigned int i=0; i<n->args.size(); i++)
+        boundary(n->args[i].get(), seen, d);
+    }
+
+    // Peak number of cipher texts held while forming n, computing its inputs in
+    // the order which minimises it (largest excess over their own size first)
+    double need(FandV_lazy_node* n) {
+      std::unordered_map<FandV_lazy_node*, double>::iterator it = needs.find(n);
+      if(it != needs.end())
+        return(it->second);
+      double peak = n->value.empty() ? (double) n->size() : 0.0;
+      if(n->value.empty()) {
+        const std::vector<FandV_lazy_node*>& d = order(n);
+        double held = 0.0;
+        for(unsigned int i=0; i<d.size(); i++) {
+          peak = std::max(peak, held + need(d[i]));
+          if(d[i]->op != FandV_LZ_LEAF) held += d[i]->size();
+        }
+        peak = std::max(peak, held + n->size());
+      }
+      needs[n] = peak;
+      return(peak);
+    }
+    const std::vector<FandV_lazy_node*>& order(FandV_lazy_node* n) {
+      std::vector<FandV_lazy_node*>& d = inputs(n);
+      std::vector< std::pair<double, FandV_lazy_node*> > key;
+      for(unsigned int i=0; i<d.size(); i++)
+        key.push_back(std::make_pair(need(d[i]) - d[i]->size(), d[i]));
+      std::stable_sort(key.begin(), key.end(), [](const std::pair<double, FandV_lazy_node*>& a, const std::pair<double, FandV_lazy_node*>& b) { return(a.first > b.first); });
+      for(unsigned int i=0; i<d.size(); i++)
+        d[i] = key[i].second;
+      return(d);
+    }
+
+    void evaluate(FandV_lazy_node* n) {
+      if(!n->value.empty() || n->op == FandV_LZ_LEAF)
+        return;
+      const std::vector<FandV_lazy_node*>& d = order(n);
+      for(unsigned int i=0; i<d.size(); i++)
+        evaluate(d[i]);
+
+      if(n->op == FandV_LZ_MATMUL) {
+        matmul(n);
+      } else {
+        FandV_lazy_prog prog;
+        std::unordered_map<FandV_lazy_node*, int> slot;
+        compile(n->elementwise() ? n : n->args[0].get(), n->elementwise(), prog, slot);
+        if(n->op == FandV_LZ_SUM) {
+          sum(n, prog);
+        } else if(n->op == FandV_LZ_PROD) {
+          prod(n, prog);
+        } else {
+          map(n, prog);
+        }
+      }
+
+      // Drop intermediate values once their last consumer has run
+      for(unsigned int i=0; i<d.size(); i++) {
+        if(--uses[d[i]] == 0 && d[i]->op != FandV_LZ_LEAF && d[i] != root.get())
+          std::vector<FandV_ct_ptr>().swap(d[i]->value);
+      }
+    }
+    void countUses(FandV_lazy_node* n) {
+      if(!counted.insert(n).second || n->op == FandV_LZ_LEAF)
+        return;
+      const std::vector<FandV_lazy_node*>& d = inputs(n);
+      for(unsigned int i=0; i<d.size(); i++) {
+        uses[d[i]]++;
+        countUses(d[i]);
+      }
+    }
+
+    int compile(FandV_lazy_node* n, bool top, FandV_lazy_prog& prog, std::unordered_map<FandV_lazy_node*, int>& slot) {
+      std::unordered_map<FandV_lazy_node*, int>::iterator it = slot.find(n);
+      if(it != slot.end())
+        return(it->second);
+      FandV_lazy_prog::instr c;
+      if(!top && formed.count(n) > 0) {
+        c.op = FandV_LZ_LEAF;
+        c.a = prog.inputs.size();
+        c.b = 0;
+        prog.inputs.push_back(&n->value);
+      } else {
+        c.op = n->op;
+        c.a = compile(n->args[0].get(), false, prog, slot);
+        c.b = compile(n->args[1].get(), false, prog, slot);
+        if(c.op == FandV_LZ_MUL) prog.muls++;
+      }
+      prog.code.push_back(c);
+      slot[n] = prog.code.size()-1;
+      return(prog.code.size()-1);
+    }
+    const FandV_par& par(const FandV_lazy_prog& prog) {
+      return(prog.inputs[0]->at(0)->p);
+    }
+
+    void map(FandV_lazy_node* n, const FandV_lazy_prog& prog) {
+      n->value.resize(n->size());
+      FandV_LazyMap w(&prog, &n->value);
+      double per;
+      FandV_sched_op op = prog.cost(per);
+      FandV_parallelFor(op, par(prog), 0, n->size(), w, per);
+    }
+    void sum(FandV_lazy_node* n, const FandV_lazy_prog& prog) {
+      FandV_LazySum s(&prog);
+      double per;
+      FandV_sched_op op = prog.cost(per);
+      FandV_parallelReduce(op, par(prog), 0, n->args[0]->size(), s, per);
+      n->value.assign(1, s.result());
+    }
+    void prod(FandV_lazy_node* n, const FandV_lazy_prog& prog) {
+      std::vector<FandV_ct_ptr> cur(n->args[0]->size()), nxt;
+      FandV_LazyMap w(&prog, &cur);
+      double per;
+      FandV_sched_op op = prog.cost(per);
+      FandV_parallelFor(op, par(prog), 0, cur.size(), w, per);
+      while(cur.size() > 1) {
+        nxt.resize((cur.size()+1)/2);
+        FandV_LazyPair pair(&cur, &nxt);
+        FandV_parallelFor(FandV_OP_MUL, cur[0]->p, 0, nxt.size(), pair);
+        cur.swap(nxt);
+      }
+      n->value = cur;
+    }
+    void matmul(FandV_lazy_node* n) {
+      const FandV_lazy_node &x = *n->args[0], &y = *n->args[1];
+      int xr, xc, yr, yc;
+      FandV_lazy_dims(x, y, xr, xc, yr, yc);
+      FandV_ct_mat xm(x.value, xr, xc), ym(y.value, yr, yc);
+      FandV_ct_mat res(xm.matmulParallel(ym));
+      n->value.swap(res.mat);
+    }
+
+    FandV_lazy_ptr root;
+    std::unordered_map<FandV_lazy_node*, int> parents;
+    std::unordered_set<FandV_lazy_node*> balanced, formed, counted;
+    std::unordered_map<FandV_lazy_node*, FandV_lazy_node*> owner;
+    std::unordered_map<FandV_lazy_node*, std::vector<FandV_lazy_node*> > deps;
+    std::unordered_map<FandV_lazy_node*, double> needs;
+    std::unordered_map<FandV_lazy_node*, int> uses;
+};
+
+void FandV_lazy::compute() {
+  if(node->op == FandV_LZ_LEAF)
+    return;
+  FandV_lazy_eval ev(node);
+  ev.run();
+  node->op = FandV_LZ_LEAF;
+  node->args.clear();
+}
+
+FandV_ct FandV_lazy::getCt() {
+  compute();
+  if(node->kind != FandV_LZ_CT || node->value.size() != 1) {
+    Rcout << "Error: lazy expression is not a cipher text\n";
+    return(FandV_ct(FandV_par(), NULL, 0));
+  }
+  return(*(node->value[0]));
+}
+FandV_ct_vec FandV_lazy::getVec() {
+  compute();
+  return(FandV_ct_vec(node->value));
+}
+FandV_ct_mat FandV_lazy::getMat() {
+  compute();
+  return(FandV_ct_mat(node->value, node->nrow, node->ncol));
+}
+
+void FandV_lazy::show() const {
+  Rcout << "Fan and Vercauteren lazy ";
+  switch(node->kind) {
+    case FandV_LZ_CT:
+      Rcout << "cipher text";
+      break;
+    case FandV_LZ_VEC:
+      Rcout << "vector of " << node->nrow << " cipher texts";
+      break;
+    case FandV_LZ_MAT:
+      Rcout << node->nrow << " x " << node->ncol << " matrix of cipher texts";
+      break;
+  }
+  int n = pending();
+  if(n > 0) {
+    Rcout << " (" << n << " operation" << (n > 1 ? "s" : "") << " pending)\n";
+  } else {
+    Rcout << " (computed)\n";
+  }
+}
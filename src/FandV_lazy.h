@@ -0,0 +1,105 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_lazy_H
+#define FandV_lazy_H
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "FandV_ct.h"
+
+class FandV_ct_vec;
+class FandV_ct_mat;
+
+// Operations recorded in a lazy expression graph
+enum FandV_lazy_op {
+  FandV_LZ_LEAF = 0, // a value: cipher text, vector or matrix
+  FandV_LZ_ADD,      // element-wise, recycling the shorter argument
+  FandV_LZ_SUB,
+  FandV_LZ_MUL,
+  FandV_LZ_SUM,      // reductions over all elements to a cipher text
+  FandV_LZ_PROD,
+  FandV_LZ_MATMUL    // matrix product, vectors acting as a column
+};
+
+// Shape of a node's value
+enum FandV_lazy_kind {
+  FandV_LZ_CT = 0,
+  FandV_LZ_VEC,
+  FandV_LZ_MAT
+};
+
+struct FandV_lazy_node {
+  FandV_lazy_op op;
+  FandV_lazy_kind kind;
+  int nrow, ncol; // Vectors are nrow x 1
+  std::vector< std::shared_ptr<FandV_lazy_node> > args;
+  std::vector<FandV_ct_ptr> value; // Held by leaves, and by other nodes only while computing
+
+  std::size_t size() const { return((std::size_t) nrow*ncol); }
+  bool elementwise() const { return(op == FandV_LZ_ADD || op == FandV_LZ_SUB || op == FandV_LZ_MUL); }
+};
+
+// Handle to a node of a lazy expression graph.  Operations only record a node;
+// compute() evaluates the graph reachable from here:
+//  - chains of multiplications are rebalanced into trees, so their depth grows
+//    with the log of their length;
+//  - each maximal element-wise subexpression, plus any sum or product over it,
+//    is fused into one pass over the elements so intermediate vectors are
+//    never formed, with common subexpressions evaluated once per element;
+//  - sums of products are accumulated before relinearisation, which is then
+//    done once per result rather than once per product;
+//  - the values which must be formed (matrix products, shared subexpressions)
+//    are computed largest first and freed as soon as their last consumer has
+//    run, so the peak memory held is kept down.
+// Once computed, the node becomes a leaf holding its value.
+class FandV_lazy {
+  public:
+    // Constructors
+    FandV_lazy();
+    FandV_lazy(const FandV_lazy& x);
+
+    // Record an operation
+    FandV_lazy add(const FandV_lazy& y) const;
+    FandV_lazy sub(const FandV_lazy& y) const;
+    FandV_lazy mul(const FandV_lazy& y) const;
+    FandV_lazy pow(int k) const;
+    FandV_lazy sum() const;
+    FandV_lazy prod() const;
+    FandV_lazy matmul(const FandV_lazy& y) const;
+
+    // Shape
+    std::string kind() const;
+    int size() const;
+    int nrow() const;
+    int ncol() const;
+    int pending() const; // Operations not yet computed
+
+    // Evaluate
+    void compute();
+    FandV_ct getCt();
+    FandV_ct_vec getVec();
+    FandV_ct_mat getMat();
+
+    // Print out
+    void show() const;
+
+    std::shared_ptr<FandV_lazy_node> node;
+
+  private:
+    FandV_lazy(FandV_lazy_op op, const FandV_lazy& x, const FandV_lazy& y);
+};
+
+// Start a graph from a value
+FandV_lazy lazy_FandV_ct(const FandV_ct& ct);
+FandV_lazy lazy_FandV_vec(const FandV_ct_vec& ct_vec);
+FandV_lazy lazy_FandV_mat(const FandV_ct_mat& ct_mat);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <atomic>
+#include <thread>
+
+#include "FandV_mem.h"
+
+static std::atomic<long long> FandV_mem_bytes(0);
+static std::atomic<long long> FandV_mem_atgc(0); // Live bytes just after the last collection
+static std::atomic<long long> FandV_mem_gcbytes(256LL*1048576LL);
+static std::atomic<bool> FandV_mem_wanted(false);
+static std::atomic<int> FandV_mem_busy(0); // Parallel regions and helper threads running
+static const std::thread::id FandV_mem_main = std::this_thread::get_id(); // Library is loaded by R's thread
+static bool FandV_mem_ingc = false;
+
+void FandV_mem_add(std::size_t bytes) {
+  long long live = (FandV_mem_bytes += bytes);
+  if(live - FandV_mem_atgc.load() > FandV_mem_gcbytes.load())
+    FandV_mem_wanted = true;
+}
+void FandV_mem_sub(std::size_t bytes) {
+  long long live = (FandV_mem_bytes -= bytes);
+  // Keep the baseline no higher than what is live, so the next collection is
+  // triggered by growth rather than never
+  long long atgc = FandV_mem_atgc.load();
+  while(live < atgc && !FandV_mem_atgc.compare_exchange_weak(atgc, live)) { }
+}
+void FandV_mem_service() {
+  if(!FandV_mem_wanted.load() || FandV_mem_busy.load() > 0 || FandV_mem_ingc || std::this_thread::get_id() != FandV_mem_main)
+    return;
+  FandV_mem_ingc = true;
+  FandV_mem_wanted = false;
+  R_gc();
+  FandV_mem_atgc = FandV_mem_bytes.load();
+  FandV_mem_ingc = false;
+}
+FandV_mem_hold::FandV_mem_hold() {
+  FandV_mem_busy++;
+}
+FandV_mem_hold::~FandV_mem_hold() {
+  FandV_mem_busy--;
+}
+double FandV_mem_live() {
+  return((double) FandV_mem_bytes.load());
+}
+void FandV_mem_threshold(double bytes) {
+  FandV_mem_gcbytes = (long long) bytes;
+}
@@ -0,0 +1,28 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_mem_H
+#define FandV_mem_H
+
+#include <cstddef>
+
+// Running total of the bytes held by live cipher texts.  R only sees the small
+// external pointers wrapping them, so once the total has grown by more than a
+// threshold since the last collection a collection is marked as wanted, to
+// finalise unreachable cipher texts.  Cipher texts are created inside parallel
+// kernels and helper threads, so the collection itself is only run by
+// FandV_mem_service, called on R's thread once no kernel or helper is running.
+void FandV_mem_add(std::size_t bytes);
+void FandV_mem_sub(std::size_t bytes);
+void FandV_mem_service();
+// Held for the life of a parallel region or helper thread to put off collection
+struct FandV_mem_hold {
+  FandV_mem_hold();
+  ~FandV_mem_hold();
+};
+double FandV_mem_live();
+void FandV_mem_threshold(double bytes);
+
+#endif
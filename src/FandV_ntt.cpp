@@ -0,0 +1,184 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include "FandV_ntt.h"
+
+// Primes are taken below 2^61, so a sum of two residues fits in a word and the
+// digits in the CRT need at most one subtraction to move between primes
+#define FandV_NTT_PRIMEBITS 61
+
+static int FandV_bitrev(int k, int logd) {
+  int r = 0;
+  for(int i=0; i<logd; i++) {
+    r = (r << 1) | (k & 1);
+    k >>= 1;
+  }
+  return(r);
+}
+
+FandV_ntt::FandV_ntt(int d_, int bits) : d(d_), M(1) {
+  int logd = 0;
+  while((1 << logd) < d)
+    logd++;
+
+  // Largest primes m = 1 mod 2d below 2^61 until their product exceeds
+  // 2^(bits+1), so centred coefficients up to 2^bits are recovered exactly
+  ulong step = 2*(ulong) d;
+  ulong m = (((UWORD(1) << FandV_NTT_PRIMEBITS) - 1)/step)*step + 1;
+  while(fmpz_bits(M._fmpz()) <= (mp_bitcnt_t) bits+1) {
+    while(!n_is_prime(m))
+      m -= step;
+
+    prime P;
+    P.m = m;
+    P.minv = n_preinvert_limb(m);
+    P.dinv = n_invmod(d, m);
+    ulong psi = n_powmod2_preinv(n_primitive_root_prime(m), (m-1)/step, m, P.minv);
+    ulong psiinv = n_invmod(psi, m);
+    std::vector<ulong> pw(d), pwi(d);
+    pw[0] = pwi[0] = 1;
+    for(int k=1; k<d; k++) {
+      pw[k] = n_mulmod2_preinv(pw[k-1], psi, m, P.minv);
+      pwi[k] = n_mulmod2_preinv(pwi[k-1], psiinv, m, P.minv);
+    }
+    P.w.resize(d);
+    P.wi.resize(d);
+    for(int k=0; k<d; k++) {
+      P.w[k] = pw[FandV_bitrev(k, logd)];
+      P.wi[k] = pwi[FandV_bitrev(k, logd)];
+    }
+
+    std::vector<ulong> inv(primes.size());
+    for(unsigned int k=0; k<primes.size(); k++)
+      inv[k] = n_invmod(primes[k].m % m, m);
+    garner.push_back(inv);
+
+    primes.push_back(P);
+    M = M*fmpzxx(m);
+    m -= step;
+  }
+  Mo2 = M/2;
+}
+
+// Cooley-Tukey, natural order in and bit reversed order out, with the powers
+// of psi folded into the twiddles so no separate negacyclic weighting is needed
+void FandV_ntt::transform(ulong* a, const prime& P) const {
+  for(int m=1, t=d; m<d; m*=2) {
+    t /= 2;
+    for(int i=0; i<m; i++) {
+      ulong S = P.w[m+i];
+      ulong* x = a + 2*i*t;
+      for(int j=0; j<t; j++) {
+        ulong U = x[j], V = n_mulmod2_preinv(x[j+t], S, P.m, P.minv);
+        x[j] = n_addmod(U, V, P.m);
+        x[j+t] = n_submod(U, V, P.m);
+      }
+    }
+  }
+}
+
+// Gentleman-Sande, the exact inverse of transform()
+void FandV_ntt::untransform(ulong* a, const prime& P) const {
+  for(int m=d, t=1; m>1; m/=2) {
+    int h = m/2;
+    for(int i=0; i<h; i++) {
+      ulong S = P.wi[h+i];
+      ulong* x = a + 2*i*t;
+      for(int j=0; j<t; j++) {
+        ulong U = x[j], V = x[j+t];
+        x[j] = n_addmod(U, V, P.m);
+        x[j+t] = n_mulmod2_preinv(n_submod(U, V, P.m), S, P.m, P.minv);
+      }
+    }
+    t *= 2;
+  }
+  for(int j=0; j<d; j++) {
+    a[j] = n_mulmod2_preinv(a[j], P.dinv, P.m, P.minv);
+  }
+}
+
+void FandV_ntt::forward(const fmpz_polyxx& x, std::vector<ulong>& X) const {
+  X.resize(primes.size()*d);
+  forward(x, X.data());
+}
+void FandV_ntt::forward(const fmpz_polyxx& x, ulong* X) const {
+  const fmpz_poly_struct* xp = x._poly();
+  for(unsigned int k=0; k<primes.size(); k++) {
+    ulong* a = X + k*d;
+    for(int i=0; i<d; i++)
+      a[i] = 0;
+    for(slong i=0; i<xp->length && i<d; i++) {
+      a[i] = fmpz_fdiv_ui(xp->coeffs+i, primes[k].m);
+    }
+    transform(a, primes[k]);
+  }
+}
+void FandV_ntt::forward(const long* x, std::vector<ulong>& X) const {
+  X.resize(primes.size()*d);
+  for(unsigned int k=0; k<primes.size(); k++) {
+    ulong* a = &X[k*d];
+    for(int i=0; i<d; i++) {
+      a[i] = x[i] < 0 ? primes[k].m - (ulong) (-x[i]) : (ulong) x[i];
+    }
+    transform(a, primes[k]);
+  }
+}
+
+void FandV_ntt::mul(const std::vector<ulong>& X, const std::vector<ulong>& Y, std::vector<ulong>& Z) const {
+  mul(X.data(), Y, Z);
+}
+void FandV_ntt::mul(const ulong* X, const std::vector<ulong>& Y, std::vector<ulong>& Z) const {
+  Z.resize(primes.size()*d);
+  for(unsigned int k=0; k<primes.size(); k++) {
+    for(int i=k*d; i<(int) (k+1)*d; i++) {
+      Z[i] = n_mulmod2_preinv(X[i], Y[i], primes[k].m, primes[k].minv);
+    }
+  }
+}
+
+// Garner's algorithm: with digits v_k, x = v_0 + m_0(v_1 + m_1(v_2 + ...))
+void FandV_ntt::inverse(std::vector<ulong>& Z, fmpz_polyxx& res) const {
+  std::size_t K = primes.size();
+  for(unsigned int k=0; k<K; k++) {
+    untransform(&Z[k*d], primes[k]);
+  }
+
+  fmpz_poly_struct* rp = res._poly();
+  fmpz_poly_fit_length(rp, d);
+  _fmpz_poly_set_length(rp, d);
+  std::vector<ulong> v(K);
+  for(int i=0; i<d; i++) {
+    for(unsigned int j=0; j<K; j++) {
+      const prime& P = primes[j];
+      ulong r = Z[j*d+i];
+      for(unsigned int k=0; k<j; k++) {
+        ulong vk = v[k] >= P.m ? v[k]-P.m : v[k];
+        r = n_mulmod2_preinv(n_submod(r, vk, P.m), garner[j][k], P.m, P.minv);
+      }
+      v[j] = r;
+    }
+    fmpz* c = rp->coeffs+i;
+    fmpz_set_ui(c, v[K-1]);
+    for(int k=K-2; k>=0; k--) {
+      fmpz_mul_ui(c, c, primes[k].m);
+      fmpz_add_ui(c, c, v[k]);
+    }
+    if(fmpz_cmp(c, Mo2._fmpz()) > 0)
+      fmpz_sub(c, c, M._fmpz());
+  }
+  _fmpz_poly_normalise(rp);
+}
+
+// Memory
+double FandV_ntt::memoryUsage() const {
+  double bytes = sizeof(FandV_ntt) + primes.capacity()*sizeof(prime);
+  for(unsigned int k=0; k<primes.size(); k++) {
+    bytes += (primes[k].w.capacity() + primes[k].wi.capacity() + garner[k].capacity())*sizeof(ulong);
+  }
+  return(bytes);
+}
@@ -0,0 +1,57 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_ntt_H
+#define FandV_ntt_H
+
+#include <flint/fmpzxx.h>
+#include <flint/fmpz_polyxx.h>
+#include <flint/ulong_extras.h>
+using namespace flint;
+
+#include <vector>
+
+// Negacyclic number theoretic transforms for exact products in Z[x]/(x^d+1),
+// d a power of two.  Each polynomial is held as its residues modulo a few word
+// sized primes m = 1 mod 2d (RNS form), transformed so that a product in the
+// ring is a pointwise product of residues; the inverse transform returns the
+// exact integer coefficients by CRT.  There are enough primes for coefficients
+// of the product up to 2^bits in absolute value.
+class FandV_ntt {
+  public:
+    // Constructors
+    FandV_ntt(int d_, int bits);
+
+    // Transform of x (length at most d), a block of d residues per prime
+    void forward(const fmpz_polyxx& x, std::vector<ulong>& X) const;
+    void forward(const fmpz_polyxx& x, ulong* X) const; // ... into size() words
+    void forward(const long* x, std::vector<ulong>& X) const; // ... x holds d small integers
+    // Z = X*Y in the ring, in transform form
+    void mul(const std::vector<ulong>& X, const std::vector<ulong>& Y, std::vector<ulong>& Z) const;
+    void mul(const ulong* X, const std::vector<ulong>& Y, std::vector<ulong>& Z) const;
+    // Words in a transform
+    std::size_t size() const { return(primes.size()*d); }
+    // Back to coefficients: res <- the centred CRT of each coefficient ... overwrites Z
+    void inverse(std::vector<ulong>& Z, fmpz_polyxx& res) const;
+
+    // Memory
+    double memoryUsage() const;
+
+    int d;
+
+  private:
+    struct prime {
+      ulong m, minv, dinv;
+      std::vector<ulong> w, wi; // Powers of psi and psi^-1 in bit reversed order, psi^d = -1
+    };
+    void transform(ulong* a, const prime& P) const;
+    void untransform(ulong* a, const prime& P) const;
+
+    std::vector<prime> primes;
+    std::vector< std::vector<ulong> > garner; // garner[j][k] = m_k^-1 mod m_j, k < j
+    fmpzxx M, Mo2; // Product of the primes, and half of it
+};
+
+#endif
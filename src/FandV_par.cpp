@@ -7,14 +7,19 @@
 using namespace Rcpp;
 
 #include <flint/arith.h>
+#include <random>
+#include <cmath>
+#include <stdexcept>
 #include "getline.h"
 
 #include "FandV_par.h"
 #include "FandV.h"
 #include "FandV_keys.h"
+#include "FandV_prof.h"
+#include "FandV_sched.h"
 
 // Construct from parameters
-FandV_par::FandV_par(int d_, double sigma_, int qpow_, std::string t_, int lambda_, int L_) : sigma(sigma_), qpow(qpow_), q(1), t(t_.c_str()), T(1), lambda(lambda_), L(L_) {
+FandV_par::FandV_par(int d_, double sigma_, int qpow_, std::string t_, int lambda_, int L_) : sigma(sigma_), qpow(qpow_), q(1), t(t_.c_str()), T(1), lambda(lambda_), L(L_), encoding(FandV_BINARY), base(2), fracbits(0) {
   arith_cyclotomic_polynomial(Phi._data().inner, 2*d_); // Phi is 2d-th Cyclotomic polynomial
   
   q = q << qpow; // q=2^qpow
@@ -23,19 +28,27 @@ FandV_par::FandV_par(int d_, double sigma_, int qpow_, std::string t_, int lambd
 }
 
 // Copy constructor
-FandV_par::FandV_par(const FandV_par& par) : sigma(par.sigma), qpow(par.qpow), q(par.q), t(par.t), T(par.T), Delta(par.Delta), Phi(par.Phi), lambda(par.lambda), L(par.L) { }
+FandV_par::FandV_par(const FandV_par& par) : sigma(par.sigma), qpow(par.qpow), q(par.q), t(par.t), T(par.T), Delta(par.Delta), Phi(par.Phi), lambda(par.lambda), L(par.L), encoding(par.encoding), base(par.base), fracbits(par.fracbits) { }
 
-// Swap function
+// Move constructor (takes over the FLINT storage of par, leaving it empty)
+FandV_par::FandV_par(FandV_par&& par) : sigma(0), qpow(0), lambda(0), L(0), encoding(FandV_BINARY), base(2), fracbits(0) {
+  swap(*this, par);
+}
+
+// Swap function.  FLINT objects are swapped by pointer, not by copying limbs
 void FandV_par::swap(FandV_par& a, FandV_par& b) {
   std::swap(a.sigma, b.sigma);
   std::swap(a.qpow, b.qpow);
-  std::swap(a.q, b.q);
-  std::swap(a.t, b.t);
-  std::swap(a.T, b.T);
-  std::swap(a.Delta, b.Delta);
-  std::swap(a.Phi, b.Phi);
+  fmpz_swap(a.q._fmpz(), b.q._fmpz());
+  fmpz_swap(a.t._fmpz(), b.t._fmpz());
+  fmpz_swap(a.T._fmpz(), b.T._fmpz());
+  fmpz_swap(a.Delta._fmpz(), b.Delta._fmpz());
+  fmpz_poly_swap(a.Phi._poly(), b.Phi._poly());
   std::swap(a.lambda, b.lambda);
   std::swap(a.L, b.L);
+  std::swap(a.encoding, b.encoding);
+  std::swap(a.base, b.base);
+  std::swap(a.fracbits, b.fracbits);
 }
 
 // Assignment (copy-and-swap idiom)
@@ -45,11 +58,30 @@ FandV_par& FandV_par::operator=(FandV_par par) {
 }
 
 // Print
+// Memory
+double FandV_par::memoryUsage() const {
+  return(sizeof(FandV_par) + fmpzxx_bytes(q) + fmpzxx_bytes(t) + fmpzxx_bytes(T) + fmpzxx_bytes(Delta) + fmpz_polyxx_bytes(Phi));
+}
+std::size_t FandV_par::ctBytes() const {
+  // Two polynomials of Phi.length() coefficients reduced mod q, which are
+  // multiprecision once q exceeds a small fmpz
+  std::size_t coef = sizeof(fmpz);
+  if(qpow > FLINT_BITS-2)
+    coef += sizeof(__mpz_struct) + (qpow/FLINT_BITS+1)*sizeof(mp_limb_t);
+  return(2*Phi.length()*coef);
+}
+
 void FandV_par::show() {
   Rcout << "Fan and Vercauteren parameters\n";
   Rcout << "\u03d5 = ";
   printPoly(Phi);
   Rcout << "\nq = " << q << " (" << qpow << "-bit integer)\nt = " << t << "\n\u0394 = " << Delta << "\n\u03c3 = " << sigma << "\nSecurity level \u2248 " << lambda << "-bits\nSupports multiplicative depth of " << L << " with overwhelming probability (i.e. lower bound, likely more possible)\n";
+  Rcout << "Plaintext encoding: " << get_encoding();
+  if(encoding == FandV_BALANCED)
+    Rcout << " (base " << base << ")";
+  if(encoding == FandV_FRACTIONAL)
+    Rcout << " (" << fracbits << " fractional bits)";
+  Rcout << "\n";
 }
 void FandV_par::show_no_t() {
   Rcout << "\u03d5 = ";
@@ -62,6 +94,178 @@ void FandV_par::show_t() {
 std::string FandV_par::get_t() {
   return(t.to_string());
 }
+std::string FandV_par::get_encoding() {
+  switch(encoding) {
+    case FandV_NAF: return("naf");
+    case FandV_BALANCED: return("balanced");
+    case FandV_FRACTIONAL: return("fractional");
+  }
+  return("binary");
+}
+
+// Plaintext encoding: the encoder divides by base and the fractional digits
+// must stay in the top half of the polynomial, so anything else is refused
+static bool FandV_encoding_ok(int encoding, int base, int fracbits, int d) {
+  if(encoding < FandV_BINARY || encoding > FandV_FRACTIONAL)
+    return(false);
+  if(encoding == FandV_BALANCED && base < 2)
+    return(false);
+  if(encoding == FandV_FRACTIONAL && (fracbits < 0 || fracbits >= d/2))
+    return(false);
+  return(true);
+}
+void FandV_par::setEncoding(int encoding_, int base_, int fracbits_) {
+  if(!FandV_encoding_ok(encoding_, base_, fracbits_, Phi.length()-1)) {
+    Rcout << "Error: invalid plaintext encoding\n";
+    return;
+  }
+  encoding = encoding_;
+  base = (encoding == FandV_BALANCED) ? base_ : 2;
+  fracbits = (encoding == FandV_FRACTIONAL) ? fracbits_ : 0;
+}
+void FandV_par::encode(fmpzxx m, fmpz_polyxx& mP) const {
+  int d = Phi.length()-1, sign = 1;
+  fmpzxx b(base), r, zero(0);
+  
+  mP.realloc(32);
+  if(m < zero) {
+    sign = -1;
+    m = -m;
+  }
+  for(int i=0; m != zero && i<d; i++) {
+    r = m%b;
+    if(encoding == FandV_NAF) {
+      // Odd m takes digit 2-(m mod 4) so that the next digit is always 0
+      if(r == fmpzxx(1))
+        r = fmpzxx(2) - m%fmpzxx(4);
+    } else if(encoding == FandV_BALANCED) {
+      if(r*fmpzxx(2) > b)
+        r -= b;
+    }
+    mP.set_coeff(i, r*fmpzxx(sign));
+    m = (m-r)/b;
+  }
+}
+void FandV_par::encodefrac(double m, fmpz_polyxx& mP) const {
+  int d = Phi.length()-1, sign = 1;
+  double ip, fp;
+  
+  if(m < 0.0) {
+    sign = -1;
+    m = -m;
+  }
+  if(!std::isfinite(m))
+    throw std::range_error("only finite values can be encoded");
+  fp = modf(m, &ip);
+  
+  // Integer part in binary from x^0 upwards, which must stay below x^(d/2)
+  // where the fractional digits begin ...
+  fmpzxx ipz;
+  fmpz_set_d(ipz._fmpz(), ip);
+  if(fmpz_bits(ipz._fmpz()) > (mp_bitcnt_t) d/2)
+    throw std::range_error("integer part too large for the fractional encoding, increase d");
+  encode(ipz, mP);
+  if(sign < 0)
+    mP = -mP;
+  // ... fractional part in binary from x^(d-1) downwards with negated digits
+  for(int k=1; k<=fracbits && k<d/2; k++) {
+    fp *= 2.0;
+    if(fp >= 1.0) {
+      mP.set_coeff(d-k, -sign);
+      fp -= 1.0;
+    }
+  }
+}
+std::string FandV_par::decode(const fmpz_polyxx& mP) const {
+  fmpzxx m(0), b(base);
+  int d = Phi.length()-1, len = mP.length();
+  
+  if(encoding != FandV_FRACTIONAL) {
+    for(int i=len-1; i>=0; i--) {
+      m = m*b + mP.get_coeff(i);
+    }
+    return(m.to_string());
+  }
+  
+  // Fractional: sum_{i<d/2} c_i 2^i - sum_{i>=d/2} c_i 2^-(d-i), accumulated
+  // over the common denominator 2^K and reduced at the end
+  int K = 0;
+  for(int i=d/2; i<len; i++) {
+    if(mP.get_coeff(i) != fmpzxx(0)) {
+      K = d-i;
+      break;
+    }
+  }
+  fmpzxx fr(0);
+  for(int i=std::min(len, d/2)-1; i>=0; i--) {
+    m = m*b + mP.get_coeff(i);
+  }
+  for(int i=len-1; i>=d-K; i--) {
+    fr = fr*b + mP.get_coeff(i);
+  }
+  m = (m << K) - fr;
+  while(K > 0 && m%b == fmpzxx(0)) {
+    m = m/b;
+    K--;
+  }
+  if(K == 0)
+    return(m.to_string());
+  return(m.to_string() + "/" + (fmpzxx(1) << K).to_string());
+}
+
+// Scale and round worker over a range of coefficients.  Each coefficient is
+// written in place, so tasks touch disjoint fmpz and need no locking.
+struct FandV_ScaleRound : public Worker {
+  fmpz* c;
+  const fmpz *t, *q, *m;
+  int qpow;
+  bool pow2, modq;
+  
+  FandV_ScaleRound(fmpz* c_, const fmpz* t_, const fmpz* q_, const fmpz* m_, int qpow_, bool pow2_, bool modq_) : c(c_), t(t_), q(q_), m(m_), qpow(qpow_), pow2(pow2_), modq(modq_) { }
+  
+  void operator()(std::size_t begin, std::size_t end) {
+    fmpz_t x, r, h, qo2, mo2;
+    fmpz_init(x); fmpz_init(r); fmpz_init(h); fmpz_init(qo2); fmpz_init(mo2);
+    // Rounding is half down, (t*x)%q > q/2 rounding up, so adding 2^(qpow-1)-1
+    // before the floor shift agrees exactly with the general path
+    fmpz_one(h);
+    fmpz_mul_2exp(h, h, qpow-1);
+    fmpz_sub_ui(h, h, 1);
+    fmpz_fdiv_q_2exp(qo2, q, 1);
+    fmpz_fdiv_q_2exp(mo2, m, 1);
+    
+    for(std::size_t i=begin; i<end; i++) {
+      fmpz_mul(x, c+i, t);
+      if(pow2) {
+        fmpz_add(x, x, h);
+        fmpz_fdiv_q_2exp(x, x, qpow);
+      } else {
+        fmpz_fdiv_qr(x, r, x, q);
+        if(fmpz_cmp(r, qo2) > 0)
+          fmpz_add_ui(x, x, 1);
+      }
+      if(pow2 && modq)
+        fmpz_fdiv_r_2exp(x, x, qpow);
+      else
+        fmpz_mod(x, x, m);
+      if(fmpz_cmp(x, mo2) > 0)
+        fmpz_sub(x, x, m);
+      fmpz_swap(c+i, x);
+    }
+    
+    fmpz_clear(x); fmpz_clear(r); fmpz_clear(h); fmpz_clear(qo2); fmpz_clear(mo2);
+  }
+};
+
+// With q = 2^qpow the division by q and reduction mod q are shifts, so each
+// coefficient costs one multiply, one add and two shifts in a single pass.
+// Any other q takes the general floor division.
+void FandV_par::scaleRound(fmpz_polyxx& x, const fmpzxx& m) const {
+  bool pow2 = qpow > 0 && q == (fmpzxx(1) << qpow);
+  FandV_ScaleRound w(x._poly()->coeffs, t._fmpz(), q._fmpz(), m._fmpz(), qpow, pow2, m == q);
+  FandV_parallelFor(FandV_OP_COEF, *this, 0, x.length(), w);
+  _fmpz_poly_normalise(x._poly());
+}
 
 // Keygen
 void FandV_par::keygen(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk) {
@@ -76,6 +280,38 @@ void FandV_par::keygen(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk) {
   
   RNGScope scope;
   
+  keygenfrom(pk, sk, rlk,
+             [&]() { return(lround(R::runif(0.0,1.0))); },
+             [&](fmpzxx& x) { fmpz_rand(x, qpow); },
+             [&]() { return(lround(R::rnorm(0.0,sigma))); });
+  
+  // Make sure public key holds a copy of rlk so it can be passed onto ciphertexts
+  pk.rlki = pk.rlkl->add(rlk);
+}
+
+// Key set number stream of a batch seeded by seed.  Each gets its own
+// generator, so the keys do not depend on how a batch is split between threads.
+void FandV_par::keygenseeded(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk, unsigned long seed, unsigned long stream) const {
+  std::seed_seq ss{seed, stream};
+  std::mt19937_64 rng(ss);
+  std::normal_distribution<double> rnorm(0.0, sigma);
+  
+  keygenfrom(pk, sk, rlk,
+             [&]() { return((long) (rng() >> 63)); },
+             [&](fmpzxx& x) { // 0 to 2^qpow-1, as fmpz_rand
+               x = 0;
+               for(int i=0; i<qpow/64; i++)
+                 x = (x << 64) + fmpzxx((unsigned long) rng());
+               if(qpow%64 > 0)
+                 x = (x << (qpow%64)) + fmpzxx((unsigned long) (rng() >> (64 - qpow%64)));
+             },
+             [&]() { return(lround(rnorm(rng))); });
+}
+
+// The key generation proper, drawing s from rbit, the uniform parts from runif
+// and the error terms from rnorm.  The relinearisation key is not added to a
+// locker.
+void FandV_par::keygenfrom(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk, std::function<long()> rbit, std::function<void(fmpzxx&)> runif, std::function<long()> rnorm) const {
   // Public/private keys
   pk.p = *this;
   
@@ -93,46 +329,49 @@ void FandV_par::keygen(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk) {
   // Generate random parts
   for(unsigned int i=0; i<pk.p.Phi.length()-1; i++) {
     // s
-    sk.s.set_coeff(i, (int) lround(R::runif(0.0,1.0)));
+    sk.s.set_coeff(i, (int) rbit());
     
     // a
-    fmpz_rand(tmp, pk.p.qpow); // tmp \in (0, 2^q-1)
+    runif(tmp); // tmp \in (0, 2^q-1)
     tmp -= qo2p1; // tmp - 2^{q-1} + 1 \in (-2^{q-1}, 2^{q-1}]
     pk.p0.set_coeff(i, tmp);
     pk.p1.set_coeff(i, tmp);
     
     // e
-    e.set_coeff(i, (int) lround(R::rnorm(0.0,pk.p.sigma)));
+    e.set_coeff(i, (int) rnorm());
   }
   // -(a.s+e) ...
   pk.p0 = -( ((pk.p0*sk.s)%pk.p.Phi) + e );
   // ... mod q
   fmpz_polyxx_q(pk.p0, pk.p.q);
+  pk.precompute();
   
   // Relin key
   for(unsigned int i=0; i<pk.p.Phi.length()-1; i++) {
     // a0
-    fmpz_rand(tmp, pk.p.qpow); // tmp \in (0, 2^q-1)
+    runif(tmp); // tmp \in (0, 2^q-1)
     tmp -= qo2p1; // tmp - 2^{q-1} + 1 \in (-2^{q-1}, 2^{q-1}]
     rlk.rlk01.set_coeff(i, tmp);
     // a1
-    fmpz_rand(tmp, pk.p.qpow); // tmp \in (0, 2^q-1)
+    runif(tmp); // tmp \in (0, 2^q-1)
     tmp -= qo2p1; // tmp - 2^{q-1} + 1 \in (-2^{q-1}, 2^{q-1}]
     rlk.rlk11.set_coeff(i, tmp);
     
     // e
-    rlk.rlk00.set_coeff(i, (int) lround(R::rnorm(0.0,pk.p.sigma)));
-    rlk.rlk10.set_coeff(i, (int) lround(R::rnorm(0.0,pk.p.sigma)));
+    rlk.rlk00.set_coeff(i, (int) rnorm());
+    rlk.rlk10.set_coeff(i, (int) rnorm());
   }
   // e var will now hold s^2
   e = ((sk.s*sk.s)%pk.p.Phi);
   rlk.rlk00 = -( ((rlk.rlk01*sk.s)%pk.p.Phi) + rlk.rlk00 ) + e;
   fmpz_polyxx_q(rlk.rlk00, pk.p.q);
   rlk.rlk10 = -( ((rlk.rlk11*sk.s)%pk.p.Phi) + rlk.rlk10 ) + T*e;
-  fmpz_polyxx_q(rlk.rlk00, pk.p.q);
+  fmpz_polyxx_q(rlk.rlk10, pk.p.q);
   
-  // Make sure public key holds a copy of rlk so it can be passed onto ciphertexts
-  pk.rlki = pk.rlkl->add(rlk);
+  FHE_PROF_ALLOC(FandV_PROF_KEYS, fmpz_polyxx_bytes(pk.p0) + fmpz_polyxx_bytes(pk.p1) + fmpz_polyxx_bytes(sk.s) +
+                                  fmpz_polyxx_bytes(rlk.rlk00) + fmpz_polyxx_bytes(rlk.rlk01) + fmpz_polyxx_bytes(rlk.rlk10) + fmpz_polyxx_bytes(rlk.rlk11));
+  // Last use of s, so it can now be packed (and the plain copy wiped)
+  sk.pack();
 }
 
 // Save/load
@@ -157,8 +396,10 @@ void FandV_par::save(FILE* fp) const {
   // Phi
   print(fp, Phi);
   fprintf(fp, "\n");
+  // Plaintext encoding
+  fprintf(fp, "enc=%d:%d:%d\n", encoding, base, fracbits);
 }
-FandV_par::FandV_par(FILE* fp) {
+FandV_par::FandV_par(FILE* fp) : encoding(FandV_BINARY), base(2), fracbits(0) {
   // Check for header line
   char *buf = NULL; size_t bufn = 0;
   size_t len;
@@ -187,6 +428,14 @@ FandV_par::FandV_par(FILE* fp) {
   read(fp, Delta);
   // Phi
   read(fp, Phi);
+  // Plaintext encoding (absent from files written before encoders existed)
+  long pos = ftell(fp);
+  int encoding_, base_, fracbits_;
+  if(fscanf(fp, "\nenc=%d:%d:%d", &encoding_, &base_, &fracbits_) != 3) {
+    fseek(fp, pos, SEEK_SET);
+  } else {
+    setEncoding(encoding_, base_, fracbits_); // ... staying binary if invalid
+  }
   
   free(buf);
 }
@@ -13,15 +13,27 @@ using namespace flint;
 #include <Rcpp.h>
 using namespace Rcpp;
 
+#include <functional>
+
 class FandV_pk;
 class FandV_sk;
 class FandV_rlk;
 
+// Plaintext integer encoders.  All but the fractional encoder write the message
+// as signed digits d_i and recover it by evaluating sum d_i*base^i
+enum FandV_encoding {
+  FandV_BINARY = 0,     // |m| in binary, times sign(m) (original behaviour)
+  FandV_NAF = 1,        // non-adjacent form, digits in {-1,0,1}
+  FandV_BALANCED = 2,   // balanced base-b, digits in (-b/2, b/2]
+  FandV_FRACTIONAL = 3  // fixed point, 2^-k stored as -x^(d-k) since x^d = -1
+};
+
 class FandV_par {
   public:
     // Constructors
     FandV_par(int d_=4096, double sigma_=16.0, int qpow_=128, std::string t_="32768", int lambda_=0, int L_=0);
     FandV_par(const FandV_par& par);
+    FandV_par(FandV_par&& par);
     
     // Operators
     FandV_par& operator=(FandV_par par);
@@ -32,8 +44,25 @@ class FandV_par {
     void show_no_t();
     void show_t();
     std::string get_t();
+    std::string get_encoding();
+    
+    // Memory
+    double memoryUsage() const; // Bytes, including the multiprecision values
+    std::size_t ctBytes() const; // Nominal bytes of a fresh cipher text's polynomials
+    
+    // Plaintext encoding
+    void setEncoding(int encoding_, int base_, int fracbits_);
+    void encode(fmpzxx m, fmpz_polyxx& mP) const;
+    void encodefrac(double m, fmpz_polyxx& mP) const;
+    std::string decode(const fmpz_polyxx& mP) const;
+    
+    // Scale and round: x <- [round(t*x/q)]_m coefficient-wise, m being q or t
+    void scaleRound(fmpz_polyxx& x, const fmpzxx& m) const;
     
     void keygen(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk);
+    // ... from a native generator instead of R's, so safe off the main thread.
+    // The relinearisation key is not added to pk's locker.
+    void keygenseeded(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk, unsigned long seed, unsigned long stream) const;
     
     // Save/load
     void save(FILE* fp) const;
@@ -46,6 +75,10 @@ class FandV_par {
     fmpzxx q, t, T, Delta; // Coefficient modulo values
     fmpz_polyxx Phi; // Cyclotomic polynomial defining ring modulo
     int lambda, L;
+    int encoding, base, fracbits; // Plaintext encoder (see FandV_encoding)
+    
+  private:
+    void keygenfrom(FandV_pk& pk, FandV_sk& sk, FandV_rlk& rlk, std::function<long()> rbit, std::function<void(fmpzxx&)> runif, std::function<long()> rnorm) const;
 };
 
 #endif
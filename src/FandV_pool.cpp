@@ -0,0 +1,98 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <random>
+#include <algorithm>
+
+#include "FandV_keys.h"
+#include "FandV_ct.h"
+#include "FandV_pool.h"
+
+// Construct, capping the size so the pool stays under maxbytes and starting the
+// background threads which fill it
+FandV_enc_pool::FandV_enc_pool(const FandV_pk& pk_, std::size_t size_, std::size_t refill_, double maxbytes, int threads) : pk(pk_), size(size_), refill(refill_), pending(0), stop(false) {
+  pk.pool.reset();
+  
+  // Each coefficient of c0 and c1 is an fmpz plus (beyond 62 bits) a heap mpz
+  double entrybytes = 2.0 * pk.p.Phi.length() * (sizeof(fmpz) + 32.0 + pk.p.qpow/8.0);
+  if(maxbytes > 0.0 && size*entrybytes > maxbytes) {
+    size = (std::size_t) (maxbytes/entrybytes);
+  }
+  refill = std::min(refill, size);
+  
+  std::random_device rd;
+  for(int i=0; i<std::max(threads, 1) && size>0; i++) {
+    workers.push_back(std::thread(&FandV_enc_pool::fill, this, ((unsigned long) rd() << 32) ^ rd()));
+  }
+}
+FandV_enc_pool::~FandV_enc_pool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  wake.notify_all();
+  for(unsigned int i=0; i<workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+// Background thread: sleep until the pool drops below the refill threshold, then
+// top it back up to size
+void FandV_enc_pool::fill(unsigned long seed) {
+  std::mt19937_64 rng(seed);
+  std::normal_distribution<double> rnorm(0.0, pk.p.sigma);
+  bool filling = true;
+  
+  std::unique_lock<std::mutex> guard(lock);
+  while(!stop) {
+    if(zeros.size() + pending >= size) {
+      filling = false;
+    } else if(zeros.size() + pending < refill) {
+      filling = true;
+    }
+    if(!filling) {
+      wake.wait(guard);
+      continue;
+    }
+    
+    pending++;
+    guard.unlock();
+    FandV_ct ct(pk.p, pk.rlkl, pk.rlki);
+    pk.enczero(ct, [&]() { return(lround(rnorm(rng))); });
+    guard.lock();
+    pending--;
+    zeros.push_back(std::move(ct));
+  }
+}
+
+bool FandV_enc_pool::pop(FandV_ct& ct) {
+  std::lock_guard<std::mutex> guard(lock);
+  if(zeros.empty())
+    return(false);
+  ct.swap(ct, zeros.front());
+  zeros.pop_front();
+  if(zeros.size() + pending < refill)
+    wake.notify_all();
+  return(true);
+}
+
+std::size_t FandV_enc_pool::available() {
+  std::lock_guard<std::mutex> guard(lock);
+  return(zeros.size());
+}
+double FandV_enc_pool::memoryUsage() {
+  std::lock_guard<std::mutex> guard(lock);
+  double bytes = sizeof(FandV_enc_pool) + pk.memoryUsage();
+  for(unsigned int i=0; i<zeros.size(); i++) {
+    bytes += zeros[i].memoryUsage();
+  }
+  return(bytes);
+}
+std::size_t FandV_enc_pool::capacity() const {
+  return(size);
+}
@@ -0,0 +1,52 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_pool_H
+#define FandV_pool_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+#include "FandV_keys.h"
+
+class FandV_ct;
+
+// Pool of encryptions of zero, refilled by background threads, so that an
+// encryption only has to add Delta*m to a popped entry.  The background threads
+// sample with their own generators, never R's, so pooled encryptions do not
+// follow set.seed().
+class FandV_enc_pool {
+  public:
+    // Constructors
+    FandV_enc_pool(const FandV_pk& pk_, std::size_t size_, std::size_t refill_, double maxbytes, int threads);
+    ~FandV_enc_pool();
+    
+    // Take an encryption of zero, returning false if the pool is empty
+    bool pop(FandV_ct& ct);
+    
+    // Entries currently ready and the most the pool will hold
+    std::size_t available();
+    std::size_t capacity() const;
+    double memoryUsage();
+    
+  private:
+    void fill(unsigned long seed);
+    
+    FandV_pk pk; // Copy without a pool of its own
+    std::size_t size, refill;
+    
+    std::deque<FandV_ct> zeros;
+    std::size_t pending; // Entries being computed
+    bool stop;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<std::thread> workers;
+};
+
+#endif
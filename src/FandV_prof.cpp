@@ -0,0 +1,121 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "FandV_prof.h"
+
+#ifdef FHE_PROFILE
+
+static const char* FandV_prof_opnames[FandV_PROF_NOPS] = { "enc", "mul", "relin", "rescale", "add", "dec", "save", "load" };
+static const char* FandV_prof_typenames[FandV_PROF_NTYPES] = { "ct", "ct_vec", "ct_mat", "keys" };
+
+// Counters for one thread.  Only that thread writes them, but R may read or
+// reset them at any time, hence relaxed atomics.
+struct FandV_prof_thread {
+  FandV_prof_thread() {
+    for(int i=0; i<FandV_PROF_NOPS; i++) { calls[i] = 0; ns[i] = 0; }
+    for(int i=0; i<FandV_PROF_NTYPES; i++) { allocs[i] = 0; bytes[i] = 0; }
+  }
+  std::atomic<unsigned long long> calls[FandV_PROF_NOPS], ns[FandV_PROF_NOPS];
+  std::atomic<unsigned long long> allocs[FandV_PROF_NTYPES], bytes[FandV_PROF_NTYPES];
+};
+
+// Every thread which has recorded anything, kept alive after the thread exits so
+// pool threads' work is not lost
+static std::mutex FandV_prof_lock;
+static std::vector< std::shared_ptr<FandV_prof_thread> > FandV_prof_threads;
+
+static FandV_prof_thread& FandV_prof_this() {
+  thread_local std::shared_ptr<FandV_prof_thread> mine;
+  if(!mine) {
+    mine = std::make_shared<FandV_prof_thread>();
+    std::lock_guard<std::mutex> guard(FandV_prof_lock);
+    FandV_prof_threads.push_back(mine);
+  }
+  return(*mine);
+}
+
+void FandV_prof_time(FandV_prof_op op, long long ns) {
+  FandV_prof_thread& t = FandV_prof_this();
+  t.calls[op].fetch_add(1, std::memory_order_relaxed);
+  t.ns[op].fetch_add(ns, std::memory_order_relaxed);
+}
+void FandV_prof_alloc(FandV_prof_type type, std::size_t bytes) {
+  FandV_prof_thread& t = FandV_prof_this();
+  t.allocs[type].fetch_add(1, std::memory_order_relaxed);
+  t.bytes[type].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+#endif
+
+bool FandV_prof_enabled() {
+#ifdef FHE_PROFILE
+  return(true);
+#else
+  return(false);
+#endif
+}
+
+// One row per thread and counter which has been used
+DataFrame FandV_prof() {
+  std::vector<int> thread;
+  std::vector<std::string> counter;
+  std::vector<double> calls, ns, bytes;
+  
+#ifdef FHE_PROFILE
+  std::lock_guard<std::mutex> guard(FandV_prof_lock);
+  for(unsigned int i=0; i<FandV_prof_threads.size(); i++) {
+    FandV_prof_thread& t = *FandV_prof_threads[i];
+    for(int j=0; j<FandV_PROF_NOPS; j++) {
+      if(t.calls[j].load(std::memory_order_relaxed) == 0) continue;
+      thread.push_back(i+1);
+      counter.push_back(FandV_prof_opnames[j]);
+      calls.push_back(t.calls[j].load(std::memory_order_relaxed));
+      ns.push_back(t.ns[j].load(std::memory_order_relaxed));
+      bytes.push_back(0.0);
+    }
+    for(int j=0; j<FandV_PROF_NTYPES; j++) {
+      if(t.allocs[j].load(std::memory_order_relaxed) == 0) continue;
+      thread.push_back(i+1);
+      counter.push_back(std::string("alloc:") + FandV_prof_typenames[j]);
+      calls.push_back(t.allocs[j].load(std::memory_order_relaxed));
+      ns.push_back(0.0);
+      bytes.push_back(t.bytes[j].load(std::memory_order_relaxed));
+    }
+  }
+#endif
+  
+  return(DataFrame::create(Named("thread")=IntegerVector(thread),
+                           Named("counter")=CharacterVector(counter),
+                           Named("calls")=NumericVector(calls),
+                           Named("ns")=NumericVector(ns),
+                           Named("bytes")=NumericVector(bytes),
+                           Named("stringsAsFactors")=false));
+}
+
+void FandV_prof_reset() {
+#ifdef FHE_PROFILE
+  std::lock_guard<std::mutex> guard(FandV_prof_lock);
+  for(unsigned int i=0; i<FandV_prof_threads.size(); i++) {
+    FandV_prof_thread& t = *FandV_prof_threads[i];
+    for(int j=0; j<FandV_PROF_NOPS; j++) {
+      t.calls[j].store(0, std::memory_order_relaxed);
+      t.ns[j].store(0, std::memory_order_relaxed);
+    }
+    for(int j=0; j<FandV_PROF_NTYPES; j++) {
+      t.allocs[j].store(0, std::memory_order_relaxed);
+      t.bytes[j].store(0, std::memory_order_relaxed);
+    }
+  }
+#endif
+}
@@ -0,0 +1,74 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_prof_H
+#define FandV_prof_H
+
+#include "../config.h"
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <cstddef>
+
+// Optional instrumentation of the hot paths, compiled in only when FHE_PROFILE
+// is defined (R CMD INSTALL --configure-vars='FHE_PROFILE=1').  Each thread keeps
+// its own call counts, cumulative nanoseconds and bytes allocated, so the only
+// cost is two clock reads per timed call.  Timings are inclusive: mul includes
+// the rescale and relin time also reported separately.
+enum FandV_prof_op {
+  FandV_PROF_ENC = 0,
+  FandV_PROF_MUL,
+  FandV_PROF_RELIN,
+  FandV_PROF_RESCALE,
+  FandV_PROF_ADD,
+  FandV_PROF_DEC,
+  FandV_PROF_SAVE,
+  FandV_PROF_LOAD,
+  FandV_PROF_NOPS
+};
+enum FandV_prof_type {
+  FandV_PROF_CT = 0,
+  FandV_PROF_CT_VEC,
+  FandV_PROF_CT_MAT,
+  FandV_PROF_KEYS,
+  FandV_PROF_NTYPES
+};
+
+// R interface: counters so far (empty unless compiled in) and zeroing them
+bool FandV_prof_enabled();
+DataFrame FandV_prof();
+void FandV_prof_reset();
+
+#ifdef FHE_PROFILE
+
+#include <chrono>
+
+void FandV_prof_time(FandV_prof_op op, long long ns);
+void FandV_prof_alloc(FandV_prof_type type, std::size_t bytes);
+
+// Times the enclosing scope
+class FandV_prof_timer {
+  public:
+    FandV_prof_timer(FandV_prof_op op_) : op(op_), start(std::chrono::steady_clock::now()) { }
+    ~FandV_prof_timer() {
+      FandV_prof_time(op, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+  private:
+    FandV_prof_op op;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define FHE_PROF(op) FandV_prof_timer FandV_prof_timer_(op)
+#define FHE_PROF_ALLOC(type, bytes) FandV_prof_alloc(type, bytes)
+
+#else
+
+#define FHE_PROF(op)
+#define FHE_PROF_ALLOC(type, bytes)
+
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include <thread>
+#include <algorithm>
+
+#include "FandV_ct.h"
+#include "FandV_reduce.h"
+#include "FandV_sched.h"
+
+// Chunk c of output i sums terms k in [c*chunk, min((c+1)*chunk, len))
+struct FandV_SumsPart : public Worker {
+  // Input cipher texts and layout
+  const std::vector<FandV_ct_ptr>* x;
+  const std::size_t si, sk, len, chunks, chunk;
+
+  // Partial sums, chunks per output
+  std::vector< std::shared_ptr<FandV_ct> >* part;
+
+  // Constructor
+  FandV_SumsPart(const std::vector<FandV_ct_ptr>* x_, std::vector< std::shared_ptr<FandV_ct> >* part_, const std::size_t si_, const std::size_t sk_, const std::size_t len_, const std::size_t chunks_) : si(si_), sk(sk_), len(len_), chunks(chunks_), chunk((len_+chunks_-1)/chunks_) { x=x_; part=part_; }
+
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t t = begin; t < end; t++) {
+      std::size_t i = t/chunks;
+      std::size_t from = (t%chunks)*chunk, to = std::min(len, from + chunk);
+      if(from >= to)
+        continue;
+      std::shared_ptr<FandV_ct> acc = std::make_shared<FandV_ct>(*x->at(i*si + from*sk));
+      for(std::size_t k = from+1; k < to; k++) {
+        acc->addEq(*x->at(i*si + k*sk));
+      }
+      part->at(t) = acc;
+    }
+  }
+};
+
+// Combine the partial sums of each output
+struct FandV_SumsJoin : public Worker {
+  std::vector< std::shared_ptr<FandV_ct> >* part;
+  const std::size_t chunks;
+
+  // Output cipher texts
+  std::vector< std::shared_ptr<FandV_ct> >* res;
+
+  // Constructor
+  FandV_SumsJoin(std::vector< std::shared_ptr<FandV_ct> >* part_, std::vector< std::shared_ptr<FandV_ct> >* res_, const std::size_t chunks_) : chunks(chunks_) { part=part_; res=res_; }
+
+  // function call operator that work for the specified range (begin/end)
+  void operator()(std::size_t begin, std::size_t end) {
+    for(std::size_t i = begin; i < end; i++) {
+      std::shared_ptr<FandV_ct>& acc = part->at(i*chunks);
+      for(std::size_t c = 1; c < chunks; c++) {
+        if(!part->at(i*chunks + c))
+          continue;
+        acc->addEq(*part->at(i*chunks + c));
+      }
+      res->at(i) = acc;
+    }
+  }
+};
+
+void FandV_sums(const std::vector<FandV_ct_ptr>& x, std::size_t n, std::size_t len, std::size_t si, std::size_t sk, std::vector< std::shared_ptr<FandV_ct> >& res) {
+  res.assign(n, std::shared_ptr<FandV_ct>());
+  if(n == 0 || len == 0)
+    return;
+  const FandV_par& p = x[0]->p;
+
+  // Only cut the sums into chunks when the whole job is worth threading and
+  // there are too few outputs to occupy the threads
+  std::size_t chunks = 1;
+  if(FandV_schedule(FandV_OP_ADD, p, n*len).parallel) {
+    int threads = FandV_getThreads();
+    if(threads == 0)
+      threads = std::max((int) std::thread::hardware_concurrency(), 1);
+    chunks = std::max(std::min(((std::size_t) threads + n - 1)/n, len), (std::size_t) 1);
+  }
+
+  std::vector< std::shared_ptr<FandV_ct> > part(n*chunks);
+  FandV_SumsPart partEngine(&x, &part, si, sk, len, chunks);
+  FandV_parallelFor(FandV_OP_ADD, p, 0, n*chunks, partEngine, (double) len/chunks);
+
+  FandV_SumsJoin joinEngine(&part, &res, chunks);
+  FandV_parallelFor(FandV_OP_ADD, p, 0, n, joinEngine, chunks);
+}
@@ -0,0 +1,22 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_reduce_H
+#define FandV_reduce_H
+
+#include <vector>
+#include <memory>
+
+#include "FandV_ct.h"
+
+// Sums over a 2-D layout of cipher texts: res[i] = sum over k of x[i*si + k*sk]
+// for n outputs of len terms each.  The work is split along both dimensions:
+// when there are fewer outputs than threads each sum is also cut into chunks of
+// k, summed into separate partial accumulators and combined at the end, so a
+// tall matrix's colSums (or a whole vector's sum) uses every thread rather than
+// one per output.  Each result is freshly allocated.
+void FandV_sums(const std::vector<FandV_ct_ptr>& x, std::size_t n, std::size_t len, std::size_t si, std::size_t sk, std::vector< std::shared_ptr<FandV_ct> >& res);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+
+#include "FandV_sched.h"
+
+static std::atomic<int> FandV_threads(0);
+
+void FandV_setThreads(int threads) {
+  FandV_threads = std::max(threads, 0);
+}
+int FandV_getThreads() {
+  return(FandV_threads.load());
+}
+
+// Rough nanoseconds per element.  Coefficients mod q take about qpow/64 limbs;
+// additions are linear in d, while a multiplication does four polynomial
+// products (FLINT's Kronecker substitution, ~ d log d) plus the scale and round.
+static double FandV_cost(FandV_sched_op op, const FandV_par& p) {
+  double d = std::max((double) p.Phi.length()-1, 1.0);
+  double limbs = p.qpow/64.0 + 1.0;
+  switch(op) {
+    case FandV_OP_ADD:
+      return(2.0 * d * limbs);
+    case FandV_OP_MUL:
+      return(30.0 * d * log2(d+1.0) * limbs * limbs);
+    case FandV_OP_ENC:
+      return(20.0 * d * log2(d+1.0) * limbs);
+    case FandV_OP_IO:
+      return(4.0 * d * limbs);
+    case FandV_OP_COEF:
+      return(15.0 * limbs);
+    case FandV_OP_PTR:
+      return(10.0);
+  }
+  return(d);
+}
+
+FandV_sched FandV_schedule(FandV_sched_op op, const FandV_par& p, std::size_t n, double per) {
+  const double taskns = 200000.0; // Aim for tasks of ~0.2ms, well above TBB's overhead
+  FandV_sched s;
+  double cost = FandV_cost(op, p) * std::max(per, 1.0);
+  
+  int cap = FandV_threads.load();
+  int hw = std::max((int) std::thread::hardware_concurrency(), 1);
+  int most = cap > 0 ? std::min(cap, hw) : hw;
+  
+  s.grain = std::max((std::size_t) ceil(taskns/cost), (std::size_t) 1);
+  std::size_t tasks = (n + s.grain - 1)/s.grain;
+  s.parallel = most > 1 && tasks > 1;
+  if(!s.parallel) {
+    s.threads = 1;
+    return(s);
+  }
+  
+  // Spread the tasks over threads, but no more threads than there are tasks
+  if(tasks < (std::size_t) most) {
+    s.threads = (int) tasks;
+  } else {
+    s.threads = cap > 0 ? most : -1;
+  }
+  return(s);
+}
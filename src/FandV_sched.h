@@ -0,0 +1,79 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_sched_H
+#define FandV_sched_H
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include <cstddef>
+
+#include "FandV_par.h"
+#include "FandV_mem.h"
+
+// Kinds of per element work, for costing
+enum FandV_sched_op {
+  FandV_OP_ADD = 0, // add/sub of cipher texts, plaintext scalar multiply-add
+  FandV_OP_MUL,     // cipher text multiply including relinearisation
+  FandV_OP_ENC,     // encryption
+  FandV_OP_IO,      // copying/converting one cipher text record
+  FandV_OP_COEF,    // scaling/reducing one polynomial coefficient
+  FandV_OP_PTR      // sharing one cipher text (a reference count update)
+};
+
+// How to run a loop over n elements: serially, or in parallel with a given grain
+// size and thread count (-1 leaves RcppParallel's default)
+struct FandV_sched {
+  bool parallel;
+  std::size_t grain;
+  int threads;
+};
+
+// Cost model: the estimated time per element from d and qpow (times per, the
+// number of op each element does) decides whether a loop of n elements is worth
+// spreading over threads and how large each task should be so scheduling
+// overhead stays small
+FandV_sched FandV_schedule(FandV_sched_op op, const FandV_par& p, std::size_t n, double per=1.0);
+
+// Upper limit on threads used by the package's kernels (0 means no limit).  This
+// is the package's own setting and leaves RcppParallel's global options alone.
+void FandV_setThreads(int threads);
+int FandV_getThreads();
+
+// Drop in replacements for parallelFor/parallelReduce using the schedule.  Any
+// garbage collection wanted while the loop ran is done once it has returned.
+template <typename W>
+void FandV_parallelFor(FandV_sched_op op, const FandV_par& p, std::size_t begin, std::size_t end, W& worker, double per=1.0) {
+  if(end <= begin)
+    return;
+  FandV_sched s = FandV_schedule(op, p, end-begin, per);
+  {
+    FandV_mem_hold hold;
+    if(s.parallel) {
+      parallelFor(begin, end, worker, s.grain, s.threads);
+    } else {
+      worker(begin, end);
+    }
+  }
+  FandV_mem_service();
+}
+template <typename R>
+void FandV_parallelReduce(FandV_sched_op op, const FandV_par& p, std::size_t begin, std::size_t end, R& reducer, double per=1.0) {
+  if(end <= begin)
+    return;
+  FandV_sched s = FandV_schedule(op, p, end-begin, per);
+  {
+    FandV_mem_hold hold;
+    if(s.parallel) {
+      parallelReduce(begin, end, reducer, s.grain, s.threads);
+    } else {
+      reducer(begin, end);
+    }
+  }
+  FandV_mem_service();
+}
+
+#endif
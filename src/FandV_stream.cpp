@@ -0,0 +1,255 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#include <Rcpp.h>
+using namespace Rcpp;
+
+#include <RcppParallel.h>
+using namespace RcppParallel;
+
+#include <iostream>
+#include "getline.h"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <memory>
+#include <exception>
+#include <stdexcept>
+#include <errno.h>
+
+#include "FandV_ct.h"
+#include "FandV_ct_vec.h"
+#include "FandV_stream.h"
+#include "FandV_sched.h"
+#include "FandV_mem.h"
+#include "FandV.h"
+
+// Construct, checking and reading the header of every file.  A file which
+// cannot be read fails the whole reduction rather than being left out of it.
+FandV_ct_reader::FandV_ct_reader(const std::vector<std::string>& files_, FandV_rlk_locker* rlkl_) : filei(0), total(0), fp(NULL), remaining(0), rlkl(rlkl_) {
+  for(unsigned int i=0; i<files_.size(); i++) {
+    const char *file_c = files_[i].c_str();
+    FILE *f = fopen(file_c, "r");
+    if(f == NULL) {
+      throw std::runtime_error("cannot open " + files_[i] + ": " + strerror(errno));
+    }
+
+    // Check for header line
+    char *buf = NULL; size_t bufn = 0;
+    size_t len;
+    len = getline(&buf, &bufn, f);
+    if(strncmp("=> FHE pkg obj <=\n", buf, len) != 0) {
+      free(buf);
+      fclose(f);
+      throw std::runtime_error(files_[i] + " does not contain an FHE object");
+    }
+    len = getline(&buf, &bufn, f);
+    if(strncmp("Rcpp_FandV_ct_vec\n", buf, len) != 0) {
+      free(buf);
+      fclose(f);
+      throw std::runtime_error(files_[i] + " does not contain a ciphertext vector object");
+    }
+
+    // pars
+    FandV_par p(f);
+    len = getline(&buf, &bufn, f); // Advance past the new line
+    // rlk
+    FandV_rlk rlk(f);
+    len = getline(&buf, &bufn, f); // Advance past the new line
+    // ct_vec header
+    int n;
+    len = getline(&buf, &bufn, f);
+    len = getline(&buf, &bufn, f);
+    if(strncmp("Rcpp_FandV_ct_vec\n", buf, len) != 0 || fscanf(f, "n=%d\n", &n) != 1 || n < 0) {
+      free(buf);
+      fclose(f);
+      throw std::runtime_error(files_[i] + " does not contain a vector of ciphertext objects");
+    }
+
+    files.push_back(files_[i]);
+    pos.push_back(ftell(f));
+    sizes.push_back(n);
+    pars.push_back(p);
+    rlkis.push_back(rlkl->add(rlk));
+    free(buf);
+    fclose(f);
+  }
+}
+FandV_ct_reader::~FandV_ct_reader() {
+  if(fp != NULL) fclose(fp);
+}
+
+// Move on to the start of the cipher texts in the next file
+bool FandV_ct_reader::openNext() {
+  if(fp != NULL) {
+    fclose(fp);
+    fp = NULL;
+  }
+  if(filei >= files.size())
+    return(false);
+  fp = fopen(files[filei].c_str(), "r");
+  if(fp == NULL)
+    throw std::runtime_error("cannot reopen " + files[filei] + ": " + strerror(errno));
+  fseek(fp, pos[filei], SEEK_SET);
+  remaining = sizes[filei++];
+  return(true);
+}
+
+std::size_t FandV_ct_reader::next(std::size_t n, FandV_ct_vec& out) {
+  out.vec.clear();
+  out.vec.reserve(n);
+  while(out.vec.size() < n) {
+    if(remaining == 0 && !openNext())
+      break;
+    const FandV_par& p = pars[filei-1];
+    size_t rlki = rlkis[filei-1];
+    for(; remaining > 0 && out.vec.size() < n; remaining--) {
+      int ch = fgetc(fp);
+      if(ch == EOF)
+        throw std::runtime_error(files[filei-1] + " holds fewer cipher texts than its header states");
+      ungetc(ch, fp);
+      out.vec.push_back(std::make_shared<const FandV_ct>(fp, p, rlkl, rlki));
+    }
+  }
+  total += out.vec.size();
+  return(out.vec.size());
+}
+std::size_t FandV_ct_reader::count() const {
+  return(total);
+}
+
+// Drive a reduction: the calling (R) thread parses chunk k+1 while a helper
+// thread runs the parallel arithmetic on chunk k, so at most two chunks are
+// ever held in memory.  y, if given, is read in lock step with x.
+template <typename Reduce>
+static void FandV_stream(FandV_ct_reader& x, FandV_ct_reader* y, std::size_t chunk, Reduce reduce) {
+  FandV_mem_hold hold; // No collection while the helper is working
+  FandV_ct_vec cur, nxt, ycur, ynxt;
+  x.next(chunk, cur);
+  if(y != NULL) y->next(chunk, ycur);
+
+  while(cur.size() > 0) {
+    std::exception_ptr failed;
+    std::thread worker([&]() {
+      try {
+        reduce(cur, ycur);
+      } catch(...) {
+        failed = std::current_exception(); // Rethrown on R's thread below
+      }
+    });
+    try {
+      x.next(chunk, nxt);
+      if(y != NULL) y->next(chunk, ynxt);
+    } catch(...) {
+      worker.join(); // The helper must finish before its chunk goes out of scope
+      throw;
+    }
+    worker.join();
+    if(failed)
+      std::rethrow_exception(failed);
+
+    cur.swap(cur, nxt);
+    ycur.swap(ycur, ynxt);
+  }
+}
+
+// Fold a chunk's partial result into the running total (addEq keeps the
+// coefficients bounded however many chunks there are)
+static void FandV_stream_acc(std::unique_ptr<FandV_ct>& acc, FandV_ct& partial) {
+  if(!acc) {
+    acc.reset(new FandV_ct(std::move(partial)));
+  } else {
+    acc->addEq(partial);
+  }
+}
+static FandV_ct FandV_stream_result(std::unique_ptr<FandV_ct>& acc) {
+  if(!acc)
+    throw std::runtime_error("no cipher texts were read");
+  return(std::move(*acc));
+}
+
+FandV_ct stream_FandV_sum(std::vector<std::string> files, FandV_rlk_locker* rlkl, int chunk) {
+  FandV_ct_reader x(files, rlkl);
+  std::unique_ptr<FandV_ct> acc;
+
+  FandV_stream(x, NULL, std::max(chunk, 1), [&](const FandV_ct_vec& c, const FandV_ct_vec&) {
+    FandV_ct partial = c.sumParallel();
+    FandV_stream_acc(acc, partial);
+  });
+
+  return(FandV_stream_result(acc));
+}
+
+struct FandV_StreamDot : public Worker {
+  // Source chunk and its plaintext weights
+  const std::vector<FandV_ct_ptr>* input;
+  const std::vector<fmpzxx>* w;
+  const std::size_t offset;
+
+  // Accumulated value
+  FandV_ct value;
+
+  // Constructors
+  FandV_StreamDot(const std::vector<FandV_ct_ptr>* input_, const std::vector<fmpzxx>* w_, std::size_t offset_) : input(input_), w(w_), offset(offset_), value(input_->at(0)->p, input_->at(0)->rlkl, input_->at(0)->rlki) { }
+  FandV_StreamDot(const FandV_StreamDot& dot, Split) : input(dot.input), w(dot.w), offset(dot.offset), value(dot.input->at(0)->p, dot.input->at(0)->rlkl, dot.input->at(0)->rlki) { }
+
+  // Accumulate, skipping zero weights
+  void operator()(std::size_t begin, std::size_t end) {
+    for(; begin<end; begin++) {
+      const fmpzxx& k = w->at(offset + begin);
+      if(k != 0)
+        value.addmulEq(*input->at(begin), k);
+    }
+  }
+
+  void join(const FandV_StreamDot& rhs) {
+    value.addEq(rhs.value);
+  }
+};
+FandV_ct stream_FandV_innerprod(std::vector<std::string> files, IntegerVector w, FandV_rlk_locker* rlkl, int chunk) {
+  FandV_ct_reader x(files, rlkl);
+  std::unique_ptr<FandV_ct> acc;
+  std::vector<fmpzxx> wz(w.size()); // No R objects touched off the main thread
+  for(int i=0; i<w.size(); i++)
+    wz[i] = w[i];
+  std::size_t offset = 0;
+  bool tooShort = false;
+
+  FandV_stream(x, NULL, std::max(chunk, 1), [&](const FandV_ct_vec& c, const FandV_ct_vec&) {
+    if(tooShort || offset + c.vec.size() > wz.size()) {
+      tooShort = true;
+      return;
+    }
+    FandV_StreamDot dot(&(c.vec), &wz, offset);
+    FandV_parallelReduce(FandV_OP_ADD, c.vec[0]->p, 0, c.vec.size(), dot);
+    offset += c.vec.size();
+    FandV_stream_acc(acc, dot.value);
+  });
+
+  if(tooShort || x.count() != wz.size()) {
+    throw std::runtime_error(std::to_string(x.count()) + " cipher texts read but " + std::to_string(wz.size()) + " weights supplied");
+  }
+  return(FandV_stream_result(acc));
+}
+
+FandV_ct stream_FandV_wsum(std::vector<std::string> files, std::vector<std::string> countfiles, FandV_rlk_locker* rlkl, int chunk) {
+  FandV_ct_reader x(files, rlkl), y(countfiles, rlkl);
+  std::unique_ptr<FandV_ct> acc;
+  bool mismatch = false;
+
+  FandV_stream(x, &y, std::max(chunk, 1), [&](const FandV_ct_vec& c, const FandV_ct_vec& n) {
+    if(mismatch || c.vec.size() != n.vec.size()) {
+      mismatch = true;
+      return;
+    }
+    FandV_ct partial = c.innerprod(n);
+    FandV_stream_acc(acc, partial);
+  });
+
+  if(mismatch || x.count() != y.count()) {
+    throw std::runtime_error("value and count files hold different numbers of cipher texts");
+  }
+  return(FandV_stream_result(acc));
+}
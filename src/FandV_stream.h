@@ -0,0 +1,53 @@
+/*
+ Louis Aslett (aslett@stats.ox.ac.uk)
+ October 2026
+*/
+
+#ifndef FandV_stream_H
+#define FandV_stream_H
+
+#include <vector>
+#include <string>
+
+#include "FandV_par.h"
+
+class FandV_ct;
+class FandV_ct_vec;
+class FandV_rlk_locker;
+
+// Sequential reader over one or more saved cipher text vector files (as written
+// by saveFHE), handing back a chunk of cipher texts at a time
+class FandV_ct_reader {
+  public:
+    // Constructors
+    FandV_ct_reader(const std::vector<std::string>& files_, FandV_rlk_locker* rlkl_);
+    ~FandV_ct_reader();
+
+    // Parse up to n more cipher texts into out (replacing its contents), returns
+    // the number read which is 0 once every file is exhausted
+    std::size_t next(std::size_t n, FandV_ct_vec& out);
+    std::size_t count() const;
+
+  private:
+    bool openNext();
+
+    // Headers of every file are read up front, so relin keys are never added to
+    // the locker while a reduction may be using it
+    std::vector<std::string> files;
+    std::vector<long> pos; // Start of the cipher texts in each file
+    std::vector<int> sizes;
+    std::vector<FandV_par> pars;
+    std::vector<size_t> rlkis;
+    std::size_t filei, total;
+    FILE* fp;
+    int remaining;
+    FandV_rlk_locker* rlkl;
+};
+
+// Streaming reductions, pipelining parsing of the next chunk with arithmetic on
+// the current one
+FandV_ct stream_FandV_sum(std::vector<std::string> files, FandV_rlk_locker* rlkl, int chunk);
+FandV_ct stream_FandV_innerprod(std::vector<std::string> files, IntegerVector w, FandV_rlk_locker* rlkl, int chunk);
+FandV_ct stream_FandV_wsum(std::vector<std::string> files, std::vector<std::string> countfiles, FandV_rlk_locker* rlkl, int chunk);
+
+#endif